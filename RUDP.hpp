@@ -0,0 +1,238 @@
+#ifndef RUDP_HPP
+#define RUDP_HPP
+
+// C++20 interface to the RUDP library: one rudp::Connection owns one RUDP_Socket and closes it when it goes out
+// of scope. Header only, link the same objects a C program does (RUDP_Smoke in the makefile is built this way):
+//     g++ -std=c++20 app.cpp RUDP_API.o RUDP_FEC.o RUDP_Session.o RUDP_Hash.o RUDP_LZ.o RUDP_Pool.o RUDP_Shm.o
+//         RUDP_Multipath.o RUDP_Multicast.o RUDP_Spin.o -pthread -lm
+// Checksum, congestion and ACK behaviour are template parameters. A congestion policy's own grow() and reduce()
+// become the connection's window hooks, and only the setup a policy needs is compiled in, so nothing on the send,
+// ACK or loss paths tests which policy is in force.
+
+#include <concepts>
+#include <cstddef>
+#include <initializer_list>
+#include <span>
+#include <type_traits>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include "RUDP_API.h"
+}
+
+namespace rudp {
+
+// Checksum policies: whether every payload carries the RUDP checksum, or integrity is left to the UDP checksum.
+// Turning it off is negotiated, a server built with SoftwareChecksum keeps it on for both directions.
+struct SoftwareChecksum {
+    static constexpr bool software = true;
+};
+struct KernelChecksum {
+    static constexpr bool software = false;
+};
+
+// Congestion policies: the window a connection starts with, grow() as segments are acknowledged and reduce() on
+// loss (see RUDP_Congestion). Reno probes from the initial window and backs off on loss, FixedWindow keeps the
+// window it is given, for links the application has to itself. Any type with the same members plugs in.
+template <unsigned int InitialWindow = RUDP_INIT_CWND>
+struct Reno {
+    static_assert(InitialWindow >= 1 && InitialWindow <= RUDP_WINDOW, "window must be 1..RUDP_WINDOW segments");
+    static constexpr unsigned int window = InitialWindow;
+    static void grow(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked) noexcept {
+        rudp_reno_grow(cwnd, cwnd_acked, ssthresh, acked);
+    }
+    static void reduce(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout) noexcept {
+        rudp_reno_reduce(cwnd, ssthresh, flight, timeout);
+    }
+};
+template <unsigned int Window>
+struct FixedWindow {
+    static_assert(Window >= 1 && Window <= RUDP_WINDOW, "window must be 1..RUDP_WINDOW segments");
+    static constexpr unsigned int window = Window;
+    static void grow(unsigned int *, unsigned int *, unsigned int, unsigned int) noexcept {}
+    static void reduce(unsigned int *, unsigned int *, unsigned int, bool) noexcept {}
+};
+
+// ACK policies: acknowledge every Every-th segment, or after DelayMs, whichever comes first
+template <unsigned int Every = RUDP_ACK_EVERY, unsigned int DelayMs = RUDP_ACK_DELAY_MS>
+struct DelayedAck {
+    static_assert(Every >= 1, "ACK at least every segment");
+    static constexpr unsigned int every = Every;
+    static constexpr unsigned int delay_ms = DelayMs;
+};
+using ImmediateAck = DelayedAck<1, 0>;
+
+// How the data moves: through shared-memory rings when the peer runs on this host, or always over UDP. Only the UDP
+// path runs the policies above, the rings need neither windows, ACKs nor checksums.
+enum class Transport { Any, Udp };
+
+template <class P>
+concept ChecksumPolicy = requires {
+    { P::software } -> std::convertible_to<bool>;
+};
+template <class P>
+concept CongestionPolicy = requires(unsigned int *window, unsigned int count, bool timeout) {
+    { P::window } -> std::convertible_to<unsigned int>;
+    P::grow(window, window, count, count);
+    P::reduce(window, window, count, timeout);
+};
+template <class P>
+concept AckPolicy = requires {
+    { P::every } -> std::convertible_to<unsigned int>;
+    { P::delay_ms } -> std::convertible_to<unsigned int>;
+};
+
+template <ChecksumPolicy Checksum = SoftwareChecksum, CongestionPolicy Congestion = Reno<>,
+          AckPolicy Ack = DelayedAck<>>
+class Connection {
+public:
+    static constexpr int max_parts = 16; // Buffers one gathered send() takes
+
+    Connection() noexcept = default;
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+    Connection(Connection &&other) noexcept : sock_(std::exchange(other.sock_, nullptr)) {}
+    Connection &operator=(Connection &&other) noexcept {
+        if (this != &other) {
+            close();
+            sock_ = std::exchange(other.sock_, nullptr);
+        }
+        return *this;
+    }
+    ~Connection() { close(); }
+
+    /*
+    * @brief Connect to a receiver.
+    * @return A connected Connection, or an empty one (false) on failure.
+    */
+    static Connection connect(const std::string &ip, unsigned short port, Transport transport = Transport::Any) {
+        Connection conn(rudp_socket(false, port));
+        if (!conn.configure(transport)) {
+            return Connection();
+        }
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0) {
+            return Connection();
+        }
+        std::string host = ip; // rudp_connect() takes a mutable string
+        if (rudp_connect(conn.sock_, &addr, sizeof(addr), host.data(), port) == 0) {
+            return Connection();
+        }
+        return conn;
+    }
+
+    /*
+    * @brief Wait on a port for one sender to connect.
+    * @return A connected Connection, or an empty one (false) on failure.
+    */
+    static Connection accept(unsigned short port, Transport transport = Transport::Any) {
+        Connection conn(rudp_socket(true, port));
+        if (!conn.configure(transport)) {
+            return Connection();
+        }
+        struct sockaddr_in addr {};
+        if (rudp_accept(conn.sock_, &addr, sizeof(addr), nullptr, 0) == 0) {
+            return Connection();
+        }
+        return conn;
+    }
+
+    explicit operator bool() const noexcept { return sock_ != nullptr; }
+
+    /*
+    * @brief Queue bytes on a stream. The span is read in place, straight into the send window.
+    * @return The number of bytes queued, -1 on error.
+    */
+    int send(std::span<const std::byte> data, int stream = 0) noexcept {
+        return rudp_stream_send(sock_, stream, data.data(), data.size());
+    }
+    template <class T>
+    int send(std::span<T> data, int stream = 0) noexcept {
+        return send(std::as_bytes(data), stream);
+    }
+
+    /*
+    * @brief Queue several buffers as one chunk, gathered without joining them first.
+    * @return The number of bytes queued, -1 on error.
+    */
+    int send(std::initializer_list<std::span<const std::byte>> parts, int stream = 0) noexcept {
+        struct iovec iov[max_parts];
+        int count = 0;
+        for (const auto &part : parts) {
+            if (count == max_parts) {
+                return -1;
+            }
+            iov[count].iov_base = const_cast<std::byte *>(part.data());
+            iov[count].iov_len = part.size();
+            count++;
+        }
+        return rudp_queue_chunk(sock_, stream, iov, count);
+    }
+
+    /*
+    * @brief Receive into the span from any stream, the stream the bytes came from is stored in *stream.
+    * @return The number of bytes received, 0 if the peer closed, -1 on error.
+    */
+    int recv(std::span<std::byte> buffer, int *stream = nullptr) noexcept {
+        int from = RUDP_ANY_STREAM;
+        int bytes = rudp_stream_recv(sock_, &from, reinterpret_cast<char *>(buffer.data()), buffer.size());
+        if (stream != nullptr) {
+            *stream = from;
+        }
+        return bytes;
+    }
+    template <class T>
+        requires(!std::is_const_v<T>)
+    int recv(std::span<T> buffer, int *stream = nullptr) noexcept {
+        return recv(std::as_writable_bytes(buffer), stream);
+    }
+
+    int flush() noexcept { return rudp_flush(sock_); }
+    int stats(RUDP_Stats &out) const noexcept { return rudp_get_stats(sock_, &out); }
+
+    // For the parts of the C API the class does not wrap: sessions, subflows, FEC
+    RUDP_Socket *native_handle() const noexcept { return sock_; }
+
+    // Give up ownership, the caller closes the socket
+    RUDP_Socket *release() noexcept { return std::exchange(sock_, nullptr); }
+
+    // Start the FIN exchange, it finishes in the background (see wait_closed())
+    void close() noexcept {
+        if (sock_ != nullptr) {
+            rudp_close(std::exchange(sock_, nullptr));
+        }
+    }
+
+private:
+    explicit Connection(RUDP_Socket *sock) noexcept : sock_(sock) {}
+
+    // Hand the policies to the core before the handshake settles them. Defaults the core already has are left alone.
+    bool configure(Transport transport) noexcept {
+        if (sock_ == nullptr || rudp_set_checksum(sock_, Checksum::software) < 0) {
+            return false; // Also on a server, where the default accepts what the client asks for
+        }
+        if (transport == Transport::Udp && rudp_set_shared_memory(sock_, false) < 0) {
+            return false;
+        }
+        static constexpr RUDP_Congestion congestion = {Congestion::grow, Congestion::reduce};
+        if (rudp_set_congestion_control(sock_, Congestion::window, &congestion) < 0) {
+            return false;
+        }
+        if constexpr (Ack::every != RUDP_ACK_EVERY || Ack::delay_ms != RUDP_ACK_DELAY_MS) {
+            return rudp_set_ack_policy(sock_, Ack::every, Ack::delay_ms) > 0;
+        }
+        return true;
+    }
+
+    RUDP_Socket *sock_ = nullptr;
+};
+
+// Let closed connections finish their FIN exchange before the process exits
+inline void wait_closed() { rudp_wait_closed(); }
+
+} // namespace rudp
+
+#endif // RUDP_HPP
@@ -1,53 +1,63 @@
+#define _DEFAULT_SOURCE // SO_RXQ_OVFL and SO_*BUFFORCE are BSD/Linux extensions hidden by -std=c99
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <ifaddrs.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/time.h>
-// Constants for packet flags
-#define SYN_FLAG 100
-#define ACK_FLAG 200
-#define FIN_FLAG 400
-#define SYN_ACK_FLAG 300
-#define FIN_ACK_FLAG 600
-#define seq_no 1111
-
-// Structure for RUDP header
-typedef struct {
-    int length;  // Length of data
-    unsigned short int  checksum;  // Checksum for data integrity
-    int flags;  // Flags for packet type (SYN, ACK, FIN, etc.)
-} RUDP_Header;
-
-// A struct that represents RUDP Socket
-typedef struct _rudp_socket
-{
-    int socket_fd;  // UDP socket file descriptor
-    bool isServer;  // True if the RUDP socket acts like a server, false for client.
-    bool isConnected;  // True if there is an active connection, false otherwise.
-    struct sockaddr_in dest_addr;  // Destination address. Client fills it when it connects via rudp_connect(), server fills it when it accepts a connection via rudp_accept().
-} RUDP_Socket;
-
-
-
-// Helper function to send control packets
+#include <sys/uio.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "RUDP_API.h"
+
+#define RUDP_MAX_TIMEOUTS 10 // Consecutive retransmission timeouts before the peer is considered gone
+
+// Older headers lack these, the plain options and a missing drop counter are the fallback
+#ifndef SO_SNDBUFFORCE
+#define SO_SNDBUFFORCE -1
+#endif
+#ifndef SO_RCVBUFFORCE
+#define SO_RCVBUFFORCE -1
+#endif
+
+// Helper function to send control packets, on the subflow data last came in on
 ssize_t send_control_packet(RUDP_Socket *sockfd, int flags) {
+    return rudp_send_control(sockfd, flags, rudp_control_path(sockfd));
+}
+
+ssize_t rudp_send_control(RUDP_Socket *sockfd, int flags, int path) {
     // Prepare the header with the appropriate flags
     RUDP_Header header;
+    memset(&header, 0, sizeof(header));
     header.flags = flags;
+    header.seq = sockfd->snd_nxt;
+    header.ack = sockfd->rcv_nxt;
+    header.sack = rudp_sack_bitmap(sockfd);
+    header.window = rudp_rcv_window(sockfd);
+    sockfd->rcv_adv_edge = sockfd->rcv_nxt + header.window;
+    if (!(flags & SYN_FLAG) && !sockfd->syn_pending) {
+        header.fec_m = (unsigned char)rudp_fec_recommend(sockfd); // The handshake options carry the FEC offer
+    }
 
-
-    // Send the packet over the socket
-    ssize_t bytes_sent = sendto(sockfd->socket_fd, &header, sizeof(RUDP_Header), 0,
-                                (struct sockaddr *)&(sockfd->dest_addr), sizeof(struct sockaddr_in));
-    if (bytes_sent < 0) {
+    // Send the packet over the socket, with the handshake options while the handshake runs and on joins
+    if (rudp_send_packet(sockfd, path, &header, NULL, 0) < 0) {
         perror("Error sending control packet");
         return -1; // Error
     }
+    if (sockfd->shm != NULL) {
+        rudp_shm_ring_bell(sockfd->shm, 1 - sockfd->shm_side); // A peer on the rings sleeps on its doorbell, not the socket
+    }
 
-    return bytes_sent; // Number of bytes sent
+    return 1; // Success
 }
 
 int receive_control_packet(RUDP_Socket *sockfd,RUDP_Header *stam, struct sockaddr_in *recvr_addr,socklen_t *addr_len) {
@@ -94,17 +104,40 @@ unsigned short int calculate_checksum(void *data, unsigned int bytes) {
 }
 
 RUDP_Socket* rudp_socket(bool isServer, unsigned short int listen_port) {
-    RUDP_Socket* sockfd = (RUDP_Socket*)malloc(sizeof(RUDP_Socket));
+    RUDP_Socket* sockfd = (RUDP_Socket*)calloc(1, sizeof(RUDP_Socket));
     if (sockfd == NULL) {
         perror("Failed to allocate memory for socket structure");
         return NULL;
     }
 
+    // Allocate the send pool, retransmission and reassembly queues
+    sockfd->snd_queue = (RUDP_Segment**)calloc(RUDP_SND_SEGS, sizeof(RUDP_Segment*));
+    sockfd->snd_pool = (RUDP_Segment*)calloc(RUDP_SND_SEGS, sizeof(RUDP_Segment));
+    sockfd->rcv_queue = (RUDP_Segment*)calloc(RUDP_RCV_SEGS, sizeof(RUDP_Segment));
+    if (sockfd->snd_queue == NULL || sockfd->snd_pool == NULL || sockfd->rcv_queue == NULL) {
+        perror("Failed to allocate memory for segment queues");
+        free(sockfd->snd_queue);
+        free(sockfd->snd_pool);
+        free(sockfd->rcv_queue);
+        free(sockfd);
+        return NULL;
+    }
+    for (int i = RUDP_SND_SEGS - 1; i >= 0; i--) {
+        sockfd->snd_pool[i].next = sockfd->snd_free;
+        sockfd->snd_free = &sockfd->snd_pool[i];
+    }
+    for (int i = 0; i < RUDP_MAX_STREAMS; i++) {
+        sockfd->streams[i].weight = 1;
+    }
+
     // Create UDP socket
 
     sockfd->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd->socket_fd < 0) {
         perror("Failed to create UDP socket");
+        free(sockfd->snd_queue);
+        free(sockfd->snd_pool);
+        free(sockfd->rcv_queue);
         free(sockfd);
         return NULL;
     }
@@ -121,6 +154,9 @@ RUDP_Socket* rudp_socket(bool isServer, unsigned short int listen_port) {
         if (bind(sockfd->socket_fd, (struct sockaddr *)&(sockfd->dest_addr), sizeof(struct sockaddr_in)) < 0) {
             perror("Failed to bind socket");
             close(sockfd->socket_fd);
+            free(sockfd->snd_queue);
+            free(sockfd->snd_pool);
+            free(sockfd->rcv_queue);
             free(sockfd);
             return NULL;
         }
@@ -129,11 +165,43 @@ RUDP_Socket* rudp_socket(bool isServer, unsigned short int listen_port) {
 
     sockfd->isServer = isServer;
     sockfd->isConnected = false;
+    sockfd->shm_enabled = true;
+    sockfd->shm_fd = -1;
+    sockfd->path_count = 1;
+    sockfd->ack_every = RUDP_ACK_EVERY;
+    sockfd->ack_delay_ms = RUDP_ACK_DELAY_MS;
+    sockfd->spin_cpu = -1;
+    sockfd->rto_us = RUDP_RTO_MS * 1000LL;
+    sockfd->cwnd = RUDP_INIT_CWND;
+    sockfd->cwnd_init = RUDP_INIT_CWND;
+    sockfd->ssthresh = RUDP_WINDOW;
+    sockfd->congestion.grow = rudp_reno_grow;
+    sockfd->congestion.reduce = rudp_reno_reduce;
+    sockfd->payload_checksum = calculate_checksum; // Until the handshake says otherwise
+    sockfd->payload_intact = rudp_checksum_intact;
+    sockfd->snd_wnd_edge = RUDP_RCV_SEGS; // Until the peer advertises its own
+    sockfd->rcv_adv_edge = RUDP_RCV_SEGS;
+    if (isServer) {
+        // A receiver accepts FEC up to these limits and compression if the sender asks for them
+        sockfd->fec_k = RUDP_FEC_MAX_K;
+        sockfd->fec_m = RUDP_FEC_MAX_M;
+        sockfd->compress = true;
+        sockfd->no_checksum = true; // Accepted if the client asks, rudp_set_checksum() insists on checksums
+    }
+
+    // Room for a full window from the start, grown later from the measured bandwidth-delay product
+    rudp_set_buffers(sockfd, (RUDP_WINDOW + RUDP_FEC_MAX_M) * RUDP_DGRAM_CHARGE);
+#ifdef SO_RXQ_OVFL
+    int one = 1;
+    if (setsockopt(sockfd->socket_fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+        perror("setsockopt SO_RXQ_OVFL");
+    }
+#endif
 
     return sockfd;
 }
 
- int rudp_connect(RUDP_Socket *sockfd, struct sockaddr_in *rcvr_addr, socklen_t rcvr_len, char *receiver_ip, unsigned short receiver_port) {
+int rudp_connect(RUDP_Socket *sockfd, struct sockaddr_in *rcvr_addr, socklen_t rcvr_len, char *receiver_ip, unsigned short receiver_port) {
     if (sockfd == NULL || sockfd->isConnected || sockfd->isServer) {
         return 0; // Failure
     }
@@ -142,61 +210,87 @@ RUDP_Socket* rudp_socket(bool isServer, unsigned short int listen_port) {
     sockfd->dest_addr.sin_family = AF_INET;
     sockfd->dest_addr.sin_addr.s_addr = inet_addr(receiver_ip);
     sockfd->dest_addr.sin_port = htons(receiver_port);
-
-    // Set a timeout period for receiving the SYN-ACK packet
-    struct timeval timeout;
-    timeout.tv_sec = 5; // 5 seconds timeout
-    timeout.tv_usec = 0;
-
-    // Send SYN packet to the receiver
-    if (send_control_packet(sockfd, SYN_FLAG) < 0) {
-        printf("Failed to send SYN packet\n");
-        close(sockfd->socket_fd);
-        return 0; // Failure
+    sockfd->cookie = rudp_cookie_lookup(&sockfd->dest_addr);
+    sockfd->syn_pending = true;
+
+    // With a cookie from an earlier connection the first queued segment is the SYN and the initial window
+    // follows right behind it. The SYN-ACK is handled by rudp_poll(), a lost SYN by the retransmission timer.
+    if (sockfd->cookie != 0 && sockfd->snd_pending > 0) {
+        sockfd->isConnected = true;
+        printf("syn-sent with data\n");
+        return rudp_pump(sockfd) < 0 ? 0 : 1;
     }
-    printf("syn-sent\n");
 
+    // Otherwise a plain SYN, resent with exponential backoff until the SYN-ACK arrives.
+    // A server on this host is offered shared-memory rings with it.
+    rudp_shm_offer(sockfd);
+    long long syn_sent_us = 0;
+    long long deadline_us = 0;
+    bool resent = false;
     while (true) {
+        long long now = rudp_now_us();
+        if (now >= deadline_us) {
+            if (deadline_us != 0) {
+                if (++sockfd->timeouts > RUDP_MAX_TIMEOUTS) {
+                    printf("Receiver is not responding, giving up\n");
+                    return 0; // Failure
+                }
+                printf("Timeout occurred, retransmitting SYN packet\n");
+                resent = true; // No RTT sample from an ambiguous SYN-ACK (Karn)
+                sockfd->rto_us *= 2;
+                if (sockfd->rto_us > RUDP_MAX_RTO_MS * 1000LL) {
+                    sockfd->rto_us = RUDP_MAX_RTO_MS * 1000LL;
+                }
+            }
+            if (send_control_packet(sockfd, SYN_FLAG) < 0) {
+                printf("Failed to send SYN packet\n");
+                return 0; // Failure
+            }
+            printf("syn-sent\n");
+            syn_sent_us = now;
+            deadline_us = now + sockfd->rto_us;
+        }
+
         fd_set read_fds;
         FD_ZERO(&read_fds);
         FD_SET(sockfd->socket_fd, &read_fds);
+        struct timeval timeout;
+        timeout.tv_sec = (deadline_us - now) / 1000000;
+        timeout.tv_usec = (deadline_us - now) % 1000000;
 
         int select_result = select(sockfd->socket_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (select_result < 0) {
+        if (select_result < 0 && errno != EINTR) {
             perror("select");
             return 0; // Error in select function
-        } else if (select_result == 0) {
-            // Timeout occurred, retransmit SYN packet
-            printf("Timeout occurred, retransmitting SYN packet\n");
-            if (send_control_packet(sockfd, SYN_FLAG) < 0) {
-                printf("Failed to retransmit SYN packet\n");
-                close(sockfd->socket_fd);
-                return 0; // Failure
-            }
-        } else {
+        } else if (select_result > 0) {
             // Received a packet
-            RUDP_Header syn_ack_header;
-            ssize_t syn_ack_received = recvfrom(sockfd->socket_fd, &syn_ack_header, sizeof(syn_ack_header), 0, NULL, 0);
-            if (syn_ack_received < 0) {
+            RUDP_Packet packet;
+            ssize_t bytes_received = recvfrom(sockfd->socket_fd, &packet, sizeof(packet), 0, NULL, 0);
+            if (bytes_received < 0) {
                 printf("Failed to receive SYN-ACK packet\n");
-                close(sockfd->socket_fd);
                 return 0; // Failure
             }
-            if (syn_ack_header.flags == SYN_ACK_FLAG) {
+            if (bytes_received >= (ssize_t)sizeof(RUDP_Header) && packet.header.flags == SYN_ACK_FLAG) {
                 printf("syn-ack-received\n");
-                // Send ACK packet to the receiver
-                if (send_control_packet(sockfd, ACK_FLAG) < 0) {
+                char *payload = packet.data;
+                int payload_size = (int)(bytes_received - sizeof(RUDP_Header));
+                RUDP_Handshake options;
+                rudp_handshake_read(&packet.header, &payload, &payload_size, &options);
+                if (!resent) {
+                    rudp_update_rtt(sockfd, rudp_now_us() - syn_sent_us);
+                }
+                sockfd->timeouts = 0;
+                sockfd->isConnected = true;
+                if (rudp_syn_ack(sockfd, &packet.header, &options) < 0) {
                     printf("Failed to send ACK packet\n");
-                    close(sockfd->socket_fd);
                     return 0; // Failure
                 }
                 printf("ack sent successfully\n");
-                break; // Handshake successful, exit loop
+                rudp_shm_settle(sockfd);
+                return 1; // Success
             }
         }
     }
-
-    return 1; // Success
 }
 
 int rudp_accept(RUDP_Socket *receiver_socket, struct sockaddr_in *sndr_addr, socklen_t sndr_len, char *sender_ip, unsigned short sender_port) {
@@ -205,113 +299,92 @@ int rudp_accept(RUDP_Socket *receiver_socket, struct sockaddr_in *sndr_addr, soc
         return 0; // Failure
     }
 
-    // Create a sender socket
-    RUDP_Socket *sender_socket = rudp_socket(false, 0); // Create a client socket
-    if (sender_socket == NULL) {
-        fprintf(stderr, "Error: Failed to create sender socket\n");
-        return 0; // Failure to create sender socket
-    }
-
-    // Fill in destination address structure for sender
-    memset(&(sender_socket->dest_addr), 0, sizeof(struct sockaddr_in));
-    sender_socket->dest_addr.sin_family = AF_INET;
-    sender_socket->dest_addr.sin_addr.s_addr = inet_addr(sender_ip);
-    sender_socket->dest_addr.sin_port = htons(sender_port);
-
-    // Set a timeout period for receiving the SYN packet
-    // timer starts as soon the receiver file started 
-    struct timeval timeout;
-    timeout.tv_sec = 30; // 30 seconds timeout
-    timeout.tv_usec = 0;
+    // The peer's address comes from its SYN, these are kept for existing callers
+    (void)sender_ip;
+    (void)sender_port;
 
+    // No state is kept for a peer until it proves it receives our packets: a SYN without a valid cookie
+    // only gets a SYN-ACK carrying one. The ACK echoing it opens the connection, so does a SYN that
+    // already brings a valid cookie, together with any data it carries.
     while (true) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(receiver_socket->socket_fd, &read_fds);
-
-        int select_result = select(receiver_socket->socket_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (select_result < 0) {
-            perror("select");
+        RUDP_Packet packet;
+        sndr_len = sizeof(struct sockaddr_in);
+        ssize_t bytes_received = recvfrom(receiver_socket->socket_fd, &packet, sizeof(packet), 0, (struct sockaddr *)sndr_addr, &sndr_len);
+        if (bytes_received < 0) {
+            perror("recvfrom");
             printf("accept 2 \n");
-            return 0; // Error in select function
-        } else if (select_result == 0) {
-            // Timeout occurred, retransmit SYN-ACK packet
-            printf("Timeout occurred, retransmitting SYN-ACK packet\n");
-            RUDP_Header syn_ack_header;
-            syn_ack_header.flags = SYN_ACK_FLAG;
-            if (sendto(receiver_socket->socket_fd, &syn_ack_header, sizeof(syn_ack_header), 0, sndr_addr, sndr_len) < 0) {
+            return 0; // Failed to receive SYN packet
+        }
+        if (bytes_received < (ssize_t)sizeof(RUDP_Header)) {
+            continue;
+        }
+        RUDP_Header *header = &packet.header;
+        char *payload = packet.data;
+        int payload_size = (int)(bytes_received - sizeof(RUDP_Header));
+        RUDP_Handshake options;
+        rudp_handshake_read(header, &payload, &payload_size, &options);
+        bool syn = (header->flags & SYN_FLAG) && !(header->flags & ACK_FLAG);
+        bool valid = rudp_cookie_valid(sndr_addr, options.cookie);
+        if (syn && !valid) {
+            printf("syn-received\n");
+
+            // Echo the FEC parameters both sides support and a fresh cookie, without settling anything yet
+            unsigned int k = options.fec_k < receiver_socket->fec_k ? options.fec_k : receiver_socket->fec_k;
+            unsigned int m = options.fec_m < receiver_socket->fec_m ? options.fec_m : receiver_socket->fec_m;
+            RUDP_Packet syn_ack;
+            RUDP_Header *syn_ack_header = &syn_ack.header;
+            memset(syn_ack_header, 0, sizeof(*syn_ack_header));
+            syn_ack_header->flags = SYN_ACK_FLAG;
+            syn_ack_header->window = rudp_rcv_window(receiver_socket);
+            RUDP_Handshake syn_ack_options;
+            memset(&syn_ack_options, 0, sizeof(syn_ack_options));
+            syn_ack_options.cookie = rudp_cookie(sndr_addr, rudp_now_us());
+            syn_ack_options.fec_k = (unsigned char)(k > 0 && m > 0 ? k : 0);
+            syn_ack_options.fec_m = (unsigned char)(k > 0 && m > 0 ? m : 0);
+            syn_ack_options.compress = options.compress && receiver_socket->compress;
+            if (options.shm_pid != 0 && receiver_socket->shm_enabled && rudp_shm_local(sndr_addr)) {
+                syn_ack_options.shm_pid = (unsigned int)getpid(); // We will map the client's rings once it confirms
+            }
+            syn_ack_options.no_checksum = options.no_checksum && receiver_socket->no_checksum;
+            memcpy(syn_ack.data, &syn_ack_options, sizeof(syn_ack_options));
+            if (sendto(receiver_socket->socket_fd, &syn_ack, sizeof(RUDP_Header) + sizeof(syn_ack_options), 0, (struct sockaddr *)sndr_addr, sndr_len) < 0) {
                 printf("cannot send syn ack\n");
                 return 0;
             }
             printf("syn-ack sent\n");
-        } else {
-            // Received a packet
-            RUDP_Header syn_header;
-            if (receive_control_packet(receiver_socket, &syn_header, sndr_addr, &sndr_len) < 0) {
-                printf("accept 4444 \n");
-                return 0; // Failed to receive SYN packet
-            }
-            if (syn_header.flags == SYN_FLAG) {
-                printf("syn-received\n");
-
-                RUDP_Header syn_ack_header;
-                syn_ack_header.flags = SYN_ACK_FLAG;
-
-                // Send SYN-ACK packet to sender
-                if (sendto(receiver_socket->socket_fd, &syn_ack_header, sizeof(syn_ack_header), 0, sndr_addr, sndr_len) < 0) {
-                    printf("cannot send syn ack\n");
-                    return 0;
-                }
-                printf("syn-ack sent\n");
-
-                // Set a timeout period for receiving the ACK packet
-                struct timeval ack_timeout;
-                ack_timeout.tv_sec = 5; // 5 seconds timeout
-                ack_timeout.tv_usec = 0;
-
-                // Receive ACK packet from sender
-                fd_set ack_read_fds;
-                FD_ZERO(&ack_read_fds);
-                FD_SET(receiver_socket->socket_fd, &ack_read_fds);
-
-                int ack_select_result = select(receiver_socket->socket_fd + 1, &ack_read_fds, NULL, NULL, &ack_timeout);
-                if (ack_select_result < 0) {
-                    perror("select");
-                    printf("accept 6 \n");
-                    return 0; // Error in select function
-                } else if (ack_select_result == 0) {
-                    // Timeout occurred, retransmit SYN-ACK packet
-                    printf("Timeout occurred, retransmitting SYN-ACK packet\n");
-                   if (sendto(receiver_socket->socket_fd, &syn_ack_header, sizeof(syn_ack_header), 0, sndr_addr, sndr_len) < 0) {
-                       printf("cannot send syn ack\n");
-                       return 0;
-                   }
-                   printf("syn-ack sent\n");
-                } else {
-                    // Received ACK packet
-                    RUDP_Header ack_header;
-                    if (receive_control_packet(receiver_socket, &ack_header, sndr_addr, &sndr_len) < 0) {
-                        printf("accept 6 \n");
-                        return 0; // Failed to receive ACK packet
-                    }
-                    if (ack_header.flags == ACK_FLAG) {
-                        printf("ack received\n");
-                        // Handshake successful, set isConnected flag
-                        receiver_socket->isConnected = true;
-                        printf("HandShake successfully\n");
+            continue;
+        }
+        if (!valid || !(syn || header->flags == ACK_FLAG)) {
+            continue; // Not the answer to a cookie we issued
+        }
 
-                        break; // Handshake successful, exit loop
-                    }
-                }
+        receiver_socket->isConnected = true;
+        receiver_socket->dest_addr = *sndr_addr;
+        receiver_socket->cookie = options.cookie; // Proves a later join comes from the same client
+        rudp_fec_negotiate(receiver_socket, options.fec_k, options.fec_m);
+        rudp_lz_negotiate(receiver_socket, options.compress);
+        rudp_checksum_negotiate(receiver_socket, options.no_checksum);
+        rudp_shm_take(receiver_socket, &options, sndr_addr);
+        receiver_socket->snd_wnd_edge = receiver_socket->snd_una + header->window;
+        if (syn) {
+            printf("syn-received with cookie\n");
+            if (header->flags & DATA_FLAG) {
+                rudp_process_data(receiver_socket, header, payload, payload_size);
             }
+            // The SYN-ACK also acknowledges the data
+            if (send_control_packet(receiver_socket, SYN_ACK_FLAG) < 0) {
+                printf("cannot send syn ack\n");
+                return 0;
+            }
+            printf("syn-ack sent\n");
+        } else {
+            printf("ack received\n");
+            // The ACK echoes the cookie issued one round trip ago
+            rudp_update_rtt(receiver_socket, (unsigned int)rudp_now_us() - (unsigned int)options.cookie);
         }
+        printf("HandShake successfully\n");
+        return 1; // Success
     }
-
-    
-
-    
-
-    return 1; // Success
 }
 
 
@@ -332,181 +405,234 @@ int receive_acknowledgment(RUDP_Socket *sockfd) {
 
 
 
-#define MAX_RETRIES 3
+// Teardowns still running in the background, for rudp_wait_closed()
+static pthread_mutex_t rudp_close_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rudp_close_done = PTHREAD_COND_INITIALIZER;
+static int rudp_closing = 0;
 
+/*
+* @brief Close the connection without waiting. Queued data is still delivered, then the FIN exchange
+* runs in the background, retransmitted on the RTO and bounded by RUDP_CLOSE_TIMEOUT_MS. The socket
+* is freed when it ends and must not be used after this call. The outcome goes to the close callback.
+* @return 1 if the teardown started, -1 on error.
+*/
 int rudp_close(RUDP_Socket *sockfd) {
-   // if(sockfd->isServer){ printf(" is server\n");return -1;}
-
-    // Step 1: Send FIN packet
-    RUDP_Header fin_header;
-    fin_header.flags = FIN_FLAG;
-
-    int retries = 0;
-    bool fin_ack_received = false;
-
-    while (retries < MAX_RETRIES && !fin_ack_received) {
-        ssize_t bytes_sent_fin = send_control_packet(sockfd, fin_header.flags);
-        if (bytes_sent_fin < 0) {
-            perror("send");
-            return -1; // Error in sending FIN packet
-        }
-        printf("fin sent\n");
-
-        // Wait for SYN/ACK packet with a timeout
-        struct timeval timeout;
-        timeout.tv_sec = 30; // 30 seconds timeout
-        timeout.tv_usec = 0;
-
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(sockfd->socket_fd, &read_fds);
-
-        int select_result = select(sockfd->socket_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (select_result < 0) {
-            perror("select");
-            return -1; // Error in select function
-        } else if (select_result == 0) {
-            // Timeout occurred
-            printf("Timeout occurred while waiting for FIN/ACK packet, retrying...\n");
-            retries++;
-        } else {
-            // Data is available to read, check if it's a FIN/ACK packet
-            RUDP_Header fin_ack_header;
-            struct sockaddr_in recvr_addr;
-            socklen_t addr_len = sizeof(recvr_addr);
-            ssize_t bytes_received = recvfrom(sockfd->socket_fd, &fin_ack_header, sizeof(fin_ack_header), 0, (struct sockaddr *) &recvr_addr, &addr_len);
-            if (bytes_received < 0) {
-                perror("recvfrom");
-                return -1; // Error in receiving SYN/ACK packet
-            }
-            if (fin_ack_header.flags == FIN_ACK_FLAG) {
-                fin_ack_received = true;
-                printf("fin-ack received\n");
-            } else {
-                printf("Received unexpected packet while waiting for FIN/ACK, retrying...\n");
-                retries++;
-            }
-        }
+    if (sockfd == NULL || sockfd->closing) {
+        return -1;
     }
-
-    // If fin/ACK received, send ACK packet
-    if (fin_ack_received) {
-        RUDP_Header ack_header;
-        ack_header.flags = ACK_FLAG;
-        ssize_t bytes_sent_ack = send_control_packet(sockfd, ACK_FLAG);
-        if (bytes_sent_ack < 0) {
-            perror("send");
-            return -1; // Error in sending ACK packet
-        }
+    sockfd->closing = true;
+    sockfd->close_start_us = rudp_now_us();
+    if (!sockfd->isConnected) {
+        rudp_close_finish(sockfd, RUDP_CLOSE_OK); // Nothing to tell a peer
         return 1;
-    } else {
-        printf("Maximum retries reached, closing connection failed.\n");
-        return -1; // Maximum retries reached, closing connection failed
     }
 
-    return -1; // Connection closed successfully
+    pthread_mutex_lock(&rudp_close_lock);
+    rudp_closing++;
+    pthread_mutex_unlock(&rudp_close_lock);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int error = pthread_create(&thread, &attr, rudp_close_thread, sockfd);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        printf("Failed to start the teardown thread, closing in the foreground\n");
+        rudp_close_thread(sockfd);
+    }
+    return 1;
 }
 
-#define MAX_RETRIES 3
+/*
+* @brief Close the receiving end. The same teardown as rudp_close(), which already answers a FIN that arrived
+* while reading; the address arguments are kept for existing callers.
+* @return 1 if the teardown started, -1 on error.
+*/
+int rudp_recv_close(RUDP_Socket *sockfd, struct sockaddr_in *sndr_addr, socklen_t sndr_len,bool fin_recvd) {
+    (void)sndr_addr;
+    (void)sndr_len;
+    (void)fin_recvd;
+    return rudp_close(sockfd);
+}
 
+/*
+* @brief Get told how the background close of this socket ended. Must be set before rudp_close().
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_close_callback(RUDP_Socket *sockfd, RUDP_Close_Callback callback, void *arg) {
+    if (sockfd == NULL || sockfd->closing) {
+        return -1;
+    }
+    sockfd->close_callback = callback;
+    sockfd->close_arg = arg;
+    return 1;
+}
 
-#define MAX_RETRIES 3
+// Block until every background close has finished, for programs about to exit
+void rudp_wait_closed(void) {
+    pthread_mutex_lock(&rudp_close_lock);
+    while (rudp_closing > 0) {
+        pthread_cond_wait(&rudp_close_done, &rudp_close_lock);
+    }
+    pthread_mutex_unlock(&rudp_close_lock);
+}
 
+void *rudp_close_thread(void *arg) {
+    RUDP_Socket *sockfd = (RUDP_Socket *)arg;
+    rudp_close_finish(sockfd, rudp_teardown(sockfd));
 
-int rudp_recv_close(RUDP_Socket *sockfd, struct sockaddr_in *sndr_addr, socklen_t sndr_len,bool fin_recvd) {
-    bool fin_received = fin_recvd;
+    pthread_mutex_lock(&rudp_close_lock);
+    rudp_closing--;
+    pthread_cond_broadcast(&rudp_close_done);
+    pthread_mutex_unlock(&rudp_close_lock);
+    return NULL;
+}
 
-    // Step 1: Receive FIN packet
-    while (!fin_received) {
-        RUDP_Header fin_header;
-        ssize_t bytes_received_fin = recvfrom(sockfd->socket_fd, &fin_header, sizeof(fin_header), 0, (struct sockaddr *)sndr_addr, &sndr_len);
-        if (bytes_received_fin < 0) {
-            perror("recvfrom");
-            return -1; // Error in receiving FIN packet
-        } else if (bytes_received_fin == 0) {
-            printf("Connection closed by peer\n");
-            return -1; // Connection closed by peer
-        } else {
-            fin_received = true;
-            printf("Received closing FIN\n");
-        }
+// Report the outcome and release everything the socket holds
+void rudp_close_finish(RUDP_Socket *sockfd, int status) {
+    RUDP_Close_Result result;
+    memset(&result, 0, sizeof(result));
+    result.status = status;
+    result.duration_us = rudp_now_us() - sockfd->close_start_us;
+    result.fin_transmissions = sockfd->fin_transmissions;
+    result.stats = sockfd->stats;
+    result.stats.srtt_us = sockfd->srtt_us;
+    RUDP_Close_Callback callback = sockfd->close_callback;
+    void *callback_arg = sockfd->close_arg;
+    rudp_free(sockfd);
+    if (callback != NULL) {
+        callback(&result, callback_arg);
     }
+}
 
-    // Step 2: Send FIN-ACK packet
-    RUDP_Header fin_ack_header;
-    fin_ack_header.flags = FIN_ACK_FLAG;
-    ssize_t bytes_sent_fin_ack = sendto(sockfd->socket_fd, &fin_ack_header, sizeof(fin_ack_header), 0, (struct sockaddr *)sndr_addr, sndr_len);
-    if (bytes_sent_fin_ack < 0) {
-        perror("sendto");
-        return -1; // Error in sending FIN-ACK packet
+void rudp_free(RUDP_Socket *sockfd) {
+    close(sockfd->socket_fd);
+    for (unsigned int p = 1; p < sockfd->path_count; p++) {
+        if (sockfd->paths[p].fd >= 0 && sockfd->paths[p].fd != sockfd->socket_fd) {
+            close(sockfd->paths[p].fd);
+        }
     }
+    if (sockfd->shm != NULL) {
+        rudp_shm_close(sockfd);
+        rudp_shm_release(sockfd->shm, sockfd->shm_fd);
+    }
+    rudp_session_free(sockfd->session);
+    free(sockfd->fec);
+    if (sockfd->lz != NULL) {
+        free(sockfd->lz->flat);
+        free(sockfd->lz);
+    }
+    free(sockfd->snd_queue);
+    free(sockfd->snd_pool);
+    free(sockfd->rcv_queue);
+    free(sockfd);
+}
 
-    // Step 3: Wait for ACK packet
-    bool ack_received = false;
-    int retries = 0;
-
-    while (retries < MAX_RETRIES && !ack_received) {
-        // Wait for ACK packet with a timeout
-        struct timeval timeout;
-        timeout.tv_sec = 30; // 30 seconds timeout
-        timeout.tv_usec = 0;
+// Our FIN, which also acknowledges the peer's if that came first
+int rudp_send_fin(RUDP_Socket *sockfd) {
+    if (send_control_packet(sockfd, sockfd->peer_fin ? FIN_ACK_FLAG : FIN_FLAG) < 0) {
+        return -1;
+    }
+    sockfd->fin_sent = true;
+    sockfd->fin_transmissions++;
+    return 1;
+}
 
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(sockfd->socket_fd, &read_fds);
+/*
+* @brief FIN handling, also while the application is still reading: take the peer's FIN once every segment
+* before it arrived, notice when ours is acknowledged and answer so the peer can stop retransmitting.
+* Each FIN takes one sequence number, so acknowledging it moves the ACK one past the last data segment.
+* @return 1 on success, -1 on error.
+*/
+int rudp_process_fin(RUDP_Socket *sockfd, RUDP_Header *header) {
+    if (sockfd->fin_sent && (header->flags & ACK_FLAG) && header->ack == sockfd->snd_nxt + 1) {
+        sockfd->fin_acked = true;
+    }
+    if (!(header->flags & FIN_FLAG)) {
+        return 1;
+    }
+    if (!sockfd->peer_fin && header->seq == sockfd->rcv_nxt) {
+        sockfd->peer_fin = true;
+        sockfd->rcv_nxt++;
+    } else if (!sockfd->peer_fin || header->seq != sockfd->rcv_nxt - 1) {
+        return 1; // Data before it is still missing, the peer sends it again
+    }
 
-        int select_result = select(sockfd->socket_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (select_result < 0) {
-            perror("select");
-            return -1; // Error in select function
-        } else if (select_result == 0) {
-            // Timeout occurred
-            printf("Timeout occurred while waiting for ACK packet, retrying...\n");
+    if (sockfd->fin_sent && !sockfd->fin_acked) {
+        return rudp_send_fin(sockfd); // Resend ours right away, now acknowledging theirs too
+    }
+    if (sockfd->fin_sent) {
+        // Ours is acknowledged, so this ACK ends the exchange. If it is lost the FIN comes back, stay to answer it.
+        sockfd->close_linger = true;
+        sockfd->linger_restart = true;
+    }
+    return send_control_packet(sockfd, ACK_FLAG) < 0 ? -1 : 1;
+}
 
-            // Retransmit FIN-ACK packet
-            ssize_t bytes_sent_fin_ack_retry = sendto(sockfd->socket_fd, &fin_ack_header, sizeof(fin_ack_header), 0, (struct sockaddr *)sndr_addr, sndr_len);
-            if (bytes_sent_fin_ack_retry < 0) {
-                perror("sendto");
-                return -1; // Error in retransmitting FIN-ACK packet
+/*
+* @brief The background part of a close: deliver what is queued, exchange FINs, linger if we sent the last ACK.
+* @return RUDP_CLOSE_OK, RUDP_CLOSE_TIMEOUT or RUDP_CLOSE_ERROR.
+*/
+int rudp_teardown(RUDP_Socket *sockfd) {
+    if (rudp_flush(sockfd) < 0) {
+        return RUDP_CLOSE_TIMEOUT;
+    }
+    rudp_shm_close(sockfd); // Whatever is in our rings is all there will be
+    if (rudp_send_fin(sockfd) < 0) {
+        return RUDP_CLOSE_ERROR;
+    }
+    printf("fin sent\n");
+
+    // The FIN is resent at least three times per linger period, so a peer that lingers
+    // after acknowledging it always gets another chance to answer
+    long long fin_rto_cap_us = RUDP_LINGER_MS * 1000LL / 3;
+    long long fin_rto_us = sockfd->rto_us < fin_rto_cap_us ? sockfd->rto_us : fin_rto_cap_us;
+    long long give_up_us = rudp_now_us() + RUDP_CLOSE_TIMEOUT_MS * 1000LL;
+    long long fin_deadline_us = rudp_now_us() + fin_rto_us;
+    long long linger_until_us = 0;
+    while (true) {
+        long long now = rudp_now_us();
+        long long wake_us = give_up_us;
+        if (sockfd->fin_acked && sockfd->peer_fin) {
+            if (!sockfd->close_linger) {
+                return RUDP_CLOSE_OK;
             }
-
-            retries++;
-        } else {
-            // Data is available to read, check if it's an ACK packet
-            RUDP_Header ack_header;
-            ssize_t bytes_received_ack = recvfrom(sockfd->socket_fd, &ack_header, sizeof(ack_header), 0, NULL, 0);
-            if (bytes_received_ack < 0) {
-                perror("recvfrom");
-                return -1; // Error in receiving ACK packet
+            if (linger_until_us == 0 || sockfd->linger_restart) {
+                sockfd->linger_restart = false;
+                linger_until_us = now + RUDP_LINGER_MS * 1000LL;
             }
-            if (ack_header.flags == ACK_FLAG) {
-                ack_received = true;
-                sockfd->isConnected = false;
-                printf("Received Closing ack after fin-ack\n");
-                return 1;
-            } else {
-                printf("Received unexpected packet while waiting for ACK, retrying...\n");
-                retries++;
+            if (now >= linger_until_us) {
+                return RUDP_CLOSE_OK;
+            }
+            wake_us = linger_until_us;
+        } else if (now >= give_up_us || sockfd->shm_peer_gone) {
+            printf("Peer did not finish closing, giving up\n");
+            return RUDP_CLOSE_TIMEOUT;
+        } else if (!sockfd->fin_acked) {
+            if (now >= fin_deadline_us) {
+                printf("Timeout occurred, retransmitting FIN\n");
+                fin_rto_us = 2 * fin_rto_us < fin_rto_cap_us ? 2 * fin_rto_us : fin_rto_cap_us;
+                if (rudp_send_fin(sockfd) < 0) {
+                    return RUDP_CLOSE_ERROR;
+                }
+                fin_deadline_us = now + fin_rto_us;
+            }
+            if (fin_deadline_us < wake_us) {
+                wake_us = fin_deadline_us;
             }
         }
+        if (rudp_poll(sockfd, wake_us) < 0) {
+            return RUDP_CLOSE_ERROR;
+        }
     }
-
-    if (!ack_received) {
-        printf("Maximum retries reached, closing connection failed.\n");
-        return -1; // Maximum retries reached, closing connection failed
-    }
-
-    return 0; // Connection closed successfully
 }
 
-
-
-
 int send_data_packet(RUDP_Socket *sockfd, char *data, size_t data_size, unsigned short int checksum) {
 
     // Prepare data packet with flags and checksum
     RUDP_Header header;
-    header.flags = seq_no; //check if same data
+    header.flags = DATA_FLAG; //check if same data
     header.checksum = checksum;
     printf("checksum sent:%d",checksum);
 
@@ -548,7 +674,7 @@ int receive_data_packet(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_s
     }
 
     // Check if it's a data packet
-    if (header.flags != seq_no) {
+    if (header.flags != DATA_FLAG) {
         printf("Received packet is not a data packet\n");
         return -1; // Not a data packet, discard
     }
@@ -571,198 +697,2234 @@ int receive_data_packet(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_s
 
 
 
-int rudp_send_file_1(RUDP_Socket *sockfd, char *buffer, size_t buffer_size,char *receiver_ip, unsigned short receiver_port) {
-    int bytes_sent = -1;
-    bool ack1_received = false;
-    bool ack2_received = false;
-    unsigned short int checksum = calculate_checksum(buffer, sizeof(buffer));
 
-    memset(&(sockfd->dest_addr), 0, sizeof(struct sockaddr_in));
-    sockfd->dest_addr.sin_family = AF_INET;
-    sockfd->dest_addr.sin_addr.s_addr = inet_addr(receiver_ip);
-    sockfd->dest_addr.sin_port = htons(receiver_port);
 
-    while (!(ack1_received )) {
-        // Prepare data packet with flags and checksum
-        RUDP_Header header;
-        header.flags = seq_no; // Assuming seqnum for the whole file
-        header.checksum = checksum;
 
-        // Send the header
-        ssize_t bytes_sent_header = sendto(sockfd->socket_fd,&header,sizeof(RUDP_Header),0
-                ,(struct sockaddr *)&(sockfd->dest_addr),sizeof (struct sockaddr_in));
-        if (bytes_sent_header < 0) {
-            perror("send");
-            return -1; // Error in sending header
+
+
+
+long long rudp_now_us(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+} while (0)
+
+// SipHash-2-4 with a 16 byte key: a keyed hash fast enough to run for every SYN
+unsigned long long rudp_siphash(const unsigned char *key, const unsigned char *data, size_t size) {
+    unsigned long long k0 = 0, k1 = 0;
+    for (int i = 0; i < 8; i++) {
+        k0 |= (unsigned long long)key[i] << (8 * i);
+        k1 |= (unsigned long long)key[8 + i] << (8 * i);
+    }
+    unsigned long long v0 = k0 ^ 0x736f6d6570736575ULL;
+    unsigned long long v1 = k1 ^ 0x646f72616e646f6dULL;
+    unsigned long long v2 = k0 ^ 0x6c7967656e657261ULL;
+    unsigned long long v3 = k1 ^ 0x7465646279746573ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long m = 0;
+        for (int j = 0; j < 8; j++) {
+            m |= (unsigned long long)data[i + j] << (8 * j);
         }
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    unsigned long long last = (unsigned long long)(size & 0xff) << 56;
+    for (int j = 0; i + j < size; j++) {
+        last |= (unsigned long long)data[i + j] << (8 * j);
+    }
+    v3 ^= last;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int j = 0; j < 4; j++) {
+        SIPROUND(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Key for the handshake cookies, shared by every server socket of the process so a cookie
+// stays good for the next connection on the same port. Drawn once, by whichever thread needs it first.
+static unsigned char rudp_cookie_key[16];
+static pthread_once_t rudp_cookie_key_once = PTHREAD_ONCE_INIT;
 
-        // Wait for acknowledgment packet 1 with a timeout of 30 seconds
-        struct timeval timeout1;
-        timeout1.tv_sec = 2; // 30 seconds timeout
-        timeout1.tv_usec = 0;
+void rudp_cookie_key_init(void) {
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (random == NULL || fread(rudp_cookie_key, 1, sizeof(rudp_cookie_key), random) != sizeof(rudp_cookie_key)) {
+        long long seed[2] = { rudp_now_us(), (long long)getpid() };
+        memcpy(rudp_cookie_key, seed, sizeof(seed));
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+}
 
-        fd_set read_fds1;
-        FD_ZERO(&read_fds1);
-        FD_SET(sockfd->socket_fd, &read_fds1);
+// Cookie for a peer: the low 32 bits of the issue time, and in the high ones a MAC over the whole 64-bit issue time
+// and the peer's IP address. The port is left out, every new client socket gets another one.
+unsigned long long rudp_cookie(const struct sockaddr_in *peer, long long issued_us) {
+    pthread_once(&rudp_cookie_key_once, rudp_cookie_key_init);
+    unsigned char message[12];
+    memcpy(message, &peer->sin_addr.s_addr, 4);
+    memcpy(message + 4, &issued_us, 8);
+    unsigned long long mac = rudp_siphash(rudp_cookie_key, message, sizeof(message));
+    return (mac & 0xFFFFFFFF00000000ULL) | (unsigned int)issued_us;
+}
 
-        int select_result1 = select(sockfd->socket_fd + 1, &read_fds1, NULL, NULL, &timeout1);
-        if (select_result1 < 0) {
-            perror("select");
-            return -1; // Error in select function
-        } else if (select_result1 == 0) {
-            // Timeout occurred
-            printf("Timeout occurred for acknowledgment 1\n");
-        } else {
-            // Acknowledgment 1 is available to read
-            RUDP_Header ack1_header;
-            struct sockaddr_in recvr_addr1;
-            socklen_t addr_len1 = sizeof(recvr_addr1);
-            int ack1_result = receive_control_packet(sockfd, &ack1_header, &recvr_addr1, &addr_len1);
-            if (ack1_result == -1) {
-                printf("Failed to receive acknowledgment 1 packet\n");
-                return -1; // Error in receiving acknowledgment packet
-            }
-            if (ack1_header.flags == ACK_FLAG) {
-                // Acknowledgment 1 received
-                ack1_received = true;
-              //  printf("Acknowledgment 1 received\n");
-            }
-        }
-
-        if (ack1_received) {
-            while(!ack2_received){
-            // Send the data
-                ssize_t bytes_sent_data = sendto(sockfd->socket_fd, buffer, buffer_size, 0,(struct sockaddr *)&(sockfd->dest_addr),sizeof (struct sockaddr_in));
-            if (bytes_sent_data < 0) {
-                perror("send");
-                return -1; // Error in sending data
-            }
-              //  printf("files sent\n");
-
-            // Wait for acknowledgment packet 2 with a timeout of 30 seconds
-            struct timeval timeout2;
-            timeout2.tv_sec = 2; // 30 seconds timeout
-            timeout2.tv_usec = 0;
-
-            fd_set read_fds2;
-            FD_ZERO(&read_fds2);
-            FD_SET(sockfd->socket_fd, &read_fds2);
-
-            int select_result2 = select(sockfd->socket_fd + 1, &read_fds2, NULL, NULL, &timeout2);
-            if (select_result2 < 0) {
-                perror("select");
-                return -1; // Error in select function
-            } else if (select_result2 == 0) {
-                // Timeout occurred
-                printf("Timeout occurred for acknowledgment 2\n");
-            } else {
-                // Acknowledgment 2 is available to read
-                RUDP_Header ack2_header;
-                struct sockaddr_in recvr_addr2;
-                socklen_t addr_len2 = sizeof(recvr_addr2);
-                int ack2_result = receive_control_packet(sockfd, &ack2_header, &recvr_addr2, &addr_len2);
-                if (ack2_result == -1) {
-                    printf("Failed to receive acknowledgment 2 packet\n");
-                    return -1; // Error in receiving acknowledgment packet
-                }
-                if (ack2_header.flags == ACK_FLAG) {
-                    // Acknowledgment 2 received
-                    ack2_received = true;
-                   // printf("Acknowledgment 2 received, file transfer successful\n");
-                    return 1;
-                   // break;
-                }
-              }
-            }
+// The cookie is taken as issued at the latest time with its low 32 bits. One from an earlier turn of those bits,
+// about 71 minutes apart, is then dated to the wrong turn and fails the MAC instead of looking fresh again.
+bool rudp_cookie_valid(const struct sockaddr_in *peer, unsigned long long cookie) {
+    long long now = rudp_now_us();
+    long long age_us = (unsigned int)((unsigned int)now - (unsigned int)cookie);
+    return cookie != 0 && age_us < RUDP_COOKIE_LIFETIME_US && rudp_cookie(peer, now - age_us) == cookie;
+}
+
+// Cookies the client was given, so the next connection to the same server can send data with its SYN.
+// Shared by every client socket of the process, which may connect from several threads at once.
+static struct {
+    struct sockaddr_in addr;
+    unsigned long long cookie;
+    long long stored_us; // Not offered to the server any more once it is older than a cookie lives
+} rudp_cookie_cache[RUDP_COOKIE_CACHE];
+static unsigned int rudp_cookie_cache_next = 0;
+static pthread_mutex_t rudp_cookie_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned long long rudp_cookie_lookup(const struct sockaddr_in *peer) {
+    unsigned long long cookie = 0;
+    long long now = rudp_now_us();
+    pthread_mutex_lock(&rudp_cookie_cache_lock);
+    for (int i = 0; i < RUDP_COOKIE_CACHE && cookie == 0; i++) {
+        if (rudp_cookie_cache[i].cookie != 0 && rudp_cookie_cache[i].addr.sin_addr.s_addr == peer->sin_addr.s_addr &&
+            rudp_cookie_cache[i].addr.sin_port == peer->sin_port &&
+            now - rudp_cookie_cache[i].stored_us < RUDP_COOKIE_LIFETIME_US) {
+            cookie = rudp_cookie_cache[i].cookie;
         }
     }
+    pthread_mutex_unlock(&rudp_cookie_cache_lock);
+    return cookie;
+}
 
-    return bytes_sent; // Return number of bytes sent
+void rudp_cookie_store(const struct sockaddr_in *peer, unsigned long long cookie) {
+    pthread_mutex_lock(&rudp_cookie_cache_lock);
+    int slot = -1;
+    for (int i = 0; i < RUDP_COOKIE_CACHE && slot < 0; i++) {
+        if (rudp_cookie_cache[i].addr.sin_addr.s_addr == peer->sin_addr.s_addr && rudp_cookie_cache[i].addr.sin_port == peer->sin_port) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        slot = (int)(rudp_cookie_cache_next++ % RUDP_COOKIE_CACHE); // Replace the oldest entry
+    }
+    rudp_cookie_cache[slot].addr = *peer;
+    rudp_cookie_cache[slot].cookie = cookie;
+    rudp_cookie_cache[slot].stored_us = rudp_now_us();
+    pthread_mutex_unlock(&rudp_cookie_cache_lock);
 }
 
+/*
+* @brief Client side of a SYN-ACK: keep the cookie, settle the parameters and confirm with an ACK
+* that lets the server open the connection.
+* @return 1 on success, -1 on error.
+*/
+int rudp_syn_ack(RUDP_Socket *sockfd, RUDP_Header *header, const RUDP_Handshake *options) {
+    sockfd->cookie = options->cookie;
+    rudp_cookie_store(&sockfd->dest_addr, options->cookie);
+    rudp_fec_negotiate(sockfd, options->fec_k, options->fec_m);
+    rudp_lz_negotiate(sockfd, options->compress);
+    rudp_checksum_negotiate(sockfd, options->no_checksum);
+    if (sockfd->shm != NULL && options->shm_pid == 0) {
+        rudp_shm_decline(sockfd); // The server will not map our rings
+    }
+    rudp_process_ack(sockfd, header);
+    if (send_control_packet(sockfd, ACK_FLAG) < 0) {
+        return -1;
+    }
 
-int rudp_rcv_file_1(RUDP_Socket *sockfd, char *buffer, size_t buffer_size,struct sockaddr_in *sndr_addr,
-        socklen_t sndr_len) {
-    int bytes_received = -1;
-    bool ack1_sent = false;
-    bool ack2_sent = false;
-    bool checksum_received = false;
-    unsigned short int sent_checksum ;
-    unsigned short int recvd_checksum;
-
-    while (!ack2_sent) {
-        // Receive the header for checksum
-        RUDP_Header header;
-        ssize_t bytes_received_header = receive_control_packet(sockfd, &header, sndr_addr, &sndr_len);
-        if (bytes_received_header < 0) {
-            perror("recv");
-            return -1; // Error in receiving header
-        } else if (bytes_received_header == 0) {
-            printf("Connection closed by peer\n");
-            return -1;
+    // A server that did not know our cookie dropped the data sent with the SYN, resend it right away
+    if (sockfd->snd_una == 0 && sockfd->snd_nxt != 0) {
+        for (unsigned int seq = sockfd->snd_una; seq != sockfd->snd_nxt; seq++) {
+            sockfd->snd_queue[seq % RUDP_SND_SEGS]->lost = true;
         }
+    }
+    return rudp_pump(sockfd);
+}
+
+int rudp_set_ack_policy(RUDP_Socket *sockfd, unsigned int ack_every, unsigned int ack_delay_ms) {
+    if (sockfd == NULL || ack_every == 0) {
+        return -1; // Invalid arguments
+    }
+    sockfd->ack_every = ack_every;
+    sockfd->ack_delay_ms = ack_delay_ms;
+    sockfd->saved_ack_every = ack_every; // Also what leaving the low-latency mode goes back to
+    sockfd->saved_ack_delay_ms = ack_delay_ms;
+    return 1;
+}
+
+int rudp_get_stats(RUDP_Socket *sockfd, RUDP_Stats *stats) {
+    if (sockfd == NULL || stats == NULL) {
+        return -1;
+    }
+    *stats = sockfd->stats;
+    stats->cwnd = sockfd->cwnd;
+    return 1;
+}
 
+// Send a pure ACK carrying the cumulative ACK for everything received so far
+int rudp_send_ack(RUDP_Socket *sockfd) {
+    if (send_control_packet(sockfd, ACK_FLAG) < 0) {
+        return -1;
+    }
+    sockfd->ack_pending = 0;
+    sockfd->ack_deadline_us = 0;
+    sockfd->stats.acks_sent++;
+    return 1;
+}
 
-        // Check if header contains checksum
-        if (header.flags == seq_no) {
-            checksum_received = true;
-            sent_checksum = header.checksum;
-         //   printf("checksum received\n");
+// Send header and payload as one datagram on a subflow without copying the payload. SYNs, our control packets
+// until the server has answered and subflow joins get the handshake options in front of the payload.
+int rudp_send_packet(RUDP_Socket *sockfd, int path, RUDP_Header *header, void *payload, int payload_size) {
+    header->path = (unsigned char)path;
+    struct iovec iov[3];
+    int count = 0;
+    iov[count].iov_base = header;
+    iov[count++].iov_len = sizeof(RUDP_Header);
+    RUDP_Handshake options;
+    if ((header->flags & (SYN_FLAG | PATH_FLAG)) || (sockfd->syn_pending && !(header->flags & (DATA_FLAG | FEC_FLAG)))) {
+        memset(&options, 0, sizeof(options));
+        options.cookie = sockfd->isServer ? rudp_cookie(&sockfd->dest_addr, rudp_now_us()) : sockfd->cookie;
+        options.fec_k = (unsigned char)sockfd->fec_k;
+        options.fec_m = (unsigned char)sockfd->fec_m;
+        options.compress = sockfd->compress;
+        if (sockfd->shm != NULL) {
+            options.shm_pid = (unsigned int)getpid();
+            options.shm_fd = sockfd->shm_fd;
+            options.shm_token = sockfd->shm->token;
         }
+        options.no_checksum = sockfd->no_checksum;
+        iov[count].iov_base = &options;
+        iov[count++].iov_len = sizeof(options);
+    }
+    if (payload_size > 0) {
+        iov[count].iov_base = payload;
+        iov[count++].iov_len = payload_size;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = rudp_path_addr(sockfd, path);
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    return sendmsg(rudp_path_fd(sockfd, path), &msg, 0) < 0 ? -1 : 1;
+}
+
+// Take the handshake options off the front of a received payload: a SYN always has them, a control packet has
+// them while its sender waits for the server. Zeroed when the packet carries none.
+void rudp_handshake_read(const RUDP_Header *header, char **payload, int *payload_size, RUDP_Handshake *options) {
+    memset(options, 0, sizeof(*options));
+    bool carried = (header->flags & SYN_FLAG) || !(header->flags & (DATA_FLAG | FEC_FLAG));
+    if (carried && *payload_size >= (int)sizeof(*options)) {
+        memcpy(options, *payload, sizeof(*options));
+        *payload += sizeof(*options);
+        *payload_size -= sizeof(*options);
+    }
+}
+
+// Fill in the header of a data segment, all but the payload checksum
+void rudp_segment_header(RUDP_Socket *sockfd, RUDP_Segment *seg, RUDP_Header *header) {
+    memset(header, 0, sizeof(*header));
+    header->length = seg->length;
+    header->flags = seg->flags | ACK_FLAG;
+    if (sockfd->syn_pending && seg->seq == 0) {
+        // The first segment is the SYN until the server has answered
+        header->flags = seg->flags | SYN_FLAG;
+    }
+    header->seq = seg->seq;
+    header->stream = seg->stream;
+    header->stream_seq = seg->stream_seq;
+    header->ack = sockfd->rcv_nxt;
+    header->sack = rudp_sack_bitmap(sockfd);
+    header->fec_m = (unsigned char)(header->flags & SYN_FLAG ? 0 : rudp_fec_recommend(sockfd));
+    header->window = rudp_rcv_window(sockfd);
+    sockfd->rcv_adv_edge = sockfd->rcv_nxt + header->window;
+}
+
+// Transmit one queued segment. Every data segment piggybacks the current cumulative ACK,
+// so a pending delayed ACK is satisfied for free whenever there is reverse data.
+int rudp_send_segment(RUDP_Socket *sockfd, RUDP_Segment *seg) {
+    RUDP_Header header;
+    rudp_segment_header(sockfd, seg, &header);
+    header.checksum = sockfd->payload_checksum(seg->data, seg->length);
+
+    if (rudp_send_packet(sockfd, seg->path, &header, seg->data, seg->length) < 0) {
+        perror("Error sending data segment");
+        return -1;
+    }
 
+    bool first_transmission = seg->sent_us == 0;
+    if (!first_transmission) {
+        seg->retransmitted = true;
+        seg->fec_close_us = 0; // Retransmissions carry no parity
+        sockfd->stats.segments_retransmitted++;
+    }
+    seg->sent_us = rudp_now_us();
+    sockfd->stats.segments_sent++;
+    sockfd->paths[seg->path].segments_sent++;
+    if (sockfd->paths[seg->path].unanswered_us == 0) {
+        sockfd->paths[seg->path].unanswered_us = seg->sent_us;
+    }
+    if (sockfd->ack_pending > 0 || sockfd->ack_deadline_us != 0) {
+        sockfd->stats.acks_piggybacked++;
+        sockfd->ack_pending = 0;
+        sockfd->ack_deadline_us = 0;
+    }
 
+    if (first_transmission && sockfd->fec != NULL) {
+        return rudp_fec_encode(sockfd, seg);
+    }
+    return 1;
+}
 
-        // Send acknowledgment 1 if checksum received
-        if (checksum_received && !ack1_sent) {
-            RUDP_Header ack1_header;
-            ack1_header.flags = ACK_FLAG;
-            ssize_t bytes_sent_ack1 = sendto(sockfd->socket_fd, &ack1_header, sizeof(ack1_header), 0, sndr_addr,
-                                             sndr_len);
-            if (bytes_sent_ack1 < 0) {
-                perror("send");
-                return -1; // Error in sending acknowledgment 1
+// Transmit lost segments first, then new ones, while the congestion and receive windows allow.
+// With several subflows each segment goes to the one the scheduler picks, as long as one has room.
+int rudp_pump(RUDP_Socket *sockfd) {
+    if (!sockfd->isConnected) {
+        return 1; // Queued until rudp_connect()
+    }
+    unsigned int pipe[RUDP_MAX_PATHS];
+    rudp_path_pipes(sockfd, pipe);
+    unsigned int lost_seq = sockfd->snd_una;
+    while (true) {
+        // Lowest segment marked lost
+        while (lost_seq != sockfd->snd_nxt && !sockfd->snd_queue[lost_seq % RUDP_SND_SEGS]->lost) {
+            lost_seq++;
+        }
+        bool resend = lost_seq != sockfd->snd_nxt;
+        if (!resend && !(sockfd->snd_pending > 0 && sockfd->snd_nxt - sockfd->snd_una < RUDP_WINDOW &&
+                         SEQ_LT(sockfd->snd_nxt, sockfd->snd_wnd_edge))) {
+            break;
+        }
+        // A resend prefers another subflow than the one that lost it
+        int path = rudp_path_pick(sockfd, pipe, resend ? sockfd->snd_queue[lost_seq % RUDP_SND_SEGS]->path : -1);
+        if (path < 0) {
+            break;
+        }
+        if (resend) {
+            RUDP_Segment *seg = sockfd->snd_queue[lost_seq % RUDP_SND_SEGS];
+            seg->path = (unsigned char)path;
+            if (rudp_send_segment(sockfd, seg) < 0) {
+                return -1;
+            }
+            seg->lost = false;
+            if (sockfd->in_recovery) {
+                sockfd->stats.fast_retransmits++;
+            }
+        } else {
+            // The scheduler picks the stream, the segment takes the next sequence number
+            RUDP_Stream *stream = &sockfd->streams[rudp_schedule(sockfd)];
+            RUDP_Segment *seg = stream->pend_head;
+            stream->pend_head = seg->next;
+            if (stream->pend_head == NULL) {
+                stream->pend_tail = NULL;
+            }
+            stream->pend_count--;
+            sockfd->snd_pending--;
+            seg->next = NULL;
+            seg->seq = sockfd->snd_nxt;
+            seg->path = (unsigned char)path;
+            sockfd->snd_queue[sockfd->snd_nxt % RUDP_SND_SEGS] = seg;
+            sockfd->snd_nxt++;
+            if (rudp_send_segment(sockfd, seg) < 0) {
+                return -1;
             }
-            ack1_sent = true;
         }
+        pipe[path]++;
+    }
+    rudp_arm_timers(sockfd);
+    return 1;
+}
 
-        // Receive the data if checksum received and acknowledgment 1 sent
-        if (checksum_received && ack1_sent) {
-            ssize_t bytes_received_data = recvfrom(sockfd->socket_fd, buffer, buffer_size, 0, sndr_addr, &sndr_len);
-            if (bytes_received_data < 0) {
-                perror("recv");
-                return -1; // Error in receiving data
-            }
-//             if( sent_checksum != calculate_checksum(buffer, sizeof(buffer)) ){ printf("checksum mismatch");return 0;}
-//            if (recvd_checksum != sent_checksum) {
-//                printf("checksum mismatched in receive file 1 \n ");
-//                return EXIT_FAILURE;
-//            }
-//            printf("file received\n");
+// Build the SACK bitmap for the segments held out of order above rcv_nxt
+unsigned long long rudp_sack_bitmap(RUDP_Socket *sockfd) {
+    unsigned long long sack = 0;
+    for (unsigned int i = 0; i < 64; i++) {
+        unsigned int seq = sockfd->rcv_nxt + 1 + i;
+        if (!SEQ_LT(seq, sockfd->rcv_read + RUDP_RCV_SEGS)) {
+            break;
         }
+        RUDP_Segment *slot = &sockfd->rcv_queue[seq % RUDP_RCV_SEGS];
+        if (slot->in_use && slot->seq == seq) {
+            sack |= 1ULL << i;
+        }
+    }
+    return sack;
+}
+
+// RFC 6298 smoothed RTT and retransmission timeout
+void rudp_update_rtt(RUDP_Socket *sockfd, long long sample_us) {
+    if (sample_us <= 0) {
+        sample_us = 1;
+    }
+    if (sockfd->srtt_us == 0) {
+        sockfd->srtt_us = sample_us;
+        sockfd->rttvar_us = sample_us / 2;
+    } else {
+        long long delta = sockfd->srtt_us > sample_us ? sockfd->srtt_us - sample_us : sample_us - sockfd->srtt_us;
+        sockfd->rttvar_us = (3 * sockfd->rttvar_us + delta) / 4;
+        sockfd->srtt_us = (7 * sockfd->srtt_us + sample_us) / 8;
+    }
+    sockfd->rto_us = sockfd->srtt_us + 4 * sockfd->rttvar_us;
+    if (sockfd->rto_us < RUDP_MIN_RTO_MS * 1000LL) {
+        sockfd->rto_us = RUDP_MIN_RTO_MS * 1000LL;
+    }
+    if (sockfd->rto_us > RUDP_MAX_RTO_MS * 1000LL) {
+        sockfd->rto_us = RUDP_MAX_RTO_MS * 1000LL;
+    }
+    sockfd->stats.srtt_us = sockfd->srtt_us;
+}
+
+// Mark as lost every hole that has enough SACKed segments above it and was sent before something already delivered.
+// With several subflows both tests only look at segments of the hole's own subflow, so a slower one is not
+// taken for lossy because a faster one overtook it.
+void rudp_detect_losses(RUDP_Socket *sockfd) {
+    unsigned int outstanding = sockfd->snd_nxt - sockfd->snd_una;
+    if (outstanding == 0) {
+        return;
+    }
 
+    // With few segments in flight there cannot be three duplicates; after a tail probe one is enough
+    unsigned int thresh = RUDP_DUPTHRESH;
+    if (outstanding - 1 < thresh) {
+        thresh = outstanding > 1 ? outstanding - 1 : 1;
+    }
+    if (sockfd->tlp_sent) {
+        thresh = 1;
+    }
 
+    bool multipath = sockfd->path_count > 1;
+    long long now = rudp_now_us();
+    bool newly_lost = false;
+    unsigned int sacked_above[RUDP_MAX_PATHS] = {0};
+    for (unsigned int seq = sockfd->snd_nxt - 1; SEQ_LEQ(sockfd->snd_una, seq); seq--) {
+        RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        int path = multipath ? seg->path : 0;
+        long long rack_sent_us = multipath ? sockfd->paths[path].rack_sent_us : sockfd->rack_sent_us;
+        if (seg->sacked) {
+            sacked_above[path]++;
+        } else if (!seg->lost && sacked_above[path] >= thresh && seg->sent_us < rack_sent_us &&
+                   seg->fec_close_us < rack_sent_us) { // With FEC, also wait for something sent after the parity
+            seg->lost = true;
+            newly_lost = true;
+            rudp_path_lost(sockfd, seg, now);
+        }
+    }
 
+    // Plain duplicate ACKs when the hole is beyond what SACK can describe
+    RUDP_Segment *first = sockfd->snd_queue[sockfd->snd_una % RUDP_SND_SEGS];
+    if (!multipath && sockfd->dupacks >= RUDP_DUPTHRESH && !first->sacked && !first->lost && !sockfd->in_recovery &&
+        first->fec_close_us < sockfd->rack_sent_us) {
+        first->lost = true;
+        newly_lost = true;
+    }
 
-        // Send acknowledgment 2
-        RUDP_Header ack2_header;
-        ack2_header.flags = ACK_FLAG;
-        ssize_t bytes_sent_ack2 = sendto(sockfd->socket_fd, &ack2_header, sizeof(ack2_header), 0, sndr_addr,
-                                         sndr_len);
-        if (bytes_sent_ack2 < 0) {
-            perror("send");
-            return -1; // Error in sending acknowledgment 2
+    if (newly_lost && multipath) {
+        // Each subflow already cut its own window, resend on whichever has room
+        if (!sockfd->in_recovery) {
+            sockfd->in_recovery = true;
+            sockfd->recover = sockfd->snd_nxt;
+            sockfd->tlp_deadline_us = 0;
         }
-      // CHECK FOR CHECKSUM EQUALITY in every file part
-        if( sent_checksum != calculate_checksum(buffer, sizeof(buffer)) ){ return 0;// 2 checksums unequal
-        }else{
-//            printf("File Status: Received\n");
-//            printf("2 CheckSums : EQUAL\n");
-            ack2_sent = true;
-            return 1;
+        rudp_pump(sockfd);
+        return;
+    }
+
+    if (newly_lost && !sockfd->in_recovery) {
+        // Enter fast recovery: halve the window and resend the first hole right away
+        sockfd->in_recovery = true;
+        sockfd->recover = sockfd->snd_nxt;
+        sockfd->congestion.reduce(&sockfd->cwnd, &sockfd->ssthresh, outstanding, false);
+        sockfd->cwnd_acked = 0;
+        sockfd->tlp_deadline_us = 0;
+        for (unsigned int seq = sockfd->snd_una; seq != sockfd->snd_nxt; seq++) {
+            RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+            if (seg->lost) {
+                if (rudp_send_segment(sockfd, seg) == 1) {
+                    seg->lost = false;
+                    sockfd->stats.fast_retransmits++;
+                }
+                break;
+            }
         }
     }
-    return bytes_received; // Return number of bytes received
 }
 
+// Process the cumulative and selective ACK carried by an incoming header
+void rudp_process_ack(RUDP_Socket *sockfd, RUDP_Header *header) {
+    unsigned int ack = header->ack;
+
+    // Ignore ACKs for data we never sent
+    if (SEQ_LT(ack, sockfd->snd_una) || !SEQ_LEQ(ack, sockfd->snd_nxt)) {
+        return;
+    }
+    long long now = rudp_now_us();
+    if (sockfd->fec != NULL) {
+        sockfd->fec->peer_m = header->fec_m;
+    }
 
+    // The receiver only moves its right edge forward, so an older, smaller advertisement is stale
+    bool window_update = SEQ_LT(sockfd->snd_wnd_edge, ack + header->window);
+    if (window_update) {
+        sockfd->snd_wnd_edge = ack + header->window;
+    }
 
+    // Mark the segments the receiver holds out of order
+    for (unsigned int i = 0; i < 64; i++) {
+        unsigned int seq = ack + 1 + i;
+        if (!SEQ_LT(seq, sockfd->snd_nxt)) {
+            break;
+        }
+        RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        if (((header->sack >> i) & 1) && !seg->sacked) {
+            rudp_path_delivered(sockfd, seg);
+            seg->sacked = true;
+            seg->lost = false;
+            if (seg->sent_us > sockfd->rack_sent_us) {
+                sockfd->rack_sent_us = seg->sent_us;
+            }
+        }
+    }
+
+    if (SEQ_LT(sockfd->snd_una, ack)) {
+        // RTT sample from the newest acknowledged segment, unless it was retransmitted (Karn)
+        RUDP_Segment *newest = sockfd->snd_queue[(ack - 1) % RUDP_SND_SEGS];
+        if (!newest->retransmitted) {
+            rudp_update_rtt(sockfd, now - newest->sent_us);
+        }
+
+        unsigned int acked = ack - sockfd->snd_una;
+        while (sockfd->snd_una != ack) {
+            RUDP_Segment *seg = sockfd->snd_queue[sockfd->snd_una % RUDP_SND_SEGS];
+            if (seg->sent_us > sockfd->rack_sent_us) {
+                sockfd->rack_sent_us = seg->sent_us;
+            }
+            if (!seg->sacked) {
+                rudp_path_delivered(sockfd, seg);
+            }
+            if (sockfd->fec != NULL) {
+                sockfd->fec->snd_loss += ((seg->retransmitted ? 1.0 : 0.0) - sockfd->fec->snd_loss) / 64;
+            }
+            sockfd->streams[seg->stream].snd_acked = seg->stream_seq + 1;
+            seg->in_use = false;
+            seg->next = sockfd->snd_free;
+            sockfd->snd_free = seg;
+            sockfd->snd_una++;
+        }
+        sockfd->timeouts = 0;
+        sockfd->dupacks = 0;
+        sockfd->tlp_sent = false;
+        rudp_sample_rate(sockfd, acked);
+
+        if (sockfd->in_recovery) {
+            if (SEQ_LEQ(sockfd->recover, sockfd->snd_una)) {
+                sockfd->in_recovery = false; // Full ACK, recovery done
+            } else if (sockfd->path_count == 1) {
+                // Partial ACK: the next hole is lost too
+                RUDP_Segment *seg = sockfd->snd_queue[sockfd->snd_una % RUDP_SND_SEGS];
+                if (!seg->sacked && seg->sent_us < sockfd->rack_sent_us) {
+                    seg->lost = true;
+                }
+            }
+        } else {
+            sockfd->congestion.grow(&sockfd->cwnd, &sockfd->cwnd_acked, sockfd->ssthresh, acked);
+        }
+        if (sockfd->cwnd > RUDP_WINDOW) {
+            sockfd->cwnd = RUDP_WINDOW;
+        }
+        sockfd->rto_deadline_us = 0; // Restarted for the remaining data below
+    } else if (!(header->flags & DATA_FLAG) && !window_update && sockfd->snd_una != sockfd->snd_nxt) {
+        sockfd->dupacks++; // A window update is not a duplicate
+    }
+    rudp_path_acked(sockfd, now);
+
+    rudp_detect_losses(sockfd);
+    rudp_arm_timers(sockfd);
+}
+
+// Store an incoming data segment in the reassembly queue and apply the ACK policy
+void rudp_process_data(RUDP_Socket *sockfd, RUDP_Header *header, char *data, int data_size) {
+    sockfd->stats.segments_received++;
+    if (header->length != data_size || data_size > RUDP_MSS || header->stream >= RUDP_MAX_STREAMS ||
+        !sockfd->payload_intact(sockfd, header, data, data_size)) {
+        sockfd->stats.checksum_errors++;
+        return; // Corrupted, the sender will retransmit it
+    }
+
+    rudp_accept_segment(sockfd, header->seq, header->flags, header->stream, header->stream_seq, data, data_size);
+
+    // The new segment may complete a parity group that is missing others
+    if (sockfd->fec != NULL) {
+        for (int i = 0; i < RUDP_FEC_GROUPS; i++) {
+            RUDP_FEC_Group *group = &sockfd->fec->groups[i];
+            if (group->in_use && SEQ_LEQ(group->base, header->seq) && SEQ_LT(header->seq, group->base + group->k)) {
+                rudp_fec_try_decode(sockfd, group);
+            }
+        }
+    }
+}
+
+// Store a verified data segment, received or rebuilt from parity, and apply the ACK policy
+void rudp_accept_segment(RUDP_Socket *sockfd, unsigned int seq, int flags, int stream, unsigned int stream_seq,
+                         char *data, int data_size) {
+    // Duplicate of something already delivered, or beyond the reassembly queue: ACK at once so the sender resyncs
+    if (SEQ_LT(seq, sockfd->rcv_nxt) || !SEQ_LT(seq, sockfd->rcv_read + RUDP_RCV_SEGS)) {
+        rudp_send_ack(sockfd);
+        return;
+    }
+
+    RUDP_Segment *slot = &sockfd->rcv_queue[seq % RUDP_RCV_SEGS];
+    if (slot->in_use) {
+        rudp_send_ack(sockfd); // Duplicate out-of-order segment
+        return;
+    }
+    slot->in_use = true;
+    slot->seq = seq;
+    slot->flags = flags & (DATA_FLAG | EOC_FLAG | LZ_FLAG);
+    slot->stream = (unsigned char)stream;
+    slot->stream_seq = stream_seq;
+    slot->consumed = false;
+    slot->length = data_size;
+    memcpy(slot->data, data, data_size);
+    rudp_sample_rate(sockfd, 1);
+
+    bool in_order = seq == sockfd->rcv_nxt;
+    if (in_order) {
+        while (SEQ_LT(sockfd->rcv_nxt, sockfd->rcv_read + RUDP_RCV_SEGS) &&
+               sockfd->rcv_queue[sockfd->rcv_nxt % RUDP_RCV_SEGS].in_use &&
+               sockfd->rcv_queue[sockfd->rcv_nxt % RUDP_RCV_SEGS].seq == sockfd->rcv_nxt) {
+            sockfd->rcv_nxt++;
+        }
+    }
+
+    // ACK immediately on out-of-order arrival, when a hole gets filled and at the end of a chunk
+    bool filled_gap = in_order && sockfd->rcv_nxt - seq > 1;
+    if (!in_order || filled_gap || (flags & EOC_FLAG)) {
+        rudp_send_ack(sockfd);
+        return;
+    }
+
+    // Otherwise ACK every N segments, or when the delayed-ACK timer fires
+    sockfd->ack_pending++;
+    if (sockfd->ack_pending >= sockfd->ack_every || sockfd->ack_delay_ms == 0) {
+        rudp_send_ack(sockfd);
+    } else if (sockfd->ack_deadline_us == 0) {
+        sockfd->ack_deadline_us = rudp_now_us() + sockfd->ack_delay_ms * 1000LL;
+    }
+}
+
+// Arm the retransmission timer and, outside recovery, the tail-loss probe for outstanding data
+void rudp_arm_timers(RUDP_Socket *sockfd) {
+    // Persist timer: data is waiting, the receiver has no room and nothing in flight will bring an ACK
+    if (sockfd->snd_pending > 0 && sockfd->snd_una == sockfd->snd_nxt &&
+        !SEQ_LT(sockfd->snd_nxt, sockfd->snd_wnd_edge)) {
+        if (sockfd->persist_deadline_us == 0) {
+            sockfd->stats.window_stalls++;
+            sockfd->persist_us = 2 * sockfd->srtt_us > RUDP_MIN_PTO_US ? 2 * sockfd->srtt_us : RUDP_MIN_PTO_US;
+            sockfd->persist_deadline_us = rudp_now_us() + sockfd->persist_us;
+        }
+    } else {
+        sockfd->persist_deadline_us = 0;
+    }
+
+    if (sockfd->snd_una == sockfd->snd_nxt) {
+        sockfd->rto_deadline_us = 0;
+        sockfd->tlp_deadline_us = 0;
+        return;
+    }
+    long long now = rudp_now_us();
+    if (sockfd->rto_deadline_us == 0) {
+        sockfd->rto_deadline_us = now + rudp_path_rto(sockfd);
+    }
+    if (sockfd->in_recovery || sockfd->tlp_sent || sockfd->srtt_us == 0) {
+        sockfd->tlp_deadline_us = 0;
+        return;
+    }
+
+    // Probe timeout of 2*SRTT, plus the peer's delayed-ACK allowance when a lone segment is out
+    long long pto_us = 2 * sockfd->srtt_us;
+    if (sockfd->snd_nxt - sockfd->snd_una == 1) {
+        pto_us += RUDP_ACK_DELAY_MS * 1000LL;
+    }
+    if (pto_us < RUDP_MIN_PTO_US) {
+        pto_us = RUDP_MIN_PTO_US;
+    }
+    sockfd->tlp_deadline_us = now + pto_us;
+    if (sockfd->tlp_deadline_us > sockfd->rto_deadline_us) {
+        sockfd->tlp_deadline_us = 0; // The RTO comes first anyway
+    }
+}
+
+// No ACK for about 2*SRTT: resend the last segment the receiver does not hold, so its SACK reveals any tail loss
+int rudp_tail_loss_probe(RUDP_Socket *sockfd) {
+    sockfd->tlp_deadline_us = 0;
+    if (sockfd->snd_una == sockfd->snd_nxt) {
+        return 1;
+    }
+    unsigned int seq = sockfd->snd_nxt - 1;
+    while (seq != sockfd->snd_una && sockfd->snd_queue[seq % RUDP_SND_SEGS]->sacked) {
+        seq--;
+    }
+    RUDP_Segment *last = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+    int path = rudp_path_pick(sockfd, NULL, -1); // Probe on the quickest subflow
+    if (path >= 0) {
+        last->path = (unsigned char)path;
+    }
+    if (rudp_send_segment(sockfd, last) < 0) {
+        return -1;
+    }
+    sockfd->tlp_sent = true;
+    sockfd->stats.tlp_probes++;
+    return 1;
+}
+
+// Free reassembly slots above rcv_nxt: the queue size minus what the application has not read yet
+unsigned int rudp_rcv_window(RUDP_Socket *sockfd) {
+    return sockfd->rcv_read + RUDP_RCV_SEGS - sockfd->rcv_nxt;
+}
+
+// The application freed buffer space: tell the sender if its view of the window is closed or well behind
+int rudp_window_update(RUDP_Socket *sockfd) {
+    unsigned int edge = sockfd->rcv_read + RUDP_RCV_SEGS;
+    if (!SEQ_LT(sockfd->rcv_adv_edge, edge)) {
+        return 1;
+    }
+    if (sockfd->rcv_adv_edge == sockfd->rcv_nxt || edge - sockfd->rcv_adv_edge >= RUDP_RCV_SEGS / 4) {
+        sockfd->stats.window_updates++;
+        return rudp_send_ack(sockfd);
+    }
+    return 1;
+}
+
+// Persist timer expired with the peer's window still closed: ask for a fresh ACK in case the window update was lost
+int rudp_window_probe(RUDP_Socket *sockfd) {
+    if (send_control_packet(sockfd, ACK_FLAG | PROBE_FLAG) < 0) {
+        return -1;
+    }
+    sockfd->stats.window_probes++;
+    sockfd->persist_us *= 2;
+    if (sockfd->persist_us > RUDP_MAX_PERSIST_MS * 1000LL) {
+        sockfd->persist_us = RUDP_MAX_PERSIST_MS * 1000LL;
+    }
+    sockfd->persist_deadline_us = rudp_now_us() + sockfd->persist_us;
+    return 1;
+}
+
+// Request kernel buffers of the given size and record what was granted. SO_*BUFFORCE needs CAP_NET_ADMIN
+// but ignores the rmem_max/wmem_max sysctls; without it the kernel silently clamps the plain request.
+int rudp_set_buffers(RUDP_Socket *sockfd, int bytes) {
+    int result = 1;
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        int fd = rudp_path_fd(sockfd, p);
+        if (fd < 0 || (p > 0 && fd == sockfd->socket_fd)) {
+            continue; // A server's subflows share its socket
+        }
+        if ((SO_SNDBUFFORCE < 0 || setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &bytes, sizeof(bytes)) < 0) &&
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) < 0) {
+            perror("setsockopt SO_SNDBUF");
+            result = -1;
+        }
+        if ((SO_RCVBUFFORCE < 0 || setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0) &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+            perror("setsockopt SO_RCVBUF");
+            result = -1;
+        }
+    }
+    sockfd->sockbuf_req = bytes;
+    int fd = sockfd->socket_fd;
+
+    int granted = 0;
+    socklen_t len = sizeof(granted);
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &granted, &len) == 0) {
+        sockfd->stats.sndbuf_bytes = (unsigned long)granted;
+    }
+    len = sizeof(granted);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &granted, &len) == 0) {
+        sockfd->stats.rcvbuf_bytes = (unsigned long)granted;
+    }
+    return result;
+}
+
+// Count delivered segments (acknowledged on the sender, stored on the receiver) and close a
+// delivery-rate sample once it spans at least an RTT
+void rudp_sample_rate(RUDP_Socket *sockfd, unsigned int delivered) {
+    long long now = rudp_now_us();
+    long long interval_us = sockfd->srtt_us > RUDP_RATE_INTERVAL_MS * 1000LL ? sockfd->srtt_us : RUDP_RATE_INTERVAL_MS * 1000LL;
+    if (sockfd->rate_start_us == 0 || now - sockfd->rate_start_us > 8 * interval_us) {
+        // First delivery after an idle period, which says nothing about the path
+        sockfd->rate_start_us = now;
+        sockfd->rate_delivered = delivered;
+        return;
+    }
+    sockfd->rate_delivered += delivered;
+    if (now - sockfd->rate_start_us < interval_us) {
+        return;
+    }
+
+    double sample = sockfd->rate_delivered * 1000000.0 / (now - sockfd->rate_start_us);
+    if (sample > sockfd->delivery_rate) {
+        sockfd->delivery_rate = sample;
+    } else {
+        sockfd->delivery_rate = (7 * sockfd->delivery_rate + sample) / 8;
+    }
+    sockfd->rate_start_us = now;
+    sockfd->rate_delivered = 0;
+    rudp_resize_buffers(sockfd);
+}
+
+// Resize the kernel buffers to twice the bandwidth-delay product once it drifts a quarter away from the current size
+int rudp_resize_buffers(RUDP_Socket *sockfd) {
+    if (sockfd->srtt_us == 0) {
+        return 1; // No RTT yet
+    }
+    double bdp = sockfd->delivery_rate * sockfd->srtt_us / 1000000.0;
+    double segments = 2 * ceil(bdp);
+    if (segments < RUDP_WINDOW + RUDP_FEC_MAX_M) {
+        segments = RUDP_WINDOW + RUDP_FEC_MAX_M;
+    }
+    double bytes = segments * RUDP_DGRAM_CHARGE;
+    if (bytes > RUDP_MAX_SOCKBUF) {
+        bytes = RUDP_MAX_SOCKBUF;
+    }
+    if (bytes * 4 >= sockfd->sockbuf_req * 3.0 && bytes * 4 <= sockfd->sockbuf_req * 5.0) {
+        return 1;
+    }
+    return rudp_set_buffers(sockfd, (int)bytes);
+}
+
+// Retransmission timer expired: back off, collapse the window and resend everything not SACKed
+int rudp_retransmit_timeout(RUDP_Socket *sockfd) {
+    sockfd->timeouts++;
+    sockfd->stats.rto_timeouts++;
+    if (sockfd->timeouts > RUDP_MAX_TIMEOUTS) {
+        printf("Peer is not responding, giving up\n");
+        return -1;
+    }
+    printf("Timeout occurred, retransmitting from segment %u\n", sockfd->snd_una);
+
+    sockfd->congestion.reduce(&sockfd->cwnd, &sockfd->ssthresh, sockfd->snd_nxt - sockfd->snd_una, true);
+    sockfd->cwnd_acked = 0;
+    sockfd->in_recovery = false;
+    sockfd->tlp_sent = false;
+    sockfd->dupacks = 0;
+    for (unsigned int seq = sockfd->snd_una; seq != sockfd->snd_nxt; seq++) {
+        RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        if (!seg->sacked) {
+            seg->lost = true;
+        }
+    }
+
+    sockfd->rto_us *= 2;
+    if (sockfd->rto_us > RUDP_MAX_RTO_MS * 1000LL) {
+        sockfd->rto_us = RUDP_MAX_RTO_MS * 1000LL;
+    }
+    sockfd->rto_deadline_us = 0;
+    return rudp_pump(sockfd);
+}
+
+/*
+* @brief Process one datagram read from a connection's socket or one of its subflows.
+* @return 1 on success, -1 on error.
+*/
+int rudp_poll_datagram(RUDP_Socket *sockfd, int fd, struct msghdr *msg, ssize_t bytes_received) {
+    RUDP_Packet *packet = (RUDP_Packet *)msg->msg_iov[0].iov_base;
+    const struct sockaddr_in *from = (const struct sockaddr_in *)msg->msg_name;
+#ifdef SO_RXQ_OVFL
+    // The kernel attaches its running drop count once the receive buffer has overflowed
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            unsigned int drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            sockfd->stats.rx_queue_drops = drops;
+        }
+    }
+#endif
+    if (bytes_received < (ssize_t)sizeof(RUDP_Header)) {
+        return 1;
+    }
+    RUDP_Header *header = &packet->header;
+    char *payload = packet->data;
+    int payload_size = (int)(bytes_received - sizeof(RUDP_Header));
+    RUDP_Handshake options;
+    memset(&options, 0, sizeof(options));
+    if (header->flags & (SYN_FLAG | PATH_FLAG)) {
+        rudp_handshake_read(header, &payload, &payload_size, &options); // A SYN's, in front of its data, or a join's
+    }
+
+    // Only the peer's addresses count, a new one once it proves to be the same client
+    int path = rudp_path_lookup(sockfd, fd, from);
+    if (path < 0) {
+        path = rudp_path_join(sockfd, header, &options, from);
+    }
+    if (path >= 0) {
+        rudp_path_heard(sockfd, path, header);
+        if (!sockfd->isServer && header->flags == SYN_ACK_FLAG) {
+            if (rudp_syn_ack(sockfd, header, &options) < 0) {
+                return -1; // Answer to a SYN that carried data
+            }
+        } else if (!(header->flags & SYN_FLAG)) {
+            sockfd->syn_pending = false; // Only a server with our connection sends anything else
+        }
+        if ((header->flags & ACK_FLAG) && !(header->flags & SYN_FLAG)) {
+            if (!(header->flags & DATA_FLAG)) {
+                sockfd->stats.acks_received++;
+            }
+            rudp_process_ack(sockfd, header);
+            if (sockfd->snd_pending > 0 && rudp_pump(sockfd) < 0) {
+                return -1; // Keep queued data moving while the application only reads
+            }
+            if ((header->flags & PROBE_FLAG) && rudp_send_ack(sockfd) < 0) {
+                return -1; // Answer a window probe right away
+            }
+        }
+        if (header->flags & DATA_FLAG) {
+            rudp_process_data(sockfd, header, payload, payload_size);
+        } else if (header->flags & FEC_FLAG) {
+            rudp_fec_process_parity(sockfd, header, payload, payload_size);
+        }
+        if (((header->flags & FIN_FLAG) || sockfd->fin_sent) && rudp_process_fin(sockfd, header) < 0) {
+            return -1;
+        }
+        if (sockfd->isServer && (header->flags & SYN_FLAG) && !(header->flags & ACK_FLAG) &&
+            send_control_packet(sockfd, SYN_ACK_FLAG) < 0) {
+            return -1; // The client missed our SYN-ACK and sent its SYN again
+        }
+    }
+    return 1;
+}
+
+/*
+* @brief rudp_poll()'s wait: block until a datagram arrives or wake_us, then process it.
+* @return 1 if a datagram was processed, 0 on timeout, -1 on error.
+*/
+int rudp_wait_datagram(RUDP_Socket *sockfd, long long wake_us) {
+    struct timeval timeout;
+    struct timeval *timeout_ptr = NULL;
+    if (wake_us != 0) {
+        long long wait_us = wake_us - rudp_now_us();
+        if (wait_us < 0) {
+            wait_us = 0;
+        }
+        timeout.tv_sec = wait_us / 1000000;
+        timeout.tv_usec = wait_us % 1000000;
+        timeout_ptr = &timeout;
+    }
+    if (sockfd->shm != NULL && !sockfd->shm_peer_gone) {
+        // The peer rings our doorbell for ring traffic and for every datagram, so the socket only needs a look
+        rudp_shm_sleep(sockfd, wake_us);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+        timeout_ptr = &timeout;
+    }
+
+    fd_set read_fds;
+    int max_fd = rudp_path_fds(sockfd, &read_fds);
+
+    int select_result = select(max_fd + 1, &read_fds, NULL, NULL, timeout_ptr);
+    if (select_result < 0 && errno != EINTR) {
+        perror("select");
+        return -1; // Error in select function
+    }
+
+    if (select_result > 0) {
+        RUDP_Packet packet;
+        struct iovec iov;
+        iov.iov_base = &packet;
+        iov.iov_len = sizeof(packet);
+        char control[CMSG_SPACE(sizeof(unsigned int))];
+        struct sockaddr_in from;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int fd = rudp_path_readable(sockfd, &read_fds);
+        ssize_t bytes_received = recvmsg(fd, &msg, 0);
+        if (bytes_received < 0) {
+            perror("recvmsg");
+            return -1;
+        }
+        if (rudp_poll_datagram(sockfd, fd, &msg, bytes_received) < 0) {
+            return -1;
+        }
+    }
+    return select_result > 0 ? 1 : 0;
+}
+
+/*
+* @brief Wait for one incoming packet and process it, firing the delayed-ACK and retransmission timers on the way.
+* @param deadline_us Absolute time to give up waiting, 0 to wait until a packet or a timer.
+* @return 1 if a packet was processed, 0 on timeout, -1 on error.
+*/
+int rudp_poll(RUDP_Socket *sockfd, long long deadline_us) {
+    long long wake_us = deadline_us;
+    if (sockfd->ack_deadline_us != 0 && (wake_us == 0 || sockfd->ack_deadline_us < wake_us)) {
+        wake_us = sockfd->ack_deadline_us;
+    }
+    if (sockfd->rto_deadline_us != 0 && (wake_us == 0 || sockfd->rto_deadline_us < wake_us)) {
+        wake_us = sockfd->rto_deadline_us;
+    }
+    if (sockfd->tlp_deadline_us != 0 && (wake_us == 0 || sockfd->tlp_deadline_us < wake_us)) {
+        wake_us = sockfd->tlp_deadline_us;
+    }
+    if (sockfd->persist_deadline_us != 0 && (wake_us == 0 || sockfd->persist_deadline_us < wake_us)) {
+        wake_us = sockfd->persist_deadline_us;
+    }
+    long long path_wake_us = rudp_path_wake(sockfd);
+    if (path_wake_us != 0 && (wake_us == 0 || path_wake_us < wake_us)) {
+        wake_us = path_wake_us;
+    }
+
+    int received = 0;
+    if (sockfd->spin_us > 0 && (sockfd->shm == NULL || sockfd->shm_peer_gone) &&
+        (wake_us == 0 || wake_us > rudp_now_us())) {
+        received = rudp_spin(sockfd, wake_us); // The next packet usually shows up within the budget, sparing the wakeup
+    }
+    if (received == 0) {
+        received = rudp_wait_datagram(sockfd, wake_us);
+    }
+    if (received < 0) {
+        return -1;
+    }
+
+    long long now = rudp_now_us();
+    if (sockfd->ack_deadline_us != 0 && now >= sockfd->ack_deadline_us) {
+        if (rudp_send_ack(sockfd) < 0) {
+            return -1;
+        }
+    }
+    if (sockfd->rto_deadline_us != 0 && now >= sockfd->rto_deadline_us) {
+        if (rudp_retransmit_timeout(sockfd) < 0) {
+            return -1;
+        }
+    } else if (sockfd->tlp_deadline_us != 0 && now >= sockfd->tlp_deadline_us) {
+        if (rudp_tail_loss_probe(sockfd) < 0) {
+            return -1;
+        }
+    } else if (sockfd->persist_deadline_us != 0 && now >= sockfd->persist_deadline_us) {
+        if (rudp_window_probe(sockfd) < 0) {
+            return -1;
+        }
+    }
+    if (rudp_path_timers(sockfd) < 0) {
+        return -1;
+    }
+
+    return received > 0 ? 1 : 0;
+}
+
+/*
+* @brief Queue the concatenated buffers as one chunk of MTU-sized segments on a stream, the last one marked EOC.
+* Only waits for acknowledgments when the send pool is full, so chunks go out back to back.
+* @return The number of bytes queued, -1 on error.
+*/
+int rudp_queue_chunk(RUDP_Socket *sockfd, int stream_id, const struct iovec *iov, int iovcnt) {
+    if (stream_id < 0 || stream_id >= RUDP_MAX_STREAMS) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    if (rudp_shm_using(sockfd, true)) {
+        return rudp_shm_queue_chunk(sockfd, stream_id, iov, total) < 0 ? -1 : (int)total;
+    }
+
+    if (!sockfd->isConnected) {
+        // Before rudp_connect() nothing drains the pool, the chunk has to fit as it is
+        unsigned int free_segs = 0;
+        for (RUDP_Segment *seg = sockfd->snd_free; seg != NULL; seg = seg->next) {
+            free_segs++;
+        }
+        if ((total + RUDP_MSS - 1) / RUDP_MSS > free_segs) {
+            printf("Chunk does not fit in the send pool before connecting\n");
+            return -1;
+        }
+    }
+
+    if (sockfd->compress && sockfd->compress_settled) {
+        const unsigned char *data = (const unsigned char *)iov[0].iov_base;
+        if (iovcnt > 1) {
+            if (rudp_lz_gather(sockfd, iov, iovcnt, total) < 0) {
+                return -1;
+            }
+            data = sockfd->lz->flat;
+        }
+        return rudp_lz_queue_chunk(sockfd, stream_id, data, total) < 0 ? -1 : (int)total;
+    }
+
+    int part = 0;
+    size_t part_offset = 0;
+    size_t queued = 0;
+    while (queued < total) {
+        // Queue as much as the send pool can hold, behind the stream's earlier segments
+        while (queued < total && sockfd->snd_free != NULL) {
+            RUDP_Segment *seg = sockfd->snd_free;
+            sockfd->snd_free = seg->next;
+            size_t length = total - queued < RUDP_MSS ? total - queued : RUDP_MSS;
+            size_t filled = 0;
+            while (filled < length) {
+                size_t take = iov[part].iov_len - part_offset;
+                if (take > length - filled) {
+                    take = length - filled;
+                }
+                memcpy(seg->data + filled, (const char *)iov[part].iov_base + part_offset, take);
+                filled += take;
+                part_offset += take;
+                if (part_offset == iov[part].iov_len) {
+                    part++;
+                    part_offset = 0;
+                }
+            }
+            queued += length;
+            rudp_stream_append(sockfd, stream_id, seg, (int)length, queued == total);
+        }
+
+        if (rudp_pump(sockfd) < 0) {
+            return -1;
+        }
+        if (queued < total && rudp_poll(sockfd, 0) < 0) {
+            return -1;
+        }
+    }
+    return (int)total;
+}
+
+// Put a filled pool segment at the end of a stream's pending list
+void rudp_stream_append(RUDP_Socket *sockfd, int stream_id, RUDP_Segment *seg, int length, bool last) {
+    RUDP_Stream *stream = &sockfd->streams[stream_id];
+    seg->in_use = true;
+    seg->stream = (unsigned char)stream_id;
+    seg->stream_seq = stream->snd_next++;
+    seg->length = length;
+    seg->sent_us = 0;
+    seg->retransmitted = false;
+    seg->sacked = false;
+    seg->lost = false;
+    seg->fec_close_us = 0;
+    seg->flags = DATA_FLAG | (last ? EOC_FLAG : 0);
+    seg->next = NULL;
+    if (stream->pend_tail != NULL) {
+        stream->pend_tail->next = seg;
+    } else {
+        stream->pend_head = seg;
+    }
+    stream->pend_tail = seg;
+    stream->pend_count++;
+    sockfd->snd_pending++;
+}
+
+/*
+* @brief Keep sending until the receiver acknowledged everything queued on every stream.
+* @return 1 on success, -1 on error.
+*/
+int rudp_flush(RUDP_Socket *sockfd) {
+    while (sockfd->snd_una != sockfd->snd_nxt || sockfd->snd_pending > 0) {
+        if (rudp_pump(sockfd) < 0) {
+            return -1;
+        }
+        if ((sockfd->snd_una != sockfd->snd_nxt || sockfd->snd_pending > 0) && rudp_poll(sockfd, 0) < 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+* @brief Queue a buffer as one chunk on a stream without waiting for it to be acknowledged.
+* @return The number of bytes queued, -1 on error.
+*/
+int rudp_stream_send(RUDP_Socket *sockfd, int stream_id, const void *buffer, size_t buffer_size) {
+    struct iovec iov;
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = buffer_size;
+    return rudp_queue_chunk(sockfd, stream_id, &iov, 1);
+}
+
+/*
+* @brief Set how the scheduler shares the connection: lower priority values are always served first,
+* streams of equal priority take turns of `weight` segments each.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_stream_priority(RUDP_Socket *sockfd, int stream_id, int priority, unsigned int weight) {
+    if (sockfd == NULL || stream_id < 0 || stream_id >= RUDP_MAX_STREAMS) {
+        return -1;
+    }
+    sockfd->streams[stream_id].priority = priority;
+    sockfd->streams[stream_id].weight = weight > 0 ? weight : 1;
+    return 1;
+}
+
+// Pick the stream whose queued segment goes next: weighted round-robin among the best priority with data waiting
+int rudp_schedule(RUDP_Socket *sockfd) {
+    int best = INT_MAX;
+    for (int i = 0; i < RUDP_MAX_STREAMS; i++) {
+        if (sockfd->streams[i].pend_count > 0 && sockfd->streams[i].priority < best) {
+            best = sockfd->streams[i].priority;
+        }
+    }
+
+    // Stay on the current stream until its turn is used up, then move to the next eligible one
+    RUDP_Stream *current = &sockfd->streams[sockfd->snd_rr];
+    if (current->pend_count == 0 || current->priority != best || current->credit == 0) {
+        for (int i = 1; i <= RUDP_MAX_STREAMS; i++) {
+            int candidate = (sockfd->snd_rr + i) % RUDP_MAX_STREAMS;
+            RUDP_Stream *stream = &sockfd->streams[candidate];
+            if (stream->pend_count > 0 && stream->priority == best) {
+                sockfd->snd_rr = (unsigned int)candidate;
+                stream->credit = stream->weight;
+                break;
+            }
+        }
+    }
+    sockfd->streams[sockfd->snd_rr].credit--;
+    return (int)sockfd->snd_rr;
+}
+
+/*
+* @brief Find the stream's next segment in the reassembly queue. Segments of other streams and holes
+* do not block it, only a hole that must hold this stream's next segment does.
+* @return The slot, or NULL if the segment has not arrived yet.
+*/
+RUDP_Segment *rudp_stream_next(RUDP_Socket *sockfd, int stream_id, unsigned int *seq) {
+    RUDP_Stream *stream = &sockfd->streams[stream_id];
+    unsigned int s = SEQ_LT(stream->rcv_scan, sockfd->rcv_read) ? sockfd->rcv_read : stream->rcv_scan;
+    bool hole = false;
+    for (; SEQ_LT(s, sockfd->rcv_read + RUDP_RCV_SEGS); s++) {
+        RUDP_Segment *slot = &sockfd->rcv_queue[s % RUDP_RCV_SEGS];
+        bool present = slot->in_use && slot->seq == s;
+        if (present && !slot->consumed && slot->stream == stream_id) {
+            if (slot->stream_seq != stream->rcv_next) {
+                return NULL; // Its predecessor is in one of the holes below
+            }
+            *seq = s;
+            return slot;
+        }
+        if (!present) {
+            hole = true;
+        } else if (!hole) {
+            stream->rcv_scan = s + 1; // Nothing of this stream up to here, no need to look again
+        }
+    }
+    return NULL;
+}
+
+/*
+* @brief Whether a read of the stream would finish without waiting: its whole next chunk is queued,
+* or at least room bytes of it are.
+*/
+bool rudp_stream_ready(RUDP_Socket *sockfd, int stream_id, size_t room) {
+    unsigned int s;
+    if (rudp_stream_next(sockfd, stream_id, &s) == NULL) {
+        return false;
+    }
+    unsigned int expected = sockfd->streams[stream_id].rcv_next;
+    size_t bytes = 0;
+    for (; SEQ_LT(s, sockfd->rcv_nxt); s++) {
+        RUDP_Segment *slot = &sockfd->rcv_queue[s % RUDP_RCV_SEGS];
+        if (!slot->in_use || slot->seq != s || slot->stream != stream_id || slot->consumed) {
+            continue;
+        }
+        if (slot->stream_seq != expected) {
+            return false; // The next one of this stream is still missing
+        }
+        bytes += rudp_segment_bytes(slot);
+        if (bytes > room || (slot->flags & EOC_FLAG)) {
+            return true;
+        }
+        expected++;
+    }
+    return false;
+}
+
+/*
+* @brief Receive one chunk from a stream into buffer, or from whichever stream has data first.
+* A lost segment only holds up its own stream.
+* @param stream_id In: the stream to read, or RUDP_ANY_STREAM. Out: the stream the data came from.
+* @return The number of bytes received, 0 if the peer closed the connection, -1 on error.
+*/
+int rudp_stream_recv(RUDP_Socket *sockfd, int *stream_id, char *buffer, size_t buffer_size) {
+    if (sockfd == NULL || stream_id == NULL || *stream_id < RUDP_ANY_STREAM || *stream_id >= RUDP_MAX_STREAMS) {
+        return -1;
+    }
+    int stream = *stream_id;
+    size_t bytes_received = 0;
+    bool chunk_done = false;
+    bool buffer_full = false;
+    while (true) {
+        if (bytes_received == 0 && rudp_shm_using(sockfd, false)) {
+            return rudp_shm_stream_recv(sockfd, stream_id, buffer, buffer_size); // The peer moved to the rings
+        }
+
+        // Move datagrams waiting in the kernel into the reassembly queue first, so a slow reader
+        // closes the advertised window instead of overflowing the socket buffer
+        int polled = 1;
+        for (int i = 0; i < RUDP_RCV_SEGS && polled > 0; i++) {
+            polled = rudp_poll(sockfd, rudp_now_us());
+        }
+        if (polled < 0) {
+            return -1;
+        }
+
+        unsigned int seq;
+        if (stream == RUDP_ANY_STREAM) {
+            // Only commit to a stream whose chunk is complete. Waiting on a partial one could let the other
+            // streams fill the shared window and lock out the segments it still needs.
+            for (int i = 0; i < RUDP_MAX_STREAMS && stream == RUDP_ANY_STREAM; i++) {
+                if (rudp_stream_ready(sockfd, i, buffer_size)) {
+                    stream = i;
+                }
+            }
+            // A window full of partial chunks can only drain from the front
+            RUDP_Segment *front = &sockfd->rcv_queue[sockfd->rcv_read % RUDP_RCV_SEGS];
+            if (stream == RUDP_ANY_STREAM && rudp_rcv_window(sockfd) == 0 && front->in_use && front->seq == sockfd->rcv_read) {
+                stream = front->stream;
+            }
+        }
+        if (stream != RUDP_ANY_STREAM) {
+            // Hand over the stream's segments in order until the end of the chunk
+            RUDP_Segment *seg;
+            while ((seg = rudp_stream_next(sockfd, stream, &seq)) != NULL) {
+                int bytes = rudp_segment_bytes(seg);
+                if (bytes_received + bytes > buffer_size) {
+                    if (bytes_received == 0) {
+                        printf("Receive buffer too small for a segment\n");
+                        return -1;
+                    }
+                    buffer_full = true; // The rest of the chunk stays queued for the next call
+                    break;
+                }
+                if (!(seg->flags & LZ_FLAG)) {
+                    memcpy(buffer + bytes_received, seg->data, seg->length);
+                } else if (seg->length < RUDP_LZ_HEADER ||
+                           rudp_lz_decompress((unsigned char *)seg->data + RUDP_LZ_HEADER, seg->length - RUDP_LZ_HEADER,
+                                              (unsigned char *)buffer + bytes_received, bytes) < 0) {
+                    printf("Malformed compressed segment\n");
+                    return -1;
+                }
+                bytes_received += bytes;
+                seg->consumed = true;
+                sockfd->streams[stream].rcv_next++;
+                sockfd->streams[stream].rcv_scan = seq + 1;
+                if (seg->flags & EOC_FLAG) {
+                    chunk_done = true;
+                    break;
+                }
+            }
+
+            // Free the slots at the front once every stream is done with them
+            while (SEQ_LT(sockfd->rcv_read, sockfd->rcv_nxt) && sockfd->rcv_queue[sockfd->rcv_read % RUDP_RCV_SEGS].consumed) {
+                RUDP_Segment *slot = &sockfd->rcv_queue[sockfd->rcv_read % RUDP_RCV_SEGS];
+                slot->in_use = false;
+                slot->consumed = false;
+                sockfd->rcv_read++;
+            }
+        }
+        if (rudp_window_update(sockfd) < 0) {
+            return -1;
+        }
+        if (chunk_done || buffer_full) {
+            *stream_id = stream;
+            return (int)bytes_received;
+        }
+
+        if (sockfd->peer_fin) {
+            *stream_id = stream;
+            return (int)bytes_received; // Connection closed by peer
+        }
+        if (rudp_poll(sockfd, 0) < 0) {
+            return -1; // Error in receiving data
+        }
+    }
+}
+
+/*
+* @brief Send a buffer as a chunk of MTU-sized segments and wait until the receiver acknowledged all of them.
+* @return The number of bytes sent, -1 on error.
+*/
+int rudp_send_file_1(RUDP_Socket *sockfd, void *buffer, size_t buffer_size,char *receiver_ip, unsigned short receiver_port) {
+    memset(&(sockfd->dest_addr), 0, sizeof(struct sockaddr_in));
+    sockfd->dest_addr.sin_family = AF_INET;
+    sockfd->dest_addr.sin_addr.s_addr = inet_addr(receiver_ip);
+    sockfd->dest_addr.sin_port = htons(receiver_port);
+
+    if (rudp_stream_send(sockfd, 0, buffer, buffer_size) < 0 || rudp_flush(sockfd) < 0) {
+        return -1;
+    }
+    return (int)buffer_size; // Return number of bytes sent
+}
+
+/*
+* @brief Receive one chunk sent with rudp_send_file_1() into buffer.
+* @return The number of bytes received, 0 if the peer closed the connection, -1 on error.
+*/
+int rudp_rcv_file_1(RUDP_Socket *sockfd, char *buffer, size_t buffer_size,struct sockaddr_in *sndr_addr,
+        socklen_t sndr_len) {
+    if (sndr_addr != NULL && sndr_len >= sizeof(struct sockaddr_in)) {
+        sockfd->dest_addr = *sndr_addr; // ACKs go back to the sender
+    }
+    int stream = 0;
+    return rudp_stream_recv(sockfd, &stream, buffer, buffer_size);
+}
+
+int rudp_set_fec(RUDP_Socket *sockfd, unsigned int k, unsigned int m) {
+    if (sockfd == NULL || sockfd->isConnected || k > RUDP_FEC_MAX_K || m > RUDP_FEC_MAX_M) {
+        return -1; // FEC is settled in the handshake
+    }
+    if (k == 0 || m == 0) {
+        k = 0;
+        m = 0;
+    }
+    sockfd->fec_k = k;
+    sockfd->fec_m = m;
+    return 1;
+}
+
+// Settle on the smaller of both sides' FEC parameters and set up the coder
+void rudp_fec_negotiate(RUDP_Socket *sockfd, unsigned int peer_k, unsigned int peer_m) {
+    unsigned int k = peer_k < sockfd->fec_k ? peer_k : sockfd->fec_k;
+    unsigned int m = peer_m < sockfd->fec_m ? peer_m : sockfd->fec_m;
+    if (k == 0 || m == 0) {
+        sockfd->fec_k = 0;
+        sockfd->fec_m = 0;
+        return;
+    }
+    sockfd->fec_k = k;
+    sockfd->fec_m = m;
+    if (sockfd->fec == NULL) {
+        sockfd->fec = (RUDP_FEC_State *)calloc(1, sizeof(RUDP_FEC_State));
+        if (sockfd->fec == NULL) {
+            perror("Failed to allocate FEC state, continuing without FEC");
+            sockfd->fec_k = 0;
+            sockfd->fec_m = 0;
+            return;
+        }
+        rudp_gf_init();
+    }
+    sockfd->fec->peer_m = (int)m; // Start fully protected until loss has been measured
+}
+
+// Parity per group the receiver asks for, from the loss it measured; the full negotiated amount until it has a sample
+int rudp_fec_recommend(RUDP_Socket *sockfd) {
+    if (sockfd->fec == NULL) {
+        return 0;
+    }
+    if (sockfd->fec->rcv_samples == 0) {
+        return (int)sockfd->fec_m;
+    }
+    int m = (int)ceil(2 * sockfd->fec->rcv_loss * sockfd->fec_k - 0.01);
+    if (m < 0) {
+        m = 0;
+    }
+    return m > (int)sockfd->fec_m ? (int)sockfd->fec_m : m;
+}
+
+// Fold a data segment on its first transmission into the open parity group, and send the parity once the group closes
+// A symbol starts with what the receiver needs to rebuild the segment around its payload
+void rudp_fec_prefix(const RUDP_Segment *seg, unsigned char *prefix) {
+    prefix[0] = (unsigned char)(seg->length & 0xff);
+    prefix[1] = (unsigned char)(seg->length >> 8);
+    prefix[2] = (unsigned char)seg->flags;
+    prefix[3] = seg->stream;
+    for (int i = 0; i < 4; i++) {
+        prefix[4 + i] = (unsigned char)(seg->stream_seq >> (8 * i));
+    }
+}
+
+int rudp_fec_encode(RUDP_Socket *sockfd, RUDP_Segment *seg) {
+    RUDP_FEC_State *fec = sockfd->fec;
+    if (fec->enc_count == 0) {
+        // Parity for the new group: whatever the receiver asks for, or more if we keep retransmitting
+        int m = (int)ceil(2 * fec->snd_loss * sockfd->fec_k - 0.01);
+        if (fec->peer_m > m) {
+            m = fec->peer_m;
+        }
+        fec->enc_m = m > (int)sockfd->fec_m ? (int)sockfd->fec_m : m;
+        fec->enc_base = seg->seq;
+        fec->enc_len = 0;
+        for (int j = 0; j < fec->enc_m; j++) {
+            memset(fec->enc_parity[j], 0, RUDP_FEC_SYMBOL);
+        }
+    }
+
+    unsigned char prefix[RUDP_FEC_PREFIX];
+    rudp_fec_prefix(seg, prefix);
+    for (int j = 0; j < fec->enc_m; j++) {
+        unsigned char coef = rudp_fec_coef(j, fec->enc_count);
+        rudp_gf_mul_add(fec->enc_parity[j], prefix, coef, RUDP_FEC_PREFIX);
+        rudp_gf_mul_add(fec->enc_parity[j] + RUDP_FEC_PREFIX, (unsigned char *)seg->data, coef, seg->length);
+    }
+    if (seg->length > fec->enc_len) {
+        fec->enc_len = seg->length;
+    }
+    fec->enc_count++;
+    seg->fec_close_us = fec->enc_m > 0 ? LLONG_MAX : 0;
+
+    // Close the group when it is full, or at the end of a chunk so the tail is protected too
+    if (fec->enc_count < (int)sockfd->fec_k && !(seg->flags & EOC_FLAG)) {
+        return 1;
+    }
+    for (int j = 0; j < fec->enc_m; j++) {
+        RUDP_Header header;
+        memset(&header, 0, sizeof(header));
+        header.flags = FEC_FLAG;
+        header.seq = fec->enc_base;
+        header.length = RUDP_FEC_PREFIX + fec->enc_len;
+        header.fec_k = (unsigned char)fec->enc_count;
+        header.fec_m = (unsigned char)fec->enc_m;
+        header.fec_index = (unsigned char)j;
+        header.checksum = calculate_checksum(fec->enc_parity[j], header.length);
+        if (rudp_send_packet(sockfd, seg->path, &header, fec->enc_parity[j], header.length) < 0) {
+            perror("Error sending parity segment");
+            return -1;
+        }
+        sockfd->stats.fec_parity_sent++;
+    }
+
+    // Anything sent from now on reaches the receiver behind the parity
+    long long now = rudp_now_us();
+    for (unsigned int seq = fec->enc_base; seq != fec->enc_base + fec->enc_count; seq++) {
+        if (SEQ_LT(seq, sockfd->snd_una)) {
+            continue; // Already acknowledged, its pool segment may be reused
+        }
+        RUDP_Segment *member = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        if (member->fec_close_us != 0) {
+            member->fec_close_us = now;
+        }
+    }
+    fec->enc_count = 0;
+    return 1;
+}
+
+// True if the receiver still holds segment seq, queued or already handed to the application
+bool rudp_rcv_has(RUDP_Socket *sockfd, unsigned int seq) {
+    RUDP_Segment *slot = &sockfd->rcv_queue[seq % RUDP_RCV_SEGS];
+    return slot->seq == seq && (slot->in_use || SEQ_LT(seq, sockfd->rcv_read));
+}
+
+// Keep a parity segment and rebuild whatever its group is missing once there is enough parity
+void rudp_fec_process_parity(RUDP_Socket *sockfd, RUDP_Header *header, char *payload, int payload_size) {
+    RUDP_FEC_State *fec = sockfd->fec;
+    if (fec == NULL) {
+        return;
+    }
+    if (header->length != payload_size || payload_size < RUDP_FEC_PREFIX || payload_size > RUDP_FEC_SYMBOL ||
+        header->fec_k == 0 || header->fec_k > RUDP_FEC_MAX_K || header->fec_index >= RUDP_FEC_MAX_M ||
+        header->checksum != calculate_checksum(payload, payload_size)) {
+        sockfd->stats.checksum_errors++;
+        return;
+    }
+    unsigned int base = header->seq;
+
+    // Parity is sent right behind its group, so whatever is still missing when the first of it arrives was lost
+    if (fec->rcv_samples == 0 || base != fec->rcv_sampled_base) {
+        int missing = 0;
+        for (int i = 0; i < header->fec_k; i++) {
+            if (!SEQ_LT(base + i, sockfd->rcv_nxt) && !rudp_rcv_has(sockfd, base + i)) {
+                missing++;
+            }
+        }
+        fec->rcv_loss += ((double)missing / header->fec_k - fec->rcv_loss) / 16;
+        fec->rcv_samples++;
+        fec->rcv_sampled_base = base;
+    }
+    if (SEQ_LEQ(base + header->fec_k, sockfd->rcv_nxt)) {
+        return; // The whole group already arrived
+    }
+
+    RUDP_FEC_Group *group = NULL;
+    for (int i = 0; i < RUDP_FEC_GROUPS && group == NULL; i++) {
+        if (fec->groups[i].in_use && fec->groups[i].base == base) {
+            group = &fec->groups[i];
+        }
+    }
+    if (group == NULL) {
+        // Take an empty or finished slot, or else evict the oldest group
+        for (int i = 0; i < RUDP_FEC_GROUPS; i++) {
+            RUDP_FEC_Group *g = &fec->groups[i];
+            if (!g->in_use || SEQ_LEQ(g->base + g->k, sockfd->rcv_nxt)) {
+                group = g;
+                break;
+            }
+            if (group == NULL || SEQ_LT(g->base, group->base)) {
+                group = g;
+            }
+        }
+        group->in_use = true;
+        group->base = base;
+        group->k = header->fec_k;
+        group->symbol_size = payload_size;
+        group->parity_count = 0;
+    }
+    if (group->symbol_size != payload_size || group->k != header->fec_k || group->parity_count == RUDP_FEC_MAX_M) {
+        return;
+    }
+    for (int j = 0; j < group->parity_count; j++) {
+        if (group->parity_index[j] == header->fec_index) {
+            return; // Duplicate parity
+        }
+    }
+    memcpy(group->parity[group->parity_count], payload, payload_size);
+    group->parity_index[group->parity_count] = header->fec_index;
+    group->parity_count++;
+    rudp_fec_try_decode(sockfd, group);
+}
+
+/*
+* @brief Rebuild a group's missing data segments if enough parity arrived, and retire the group once it is complete.
+* @return Number of segments rebuilt.
+*/
+int rudp_fec_try_decode(RUDP_Socket *sockfd, RUDP_FEC_Group *group) {
+    RUDP_FEC_State *fec = sockfd->fec;
+    bool present[RUDP_FEC_MAX_K];
+    unsigned char *symbols[RUDP_FEC_MAX_K];
+    int missing = 0;
+    for (int i = 0; i < group->k; i++) {
+        unsigned int seq = group->base + i;
+        present[i] = rudp_rcv_has(sockfd, seq);
+        if (!present[i]) {
+            if (SEQ_LT(seq, sockfd->rcv_nxt)) {
+                group->in_use = false; // Delivered and already overwritten, nothing left to rebuild from
+                return 0;
+            }
+            missing++;
+        }
+    }
+    if (missing == 0) {
+        group->in_use = false;
+        return 0;
+    }
+    if (missing > group->parity_count) {
+        return 0; // Wait for more parity or a retransmission
+    }
+
+    // Lay the present segments out as zero padded symbols
+    for (int i = 0; i < group->k; i++) {
+        symbols[i] = fec->scratch[i];
+        if (present[i]) {
+            RUDP_Segment *slot = &sockfd->rcv_queue[(group->base + i) % RUDP_RCV_SEGS];
+            rudp_fec_prefix(slot, symbols[i]);
+            memcpy(symbols[i] + RUDP_FEC_PREFIX, slot->data, slot->length);
+            memset(symbols[i] + RUDP_FEC_PREFIX + slot->length, 0, group->symbol_size - RUDP_FEC_PREFIX - slot->length);
+        }
+    }
+    unsigned char *parity[RUDP_FEC_MAX_M];
+    for (int j = 0; j < group->parity_count; j++) {
+        parity[j] = group->parity[j];
+    }
+    group->in_use = false;
+    if (rudp_fec_decode(group->k, group->symbol_size, symbols, present, parity, group->parity_index, group->parity_count) < 0) {
+        return 0;
+    }
+
+    int recovered = 0;
+    for (int i = 0; i < group->k; i++) {
+        if (present[i]) {
+            continue;
+        }
+        int length = symbols[i][0] | (symbols[i][1] << 8);
+        int flags = symbols[i][2];
+        int stream = symbols[i][3];
+        unsigned int stream_seq = 0;
+        for (int b = 0; b < 4; b++) {
+            stream_seq |= (unsigned int)symbols[i][4 + b] << (8 * b);
+        }
+        if (length > RUDP_MSS || length > group->symbol_size - RUDP_FEC_PREFIX || !(flags & DATA_FLAG) ||
+            stream >= RUDP_MAX_STREAMS) {
+            continue; // Garbage, leave it to retransmission
+        }
+        rudp_accept_segment(sockfd, group->base + i, flags, stream, stream_seq, (char *)symbols[i] + RUDP_FEC_PREFIX, length);
+        sockfd->stats.fec_recovered++;
+        recovered++;
+    }
+    return recovered;
+}
+
+/*
+* @brief Ask for LZ compression of the data we send, or refuse it as a server. Settled in the handshake,
+* the reads on the other end then need room for RUDP_LZ_MAX_RAW bytes.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_compression(RUDP_Socket *sockfd, bool enable) {
+    if (sockfd == NULL || sockfd->isConnected) {
+        return -1; // Compression is settled in the handshake
+    }
+    sockfd->compress = enable;
+    return 1;
+}
+
+/*
+* @brief Turn the per-segment payload checksum off, leaving integrity to the UDP checksum, or as a server insist on it.
+* Settled in the handshake: off only if the client asks and the server accepts.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_checksum(RUDP_Socket *sockfd, bool enable) {
+    if (sockfd == NULL || sockfd->isConnected) {
+        return -1; // The checksum is settled in the handshake
+    }
+    sockfd->no_checksum = !enable;
+    return 1;
+}
+
+// Both ends agreed: from here on segments go out without a checksum and are taken without one
+void rudp_checksum_negotiate(RUDP_Socket *sockfd, bool peer_no_checksum) {
+    sockfd->no_checksum = sockfd->no_checksum && peer_no_checksum;
+    if (sockfd->no_checksum) {
+        sockfd->payload_checksum = rudp_checksum_none;
+        sockfd->payload_intact = rudp_checksum_trusted;
+    }
+}
+
+bool rudp_checksum_intact(RUDP_Socket *sockfd, const RUDP_Header *header, void *data, int bytes) {
+    (void)sockfd;
+    return header->checksum == calculate_checksum(data, bytes);
+}
+
+unsigned short int rudp_checksum_none(void *data, unsigned int bytes) {
+    (void)data;
+    (void)bytes;
+    return 0;
+}
+
+// Segments sent before the peer learned the outcome still carry a checksum, it is not looked at either
+bool rudp_checksum_trusted(RUDP_Socket *sockfd, const RUDP_Header *header, void *data, int bytes) {
+    (void)header;
+    (void)data;
+    (void)bytes;
+    sockfd->stats.segments_unchecked++;
+    return true;
+}
+
+/*
+* @brief Choose the window a connection starts with, and whether it then follows the network (Reno) or stays put,
+* for links the application knows it has to itself.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_congestion(RUDP_Socket *sockfd, unsigned int initial_cwnd, bool fixed) {
+    RUDP_Congestion congestion;
+    congestion.grow = fixed ? rudp_fixed_grow : rudp_reno_grow;
+    congestion.reduce = fixed ? rudp_fixed_reduce : rudp_reno_reduce;
+    return rudp_set_congestion_control(sockfd, initial_cwnd, &congestion);
+}
+
+/*
+* @brief Start the connection at initial_cwnd and let congestion drive its window and its subflows' windows from
+* then on. For congestion control other than the built-in Reno and fixed window, e.g. a rudp::Connection's policy.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_congestion_control(RUDP_Socket *sockfd, unsigned int initial_cwnd, const RUDP_Congestion *congestion) {
+    if (sockfd == NULL || sockfd->isConnected || initial_cwnd == 0 || initial_cwnd > RUDP_WINDOW ||
+        congestion == NULL || congestion->grow == NULL || congestion->reduce == NULL) {
+        return -1;
+    }
+    sockfd->cwnd = initial_cwnd;
+    sockfd->cwnd_init = initial_cwnd;
+    sockfd->congestion = *congestion;
+    return 1;
+}
+
+// Reno: slow start below ssthresh, then one segment per window of ACKs. A loss halves the window, a timeout
+// starts over from one segment.
+void rudp_reno_grow(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked) {
+    if (*cwnd < ssthresh) {
+        *cwnd += acked; // Slow start
+        return;
+    }
+    *cwnd_acked += acked; // Congestion avoidance
+    if (*cwnd_acked >= *cwnd) {
+        *cwnd_acked -= *cwnd;
+        (*cwnd)++;
+    }
+}
+
+void rudp_reno_reduce(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout) {
+    *ssthresh = flight / 2 > 2 ? flight / 2 : 2;
+    *cwnd = timeout ? 1 : *ssthresh;
+}
+
+// Fixed window: chosen, not probed for, so neither ACKs nor losses move it
+void rudp_fixed_grow(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked) {
+    (void)cwnd;
+    (void)cwnd_acked;
+    (void)ssthresh;
+    (void)acked;
+}
+
+void rudp_fixed_reduce(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout) {
+    (void)cwnd;
+    (void)ssthresh;
+    (void)flight;
+    (void)timeout;
+}
+
+// Compress only if both sides asked for it or accept it. Segments say whether they are compressed,
+// so data queued before this point simply goes out as it is.
+void rudp_lz_negotiate(RUDP_Socket *sockfd, bool peer_compress) {
+    sockfd->compress = sockfd->compress && peer_compress;
+    sockfd->compress_settled = true;
+}
+
+// Bytes a received segment hands to the application
+int rudp_segment_bytes(const RUDP_Segment *seg) {
+    if (!(seg->flags & LZ_FLAG)) {
+        return seg->length;
+    }
+    return (unsigned char)seg->data[0] | (unsigned char)seg->data[1] << 8;
+}
+
+// Gather a chunk given in several buffers, compression works on contiguous input
+int rudp_lz_gather(RUDP_Socket *sockfd, const struct iovec *iov, int iovcnt, size_t total) {
+    if (sockfd->lz == NULL && (sockfd->lz = (RUDP_LZ_State *)calloc(1, sizeof(RUDP_LZ_State))) == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    RUDP_LZ_State *lz = sockfd->lz;
+    if (lz->flat_size < total) {
+        unsigned char *flat = (unsigned char *)realloc(lz->flat, total);
+        if (flat == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        lz->flat = flat;
+        lz->flat_size = total;
+    }
+    size_t offset = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(lz->flat + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return 1;
+}
+
+/*
+* @brief Worker job: cut a slice into segment payloads. A segment becomes an LZ block when that carries
+* more of the slice than a raw MSS would, otherwise it is stored. After a block fails to shrink the next
+* few segments are stored without trying, more of them each time, so incompressible data costs little.
+*/
+void rudp_lz_job(void *arg) {
+    RUDP_LZ_Job *job = (RUDP_LZ_Job *)arg;
+    int offset = 0;
+    int skip = 0;
+    int backoff = 1;
+    job->count = 0;
+    job->raw_bytes = 0;
+    job->wire_bytes = 0;
+    while (offset < job->src_size) {
+        int remaining = job->src_size - offset;
+        int stored = remaining < RUDP_MSS ? remaining : RUDP_MSS;
+        unsigned char *out = job->data[job->count];
+        if (skip > 0) {
+            skip--;
+        } else {
+            int input = remaining < RUDP_LZ_MAX_RAW ? remaining : RUDP_LZ_MAX_RAW;
+            int consumed;
+            int size = rudp_lz_compress(job->src + offset, input, out + RUDP_LZ_HEADER, RUDP_MSS - RUDP_LZ_HEADER, &consumed);
+            if (consumed > stored || (consumed == stored && size + RUDP_LZ_HEADER < stored)) {
+                out[0] = (unsigned char)(consumed & 0xff);
+                out[1] = (unsigned char)(consumed >> 8);
+                job->length[job->count] = size + RUDP_LZ_HEADER;
+                job->compressed[job->count++] = true;
+                job->raw_bytes += consumed;
+                job->wire_bytes += size + RUDP_LZ_HEADER;
+                offset += consumed;
+                backoff = 1;
+                continue;
+            }
+            skip = backoff;
+            backoff = backoff * 2 > RUDP_LZ_BACKOFF ? RUDP_LZ_BACKOFF : backoff * 2;
+        }
+        memcpy(out, job->src + offset, stored);
+        job->length[job->count] = stored;
+        job->compressed[job->count++] = false;
+        offset += stored;
+    }
+}
+
+/*
+* @brief Queue a chunk as compressed segments. Up to RUDP_LZ_JOBS slices are compressed side by side,
+* then their segments are queued in order, waiting for acknowledgments only when the send pool is full.
+* @return 1 on success, -1 on error.
+*/
+int rudp_lz_queue_chunk(RUDP_Socket *sockfd, int stream_id, const unsigned char *data, size_t size) {
+    if (sockfd->lz == NULL && (sockfd->lz = (RUDP_LZ_State *)calloc(1, sizeof(RUDP_LZ_State))) == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    RUDP_LZ_State *lz = sockfd->lz;
+    size_t offset = 0;
+    while (offset < size) {
+        int count = 0;
+        for (; count < RUDP_LZ_JOBS && offset < size; count++) {
+            RUDP_LZ_Job *job = &lz->jobs[count];
+            job->src = data + offset;
+            job->src_size = size - offset < RUDP_LZ_SLICE ? (int)(size - offset) : RUDP_LZ_SLICE;
+            offset += job->src_size;
+        }
+        rudp_parallel(rudp_lz_job, lz->jobs, sizeof(RUDP_LZ_Job), count);
+
+        for (int j = 0; j < count; j++) {
+            RUDP_LZ_Job *job = &lz->jobs[j];
+            sockfd->stats.lz_raw_bytes += job->raw_bytes;
+            sockfd->stats.lz_wire_bytes += job->wire_bytes;
+            for (int i = 0; i < job->count; i++) {
+                while (sockfd->snd_free == NULL) {
+                    if (rudp_pump(sockfd) < 0 || rudp_poll(sockfd, 0) < 0) {
+                        return -1;
+                    }
+                }
+                RUDP_Segment *seg = sockfd->snd_free;
+                sockfd->snd_free = seg->next;
+                memcpy(seg->data, job->data[i], job->length[i]);
+                bool last = offset == size && j == count - 1 && i == job->count - 1;
+                rudp_stream_append(sockfd, stream_id, seg, job->length[i], last);
+                if (job->compressed[i]) {
+                    seg->flags |= LZ_FLAG;
+                }
+            }
+        }
+        if (rudp_pump(sockfd) < 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+* @brief Use shared-memory rings with a peer on this host, or stay on UDP. On by default on both ends,
+* settled in the handshake.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_shared_memory(RUDP_Socket *sockfd, bool enable) {
+    if (sockfd == NULL || sockfd->isConnected) {
+        return -1; // The path is settled in the handshake
+    }
+    sockfd->shm_enabled = enable;
+    return 1;
+}
+
+// Whether an address belongs to this host: loopback or one of our interfaces
+bool rudp_shm_local(const struct sockaddr_in *addr) {
+    if ((ntohl(addr->sin_addr.s_addr) >> 24) == 127) {
+        return true;
+    }
+    struct ifaddrs *interfaces;
+    if (getifaddrs(&interfaces) < 0) {
+        return false;
+    }
+    bool local = false;
+    for (struct ifaddrs *ifa = interfaces; ifa != NULL && !local; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
+            local = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr == addr->sin_addr.s_addr;
+        }
+    }
+    freeifaddrs(interfaces);
+    return local;
+}
+
+// Client: create rings for a server on this host, the SYN and the handshake ACK carry the offer
+void rudp_shm_offer(RUDP_Socket *sockfd) {
+    if (!sockfd->shm_enabled || sockfd->shm != NULL || !rudp_shm_local(&sockfd->dest_addr)) {
+        return;
+    }
+    sockfd->shm = rudp_shm_create(&sockfd->shm_fd);
+    sockfd->shm_side = RUDP_SHM_CLIENT;
+    sockfd->shm_seen = 0;
+}
+
+// Client, handshake done: move to the rings once the server mapped them. A server that lost our ACK or could
+// not open them leaves us on UDP after RUDP_SHM_ATTACH_MS.
+void rudp_shm_settle(RUDP_Socket *sockfd) {
+    long long give_up_us = rudp_now_us() + RUDP_SHM_ATTACH_MS * 1000LL;
+    while (sockfd->shm != NULL) {
+        unsigned int seen = rudp_shm_bell(sockfd->shm, sockfd->shm_side);
+        if (rudp_shm_using(sockfd, true)) {
+            return;
+        }
+        long long now = rudp_now_us();
+        if (now >= give_up_us) {
+            rudp_shm_decline(sockfd);
+        } else {
+            rudp_shm_wait(sockfd->shm, sockfd->shm_side, seen, give_up_us - now);
+        }
+    }
+}
+
+// Server, connection committed: map the rings the client offered, if it runs on this host
+void rudp_shm_take(RUDP_Socket *sockfd, const RUDP_Handshake *options, const struct sockaddr_in *peer) {
+    if (!sockfd->shm_enabled || sockfd->shm != NULL || options->shm_pid == 0 || !rudp_shm_local(peer)) {
+        return;
+    }
+    int fd;
+    RUDP_Shm_Region *region = rudp_shm_attach(options->shm_pid, options->shm_fd, options->shm_token, &fd);
+    if (region == NULL) {
+        return; // The client stops waiting for us and stays on UDP
+    }
+    if (!rudp_shm_transition(region, RUDP_SHM_OFFERED, RUDP_SHM_ATTACHED)) {
+        rudp_shm_release(region, fd); // The client already went ahead on UDP
+        return;
+    }
+    sockfd->shm = region;
+    sockfd->shm_fd = fd;
+    sockfd->shm_side = RUDP_SHM_SERVER;
+    sockfd->shm_seen = rudp_shm_bell(region, RUDP_SHM_SERVER);
+    rudp_shm_ring_bell(region, RUDP_SHM_CLIENT);
+}
+
+// Client: withdraw an offer the server has not taken and stay on UDP
+void rudp_shm_decline(RUDP_Socket *sockfd) {
+    if (!rudp_shm_transition(sockfd->shm, RUDP_SHM_OFFERED, RUDP_SHM_DECLINED)) {
+        return; // Taken in the meantime
+    }
+    rudp_shm_release(sockfd->shm, sockfd->shm_fd);
+    sockfd->shm = NULL;
+    sockfd->shm_fd = -1;
+}
+
+/*
+* @brief Whether data goes through the rings. The first side to move data after both mapped them decides,
+* a sender by claiming them; a side that finds them declined unmaps them.
+*/
+bool rudp_shm_using(RUDP_Socket *sockfd, bool sending) {
+    if (sockfd->shm == NULL || sockfd->shm_active) {
+        return sockfd->shm_active;
+    }
+    if (sending && rudp_shm_transition(sockfd->shm, RUDP_SHM_ATTACHED, RUDP_SHM_ACTIVE)) {
+        rudp_shm_ring_bell(sockfd->shm, 1 - sockfd->shm_side);
+    }
+    unsigned int state = rudp_shm_state(sockfd->shm);
+    if (state == RUDP_SHM_ACTIVE) {
+        sockfd->shm_active = true;
+        printf("using shared memory with the peer\n");
+    } else if (state == RUDP_SHM_DECLINED) {
+        rudp_shm_release(sockfd->shm, sockfd->shm_fd);
+        sockfd->shm = NULL;
+        sockfd->shm_fd = -1;
+    }
+    return sockfd->shm_active;
+}
+
+bool rudp_shm_peer_closed(RUDP_Socket *sockfd) {
+    return sockfd->shm_peer_gone || rudp_shm_closed(sockfd->shm, 1 - sockfd->shm_side);
+}
+
+/*
+* @brief rudp_poll()'s wait while rings are mapped: sleep on our doorbell until the peer rings it or wake_us.
+* Long sleeps are cut into RUDP_SHM_CHECK_MS pieces to notice a peer process that exited without closing.
+* @return 1 if the doorbell rang or the peer turned out to be gone, 0 on timeout.
+*/
+int rudp_shm_sleep(RUDP_Socket *sockfd, long long wake_us) {
+    while (true) {
+        long long wait_us = RUDP_SHM_CHECK_MS * 1000LL;
+        if (wake_us != 0 && wake_us - rudp_now_us() < wait_us) {
+            wait_us = wake_us - rudp_now_us();
+        }
+        unsigned int bell = rudp_shm_wait(sockfd->shm, sockfd->shm_side, sockfd->shm_seen, wait_us > 0 ? wait_us : 0);
+        if (bell != sockfd->shm_seen) {
+            sockfd->shm_seen = bell;
+            return 1;
+        }
+        if (wake_us != 0 && rudp_now_us() >= wake_us) {
+            return 0;
+        }
+        unsigned int pid = sockfd->shm->pid[1 - sockfd->shm_side];
+        if (pid != 0 && kill((pid_t)pid, 0) < 0 && errno == ESRCH) {
+            printf("Peer process is gone\n");
+            sockfd->shm_peer_gone = true;
+            return 1;
+        }
+    }
+}
+
+/*
+* @brief Write a chunk into the stream's ring as records, each as large as the free space allows, the last
+* marked EOC. A chunk in the ring is as good as acknowledged, the memory is the peer's as much as ours.
+* @return 1 on success, -1 on error.
+*/
+int rudp_shm_queue_chunk(RUDP_Socket *sockfd, int stream_id, const struct iovec *iov, size_t total) {
+    RUDP_Shm_Region *region = sockfd->shm;
+    int side = sockfd->shm_side;
+    unsigned long long head = rudp_shm_head(region, side, stream_id);
+    int part = 0;
+    size_t part_offset = 0;
+    size_t queued = 0;
+    while (queued < total) {
+        size_t space = RUDP_SHM_RING - (size_t)(head - rudp_shm_tail(region, side, stream_id));
+        if (space <= sizeof(RUDP_Shm_Record)) {
+            // Full, the reader frees room and rings us
+            if (rudp_shm_peer_closed(sockfd)) {
+                printf("Peer closed the connection\n");
+                return -1;
+            }
+            if (rudp_poll(sockfd, 0) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        RUDP_Shm_Record record;
+        size_t length = total - queued < space - sizeof(record) ? total - queued : space - sizeof(record);
+        record.length = (unsigned int)length;
+        record.flags = queued + length == total ? EOC_FLAG : 0;
+        rudp_shm_store(region, side, stream_id, head, &record, sizeof(record));
+        unsigned long long pos = head + sizeof(record);
+        size_t filled = 0;
+        while (filled < length) {
+            size_t take = iov[part].iov_len - part_offset;
+            if (take > length - filled) {
+                take = length - filled;
+            }
+            rudp_shm_store(region, side, stream_id, pos + filled, (const char *)iov[part].iov_base + part_offset, take);
+            filled += take;
+            part_offset += take;
+            if (part_offset == iov[part].iov_len) {
+                part++;
+                part_offset = 0;
+            }
+        }
+        head = pos + length;
+        queued += length;
+        rudp_shm_set_head(region, side, stream_id, head);
+        rudp_shm_ring_bell(region, 1 - side);
+    }
+
+    RUDP_Stream *stream = &sockfd->streams[stream_id];
+    stream->snd_next++;
+    stream->snd_acked = stream->snd_next;
+    sockfd->stats.shm_bytes_sent += total;
+    return 1;
+}
+
+// rudp_stream_ready() on the rings: the stream's next chunk is complete, room bytes of it are there, or its writer waits for us
+bool rudp_shm_ready(RUDP_Socket *sockfd, int stream_id, size_t room) {
+    RUDP_Shm_Region *region = sockfd->shm;
+    int peer = 1 - sockfd->shm_side;
+    unsigned long long tail = rudp_shm_tail(region, peer, stream_id);
+    unsigned long long head = rudp_shm_head(region, peer, stream_id);
+    size_t bytes = sockfd->shm_left[stream_id];
+    if (bytes > 0 && (bytes > room || (sockfd->shm_flags[stream_id] & EOC_FLAG))) {
+        return true;
+    }
+    for (unsigned long long pos = tail + bytes; pos < head; ) {
+        RUDP_Shm_Record record;
+        rudp_shm_load(region, peer, stream_id, pos, &record, sizeof(record));
+        bytes += record.length;
+        if (bytes > room || (record.flags & EOC_FLAG)) {
+            return true;
+        }
+        pos += sizeof(record) + record.length;
+    }
+    return RUDP_SHM_RING - (size_t)(head - tail) <= sizeof(RUDP_Shm_Record);
+}
+
+/*
+* @brief Copy what the stream's ring holds into buffer, up to the end of the chunk, and give the room back.
+* @param chunk_done Set if the last byte copied ends a chunk.
+* @return The number of bytes copied.
+*/
+size_t rudp_shm_read(RUDP_Socket *sockfd, int stream_id, char *buffer, size_t buffer_size, bool *chunk_done) {
+    RUDP_Shm_Region *region = sockfd->shm;
+    int peer = 1 - sockfd->shm_side;
+    unsigned long long start = rudp_shm_tail(region, peer, stream_id);
+    unsigned long long tail = start;
+    unsigned long long head = rudp_shm_head(region, peer, stream_id);
+    size_t received = 0;
+    *chunk_done = false;
+    while (received < buffer_size) {
+        if (sockfd->shm_left[stream_id] == 0) {
+            if (tail == head) {
+                break;
+            }
+            RUDP_Shm_Record record;
+            rudp_shm_load(region, peer, stream_id, tail, &record, sizeof(record));
+            tail += sizeof(record);
+            sockfd->shm_left[stream_id] = record.length;
+            sockfd->shm_flags[stream_id] = record.flags;
+        }
+        size_t take = sockfd->shm_left[stream_id];
+        if (take > buffer_size - received) {
+            take = buffer_size - received;
+        }
+        rudp_shm_load(region, peer, stream_id, tail, buffer + received, take);
+        tail += take;
+        received += take;
+        sockfd->shm_left[stream_id] -= (unsigned int)take;
+        if (sockfd->shm_left[stream_id] == 0 && (sockfd->shm_flags[stream_id] & EOC_FLAG)) {
+            *chunk_done = true;
+            break;
+        }
+    }
+    if (tail != start) {
+        rudp_shm_set_tail(region, peer, stream_id, tail);
+        rudp_shm_ring_bell(region, peer);
+        sockfd->stats.shm_bytes_received += received;
+    }
+    return received;
+}
+
+/*
+* @brief rudp_stream_recv() on the rings: one chunk from a stream, or from whichever stream has one first.
+* @return The number of bytes received, 0 if the peer closed the connection, -1 on error.
+*/
+int rudp_shm_stream_recv(RUDP_Socket *sockfd, int *stream_id, char *buffer, size_t buffer_size) {
+    int stream = *stream_id;
+    size_t bytes_received = 0;
+    while (true) {
+        // Looked at before the rings, so a close seen here comes after everything written before it
+        bool closed = rudp_shm_peer_closed(sockfd) || sockfd->peer_fin;
+        if (stream == RUDP_ANY_STREAM) {
+            for (int i = 0; i < RUDP_MAX_STREAMS && stream == RUDP_ANY_STREAM; i++) {
+                if (rudp_shm_ready(sockfd, i, buffer_size)) {
+                    stream = i;
+                }
+            }
+        }
+        if (stream != RUDP_ANY_STREAM) {
+            bool chunk_done;
+            bytes_received += rudp_shm_read(sockfd, stream, buffer + bytes_received, buffer_size - bytes_received, &chunk_done);
+            if (chunk_done || bytes_received == buffer_size) {
+                *stream_id = stream;
+                return (int)bytes_received;
+            }
+        }
+        if (closed) {
+            *stream_id = stream;
+            return (int)bytes_received; // Connection closed by peer
+        }
+        if (rudp_poll(sockfd, 0) < 0) {
+            return -1;
+        }
+    }
+}
+
+// Tell a peer on the rings that nothing more will be written to them
+void rudp_shm_close(RUDP_Socket *sockfd) {
+    if (sockfd->shm != NULL) {
+        rudp_shm_set_closed(sockfd->shm, sockfd->shm_side);
+        rudp_shm_ring_bell(sockfd->shm, 1 - sockfd->shm_side);
+    }
+}
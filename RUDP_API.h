@@ -7,40 +7,885 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <sys/select.h>
 
-// Constants for packet flags
+#include "RUDP_FEC.h"
+#include "RUDP_Hash.h"
+#include "RUDP_LZ.h"
+#include "RUDP_Pool.h"
+#include "RUDP_Shm.h"
+
+// Constants for packet flags (bit flags, so an ACK can ride on a data segment)
 #define SYN_FLAG 0x01
 #define ACK_FLAG 0x02
 #define FIN_FLAG 0x04
+#define DATA_FLAG 0x08   // Packet carries a data segment
+#define EOC_FLAG 0x10    // Last segment of a chunk passed to rudp_send_file_1()
+#define FEC_FLAG 0x20    // Packet carries a parity segment
+#define PROBE_FLAG 0x40  // Zero-window probe, answered with an immediate ACK
+#define LZ_FLAG 0x80     // Data segment holds one LZ block: [raw length lo, raw length hi] + compressed bytes
+#define PATH_FLAG 0x100  // Client opening or probing a subflow: carries the connection's cookie, answered like a probe
+#define GROUP_FLAG 0x200 // Packet of a distribution group, not of a connection
+#define NACK_FLAG 0x400  // Group: ranges of segments a receiver is missing, or the sender's echo of them
+#define SYN_ACK_FLAG (SYN_FLAG | ACK_FLAG)
+#define FIN_ACK_FLAG (FIN_FLAG | ACK_FLAG)
+
+// Segmentation and window sizes. A segment's data fills what the MTU leaves after the IP and UDP headers, our
+// header and the most that can ride ahead of the data: a parity symbol's prefix or a SYN's handshake options.
+#define RUDP_MTU 1500          // Largest datagram, IP and UDP headers included, that is sent unfragmented
+#define RUDP_UDP_OVERHEAD 28   // IPv4 and UDP headers
+#define RUDP_MAX_PREFIX ((int)sizeof(RUDP_Handshake) > RUDP_FEC_PREFIX ? (int)sizeof(RUDP_Handshake) : RUDP_FEC_PREFIX)
+#define RUDP_MSS ((int)(RUDP_MTU - RUDP_UDP_OVERHEAD - sizeof(RUDP_Header)) - RUDP_MAX_PREFIX) // Max payload bytes per data segment
+#define RUDP_SND_SEGS 256      // Slots in the retransmission queue
+#define RUDP_RCV_SEGS 256      // Slots in the reassembly queue
+#define RUDP_WINDOW 64         // Max segments in flight, also the reach of the SACK bitmap
+#define RUDP_INIT_CWND 10      // Initial congestion window in segments
+
+// Loss recovery
+#define RUDP_RTO_MS 1000       // Retransmission timeout before the first RTT sample
+#define RUDP_MIN_RTO_MS 200
+#define RUDP_MAX_RTO_MS 60000
+#define RUDP_MIN_PTO_US 1000   // Floor for the tail-loss probe timer
+#define RUDP_DUPTHRESH 3       // Duplicate ACKs / SACKed segments above a hole that mark it lost
+#define RUDP_MAX_PERSIST_MS 1000 // Longest wait between zero-window probes
+
+// Streams: independently ordered chunk sequences sharing the connection's windows
+#define RUDP_MAX_STREAMS 8
+#define RUDP_ANY_STREAM -1     // rudp_stream_recv(): whichever stream has data first
+
+// Forward error correction: a parity symbol covers a segment's length, flags, stream position and payload
+#define RUDP_FEC_PREFIX 8      // [length lo, length hi, flags, stream, stream_seq x4]
+#define RUDP_FEC_SYMBOL (RUDP_MSS + RUDP_FEC_PREFIX)
+#define RUDP_FEC_GROUPS 16     // Parity groups the receiver tracks at once
+#define RUDP_MAX_PAYLOAD (RUDP_MSS + RUDP_MAX_PREFIX) // Parity, or a SYN's data behind its options
+
+// Compression: every segment is an independent block, so a lost one costs neither its neighbours nor a resync.
+// A chunk is cut into slices that worker threads turn into segments side by side.
+#define RUDP_LZ_HEADER 2       // Raw length in front of the block
+#define RUDP_LZ_MAX_RAW 16384  // Most bytes one segment decompresses to, a compressed read needs room for that much
+#define RUDP_LZ_SLICE 32768    // Chunk bytes one worker job covers
+#define RUDP_LZ_SLICE_SEGS ((RUDP_LZ_SLICE + RUDP_MSS - 1) / RUDP_MSS) // A stored segment still carries a full MSS
+#define RUDP_LZ_JOBS 8         // Slices compressed in one parallel batch
+#define RUDP_LZ_BACKOFF 16     // Most segments stored raw without trying after a block failed to shrink
+
+// Kernel socket buffers: sized to twice the measured bandwidth-delay product, never below a full window
+#define RUDP_DGRAM_CHARGE 2304 // Kernel memory charged for one queued full-size datagram, payload plus skb overhead
+#define RUDP_MAX_SOCKBUF (16 * 1024 * 1024)
+#define RUDP_RATE_INTERVAL_MS 10 // Shortest delivery-rate sample
+
+// Sessions: many files over one connection, each record is one chunk
+#define RUDP_SESSION_BLOCK 65536 // Max file data bytes per record
+#define RUDP_SESSION_STREAM 0  // Stream the session's records travel on
+#define RUDP_NAME_MAX 256
+#define RUDP_CHECKPOINT_MS 100 // Receiver: shortest interval between two checkpoint writes of a file
+
+// Verified files: a Merkle tree over the content, its root checked at the end and mismatching blocks resent
+#define RUDP_MERKLE_LEAF 8192  // Bytes per leaf, hashed side by side. A session block is the subtree of its leaves
+#define RUDP_VERIFY_ROUNDS 3   // Repairs of a file before it is given up as corrupt
+
+// Delta transfer: basis blocks of about the square root of the basis size, as rsync picks them
+#define RUDP_DELTA_MIN_BLOCK 1024
+#define RUDP_DELTA_MAX_BLOCK 65536
+// A block's strong hash is 64-bit SipHash-2-4 under a fixed key, cheap enough to confirm every weak match
+
+// Handshake: a server cookie proves the client is reachable, so a SYN that carries one may also carry data
+#define RUDP_COOKIE_LIFETIME_US 600000000LL // 10 minutes, well inside the 71 minutes its 32-bit issue time spans
+#define RUDP_COOKIE_CACHE 16   // Servers a client remembers cookies for
+
+// Teardown: runs in the background after rudp_close(), bounded so a vanished peer cannot hold on to the socket
+#define RUDP_CLOSE_TIMEOUT_MS 10000 // Longest the FIN exchange may take, waiting for the peer's FIN included
+#define RUDP_LINGER_MS 1000    // Wait after our final ACK in case it was lost, restarted whenever the peer's FIN comes again
+
+// Same-host path: when both ends run on this machine the data moves through shared-memory rings, not UDP
+#define RUDP_SHM_ATTACH_MS 50  // Client: longest wait for the server to map the offered rings before staying on UDP
+#define RUDP_SHM_CHECK_MS 1000 // Longest sleep on the doorbell before checking that the peer's process still exists
+
+// Multipath: one connection over several local/remote address pairs, each subflow with its own RTT and window
+#define RUDP_MAX_PATHS 4
+#define RUDP_PATH_TIMEOUTS 3   // Consecutive timeouts of a subflow before its data moves to the others and it is only probed
+#define RUDP_PATH_PROBE_MS 500 // Interval between joins or probes of a subflow the peer has not answered on
+
+// Distribution groups: one sender, many receivers. Every segment goes out once to all of them, receivers NACK
+// what they miss after a random backoff, and the sender echoes each NACK to the group so the others hold theirs
+#define RUDP_GROUP_MAX_MEMBERS 64  // Receivers a sender keeps track of, and fans out to without IP multicast
+#define RUDP_GROUP_NACK_RANGES 64  // [first, count] ranges one NACK carries
+#define RUDP_GROUP_RATE (8 * 1024 * 1024) // Default sending rate in bytes per second, nothing clocks a group like ACKs do
+#define RUDP_GROUP_BURST 8         // Datagrams the pacer may send ahead of schedule after a wait
+#define RUDP_GROUP_BACKOFF_MS 20   // Receiver: NACKs wait a random part of this, so the first one can speak for everyone
+#define RUDP_GROUP_HOLD_MS 200     // Receiver: after asking or hearing someone ask for a segment, wait this long for the repair
+#define RUDP_GROUP_AGGREGATE_MS 5  // Sender: NACKs collected before the first repair of a batch goes out
+#define RUDP_GROUP_FIN_MS 50       // Sender: first interval of end-of-object and end-of-group announcements, doubled up to a second
+#define RUDP_GROUP_LINGER_MS 2000  // Sender: silence after which it stops waiting for receivers that never reported
+#define RUDP_GROUP_SILENCE_MS 10000 // Receiver: silence after which a sender once heard is given up, idle or gone
+#define RUDP_GROUP_JOIN_MS 200     // Interval of join requests while a sender waits for members or a receiver for the sender
+#define RUDP_GROUP_TTL 1           // Multicast hops, the local network only unless raised
+#define RUDP_GROUP_SOCKBUF (4 * 1024 * 1024) // Socket buffers of a group end, a receiver may fall a while behind the sender
+
+// Default ACK policy: acknowledge every N segments or after the delayed-ACK timer, whichever comes first
+#define RUDP_ACK_EVERY 8
+#define RUDP_ACK_DELAY_MS 10
+
+// Low-latency mode: rudp_poll() spins on non-blocking reads before it blocks
+#define RUDP_SPIN_BATCH 16       // Datagrams one recvmmsg() takes while spinning
+#define RUDP_MAX_SPIN_US 100000  // Longest spin budget rudp_set_low_latency() accepts
+#define RUDP_BUSY_POLL_US 50     // SO_BUSY_POLL asked for: the kernel polls the device queue this long per read
+
+// Wrap-safe sequence number comparisons
+#define SEQ_LT(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)) < 0)
+#define SEQ_LEQ(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)) <= 0)
 
 // Structure for RUDP header
 typedef struct {
-    uint16_t length;    // Length of data
-    uint16_t checksum;  // Checksum for data integrity
-    uint8_t flags;      // Flags for packet type (SYN, ACK, FIN, etc.)
+    int length;                   // Length of data
+    unsigned short int checksum;  // Checksum for data integrity
+    unsigned char stream;         // Data: stream the segment belongs to
+    unsigned char path;           // Subflow the packet went out on, numbered as the client added them
+    int flags;                    // Flags for packet type (SYN, ACK, FIN, etc.)
+    unsigned int seq;             // Sequence number of a data segment
+    unsigned int ack;             // Cumulative ACK: next segment the sender of this header expects
+    unsigned int window;          // Free reassembly queue slots (segments) above ack. Group: id of the sender
+    unsigned long long sack;      // Selective ACK: bit i set if segment ack + 1 + i was received
+    unsigned char fec_k;          // Parity: data segments in the group
+    unsigned char fec_m;          // Parity: parity in the group. ACK: parity the receiver asks for
+    unsigned char fec_index;      // Parity: which parity symbol of the group this is
+    unsigned int stream_seq;      // Data: position of the segment within its stream
 } RUDP_Header;
 
+// Options only the handshake needs. They lead the payload of SYN-flagged packets, of the client's control packets
+// until the server has answered and of its subflow joins, instead of taking room in every header.
+typedef struct {
+    unsigned long long cookie;    // SYN-ACK: cookie issued to the client. SYN, handshake ACK and join: cookie echoed back
+    unsigned long long shm_token; // Client: token at the start of the rings
+    unsigned int shm_pid;         // Client: process offering shared-memory rings. Server: takes the offer
+    int shm_fd;                   // Client: memfd of the offered rings in that process
+    unsigned char fec_k;          // FEC group size: requested by the client, accepted by the server
+    unsigned char fec_m;          // Max parity per group: requested by the client, accepted by the server
+    unsigned char compress;       // LZ compression: requested by the client, accepted by the server
+    unsigned char no_checksum;    // Payloads left to the UDP checksum: requested by the client, accepted by the server
+} RUDP_Handshake;
+
+// A data or parity segment as it goes on the wire
+typedef struct {
+    RUDP_Header header;
+    char data[RUDP_MAX_PAYLOAD];
+} RUDP_Packet;
+
+// The largest datagram we send must fit the MTU, the array size goes negative and the build fails if it does not
+typedef char rudp_packet_fits_mtu[sizeof(RUDP_Packet) + RUDP_UDP_OVERHEAD <= RUDP_MTU ? 1 : -1];
+
+// A segment in the send pool or a slot in the reassembly queue
+typedef struct _rudp_segment {
+    bool in_use;            // Slot holds a segment
+    unsigned int seq;       // Sequence number of the segment, assigned on first transmission
+    int flags;              // DATA_FLAG, plus EOC_FLAG for the last segment of a chunk
+    unsigned char stream;   // Stream the segment belongs to
+    unsigned int stream_seq; // Position within the stream
+    bool consumed;          // Receive side: handed to the application, the slot is freed once rcv_read passes it
+    struct _rudp_segment *next; // Send side: next segment in a stream's pending list or the free list
+    int length;             // Payload length
+    long long sent_us;      // Time of the last transmission (send side only)
+    bool retransmitted;     // Sent more than once, so it gives no RTT sample
+    bool sacked;            // Receiver holds it out of order
+    bool lost;              // Marked lost and waiting to be retransmitted
+    unsigned char path;     // Send side: subflow of the last transmission
+    long long fec_close_us; // When the parity covering it was sent, LLONG_MAX while its group is open, 0 if unprotected
+    char data[RUDP_MSS];
+} RUDP_Segment;
+
+// A parity group the receiver is collecting
+typedef struct {
+    bool in_use;
+    unsigned int base;          // First data segment of the group
+    int k;                      // Data segments in the group
+    int symbol_size;            // Bytes per parity symbol
+    int parity_count;           // Parity symbols received so far
+    int parity_index[RUDP_FEC_MAX_M];
+    unsigned char parity[RUDP_FEC_MAX_M][RUDP_FEC_SYMBOL];
+} RUDP_FEC_Group;
+
+// FEC encoder and decoder state, allocated once FEC is negotiated
+typedef struct {
+    // Encoder
+    unsigned int enc_base;      // First data segment of the open group
+    int enc_count;              // Data segments folded into the open group
+    int enc_m;                  // Parity symbols the open group will get
+    int enc_len;                // Longest payload in the open group
+    unsigned char enc_parity[RUDP_FEC_MAX_M][RUDP_FEC_SYMBOL];
+    double snd_loss;            // Fraction of segments the sender had to retransmit
+    int peer_m;                 // Parity per group the receiver last asked for
+
+    // Decoder
+    RUDP_FEC_Group groups[RUDP_FEC_GROUPS];
+    double rcv_loss;            // Fraction of each group missing when its parity arrived
+    unsigned long rcv_samples;
+    unsigned int rcv_sampled_base; // Group the last loss sample came from
+    unsigned char scratch[RUDP_FEC_MAX_K][RUDP_FEC_SYMBOL];
+} RUDP_FEC_State;
+
+// One slice of a chunk and the segment payloads it became
+typedef struct {
+    const unsigned char *src;
+    int src_size;
+    int count;                  // Segments produced
+    int length[RUDP_LZ_SLICE_SEGS];
+    bool compressed[RUDP_LZ_SLICE_SEGS];
+    unsigned char data[RUDP_LZ_SLICE_SEGS][RUDP_MSS];
+    unsigned long raw_bytes;    // Slice bytes that went into compressed segments
+    unsigned long wire_bytes;   // Their payload bytes
+} RUDP_LZ_Job;
+
+// Compressor state, allocated once compression is negotiated
+typedef struct {
+    RUDP_LZ_Job jobs[RUDP_LZ_JOBS];
+    unsigned char *flat;        // A chunk given in several buffers, gathered into one
+    size_t flat_size;
+} RUDP_LZ_State;
+
+// Per-connection counters
+typedef struct {
+    unsigned long segments_sent;        // Data segments sent, including retransmissions
+    unsigned long segments_retransmitted;
+    unsigned long segments_received;    // Data segments received, including duplicates
+    unsigned long acks_sent;            // Pure ACK datagrams sent
+    unsigned long acks_piggybacked;     // ACKs carried on outgoing data segments
+    unsigned long acks_received;
+    unsigned long checksum_errors;      // Segments dropped for a bad checksum
+    unsigned long segments_unchecked;   // Segments taken on the UDP checksum alone, once the handshake dropped ours
+    unsigned long fast_retransmits;     // Segments resent by SACK/duplicate-ACK loss detection
+    unsigned long tlp_probes;           // Tail-loss probes sent
+    unsigned long rto_timeouts;         // Retransmission timer expirations
+    long long srtt_us;                  // Smoothed round-trip time
+    unsigned long window_probes;        // Zero-window probes sent
+    unsigned long window_updates;       // ACKs sent because the application freed buffer space
+    unsigned long window_stalls;        // Times the sender found the receiver's window closed
+    unsigned long fec_parity_sent;
+    unsigned long fec_recovered;        // Data segments rebuilt from parity
+    unsigned long lz_raw_bytes;         // Chunk bytes sent in compressed segments
+    unsigned long lz_wire_bytes;        // Payload bytes those segments took, length headers included
+    unsigned long sndbuf_bytes;         // SO_SNDBUF the kernel actually granted
+    unsigned long rcvbuf_bytes;         // SO_RCVBUF the kernel actually granted
+    unsigned long rx_queue_drops;       // Datagrams the kernel dropped on a full receive buffer (SO_RXQ_OVFL)
+    unsigned long shm_bytes_sent;       // Chunk bytes written to the shared-memory rings
+    unsigned long shm_bytes_received;   // Chunk bytes read from them
+    unsigned long spin_hits;            // Spins that found a datagram within the budget
+    unsigned long spin_misses;          // Spins that ran out of budget and fell back to blocking
+    unsigned int cwnd;                  // Congestion window in segments when the counters were read
+} RUDP_Stats;
+
+// One subflow of a connection. Path 0 is the connection's own socket and dest_addr; its RTT and window
+// below only come into use once there is a second path, until then the connection's own fields govern.
+typedef struct {
+    int fd;                     // Socket it sends and receives on: a socket of its own on the client, the listening one on the server
+    struct sockaddr_in remote;  // Peer address of the subflow
+    bool validated;             // The peer answered on it, data may use it
+    bool dead;                  // Timed out RUDP_PATH_TIMEOUTS times in a row, only probed until it answers again
+    long long srtt_us;
+    long long rttvar_us;
+    long long rto_us;
+    unsigned int cwnd;
+    unsigned int cwnd_acked;
+    unsigned int ssthresh;
+    bool in_recovery;           // Window reduced for a loss, ends once a segment sent after it is delivered
+    long long recover_us;       // When the loss was detected
+    long long rack_sent_us;     // Send time of its most recently sent segment known to be delivered
+    long long sample_sent_us;   // Newest first-transmission segment the ACK being processed delivered, 0 if none
+    long long unanswered_us;    // First transmission on it since it last delivered anything, 0 if none. Its timeout runs from here
+    unsigned int timeouts;      // Consecutive timeouts. While above 0 it gets no new data, only probes, unless no subflow is better off
+    long long probe_us;         // When the last join or probe went out on it
+    long long probe_deadline_us; // When to send the next one, 0 if it needs none
+    unsigned long segments_sent;
+    unsigned long segments_lost; // Marked lost by loss detection or a timeout of the subflow
+    unsigned long segments_received;
+} RUDP_Path;
+
+// What rudp_get_path_stats() reports about a subflow
+typedef struct {
+    struct sockaddr_in remote;
+    bool validated;
+    bool dead;
+    long long srtt_us;
+    unsigned int cwnd;
+    unsigned long segments_sent;
+    unsigned long segments_lost;
+    unsigned long segments_received;
+} RUDP_Path_Stats;
+
+// One receiver as the sender of a group knows it
+typedef struct {
+    unsigned long long id;      // Multicast receivers share the group's port, the address alone does not tell them apart
+    struct sockaddr_in addr;
+    unsigned int done_object;   // Last object it reported complete, 0 if none
+    bool closed;                // Acknowledged the end of the group
+    long long heard_us;         // Last time anything came from it
+} RUDP_Group_Member;
+
+// Per-group counters
+typedef struct {
+    unsigned long segments_sent;        // Sender: first transmissions of data segments
+    unsigned long repairs_sent;         // Sender: segments sent again for NACKs
+    unsigned long nacks_received;       // Sender
+    unsigned long nacks_echoed;         // Sender: echoes that announced repairs to the whole group
+    unsigned long nacks_sent;           // Receiver
+    unsigned long segments_suppressed;  // Receiver: missing segments another receiver asked for first
+    unsigned long segments_received;    // Receiver: data segments, duplicates included
+    unsigned long duplicates;           // Receiver
+    unsigned long checksum_errors;      // Receiver
+    unsigned int members;               // Sender: receivers it has heard from
+    unsigned int members_done;          // Sender: those that reported the last object complete
+} RUDP_Group_Stats;
+
+// A distribution group, one end of it. The same segment numbering as a connection, but no handshake, no window and
+// no ACK clock: the sender paces at a fixed rate and only repairs what receivers report missing.
+typedef struct {
+    int fd;
+    bool isSender;
+    bool multicast;             // The group address is an IP multicast group. Otherwise it is the sender's own
+                                // address and the sender fans every datagram out to the members by unicast
+    struct sockaddr_in group_addr;
+    unsigned int sender_id;     // Random per sender, receivers follow the first one they hear
+    unsigned long long member_id; // Receiver: random, identifies it to the sender
+    unsigned long long rng;     // Backoff randomness, independent of the application's rand()
+
+    // Object in transfer: one buffer sent with rudp_group_send() or received with rudp_group_recv()
+    unsigned int object;        // Id of the object, counting from 1
+    char *data;                 // Sender: the application's buffer, read again for repairs. Receiver: the caller's buffer
+    unsigned long long size;
+    size_t capacity;            // Receiver: room in data
+    unsigned int count;         // Segments of the object
+
+    // Sender
+    RUDP_Group_Member members[RUDP_GROUP_MAX_MEMBERS];
+    unsigned int member_count;
+    unsigned int next;          // Next segment to send for the first time
+    unsigned char *repair;      // Bit per segment a NACK asked for and no repair has carried yet
+    unsigned int repair_count;
+    unsigned int repair_next;   // No repair bit is set below it
+    long long *repaired_us;     // Per segment: last time a repair of it went out, 0 if never
+    long long repair_due_us;    // Repairs wait for more NACKs until then
+    double rate;                // Bytes per second
+    long long pace_us;          // When the next datagram is due
+    long long fin_deadline_us;  // Next end-of-object announcement, 0 while data is still going out
+    long long fin_interval_us;
+    long long heard_us;         // Last time any receiver spoke
+
+    // Receiver
+    bool sender_known;          // A sender was heard, sender_id and sender_addr are its
+    struct sockaddr_in sender_addr; // Where joins, NACKs and completions go
+    long long sender_heard_us;  // Last time the sender was heard
+    bool receiving;             // An object is in progress in data
+    unsigned int done_object;   // Last object completed, 0 if none
+    unsigned char *have;        // Bit per segment received
+    unsigned int have_count;
+    unsigned int seen;          // Segments below this are known to exist: the highest one received, or all after the end
+    long long *hold_us;         // Per segment: no NACK for it before then, a repair is expected
+    long long nack_deadline_us; // When the pending NACK goes out, 0 if none is pending
+    long long join_deadline_us; // Fan-out: next join request until the sender answers
+    bool closed;                // The sender closed the group
+
+    RUDP_Group_Stats stats;
+} RUDP_Group;
+
+// Outcome of a background close
+#define RUDP_CLOSE_OK 0        // Both FINs acknowledged
+#define RUDP_CLOSE_TIMEOUT -1  // The peer stopped answering
+#define RUDP_CLOSE_ERROR -2    // Socket error
+
+typedef struct {
+    int status;                 // RUDP_CLOSE_*
+    long long duration_us;      // From rudp_close() until the socket was released
+    unsigned int fin_transmissions; // FINs we sent, 1 unless one was lost
+    RUDP_Stats stats;           // Final counters of the connection
+} RUDP_Close_Result;
+
+// Called from the teardown thread once the connection is gone, the socket is already freed
+typedef void (*RUDP_Close_Callback)(const RUDP_Close_Result *result, void *arg);
+
+// Congestion control: how a window grows as segments are acknowledged and what it drops to after a loss (flight:
+// segments it covered, timeout: an RTO rather than fast recovery). Used for the connection and each subflow.
+// Picked once before the handshake, so the ACK and loss paths call it without testing which one is in force.
+typedef struct {
+    void (*grow)(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked);
+    void (*reduce)(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout);
+} RUDP_Congestion;
+
+// One stream's ordering state on both ends
+typedef struct {
+    // Send side
+    RUDP_Segment *pend_head;    // Queued segments not yet transmitted, oldest first
+    RUDP_Segment *pend_tail;
+    unsigned int pend_count;
+    unsigned int snd_next;      // Stream position of the next queued segment
+    unsigned int snd_acked;     // Stream segments acknowledged so far
+    int priority;               // Lower goes first
+    unsigned int weight;        // Segments per round among streams of the same priority
+    unsigned int credit;        // Segments left in the current round
+
+    // Receive side
+    unsigned int rcv_next;      // Stream position the application reads next
+    unsigned int rcv_scan;      // Sequence number to resume looking for it from
+} RUDP_Stream;
+
+// Session record types, in the order a session sends them
+#define RUDP_REC_MANIFEST 1    // Payload: RUDP_File_Info entries appended to the session's file table
+#define RUDP_REC_FILE_START 2  // A file's data follows
+#define RUDP_REC_FILE_DATA 3   // Payload: file bytes at offset
+#define RUDP_REC_FILE_END 4    // Last record of a file, carries its status and, if verified and OK, the Merkle root as payload
+#define RUDP_REC_SESSION_END 5 // No more files
+#define RUDP_REC_RESUME 6      // Receiver to sender: payload is the file's block bitmap from byte `offset` on, empty if nothing is stored
+#define RUDP_REC_SIGNATURE 7   // Receiver to sender: RUDP_Block_Sig of basis blocks from index `offset` on, status is the block size.
+                               // An empty one ends the signature, its offset is the block count
+#define RUDP_REC_FILE_COPY 8   // Payload: RUDP_Copy, file bytes at offset taken from the receiver's basis
+#define RUDP_REC_VERIFY 9      // Receiver to sender: verdict on a verified file's root, in status. A RUDP_FILE_CORRUPT verdict
+                               // carries the receiver's block hashes from block `offset` on, over as many records as it takes
+
+// File status: RUDP_FILE_OK or a negative error
+#define RUDP_FILE_OK 0
+#define RUDP_FILE_ABORTED -1   // The sender gave up on the file
+#define RUDP_FILE_SHORT -2     // Fewer bytes arrived than the manifest announced
+#define RUDP_FILE_CORRUPT -3   // The content does not match the sender's Merkle root
+
+// Per-file progress
+#define RUDP_FILE_PENDING 0    // Listed in the manifest, not started
+#define RUDP_FILE_ACTIVE 1     // Started, data flowing
+#define RUDP_FILE_SENT 2       // Sender: FILE_END queued, not yet acknowledged
+#define RUDP_FILE_DONE 3       // Sender: FILE_END acknowledged. Receiver: complete with RUDP_FILE_OK
+#define RUDP_FILE_FAILED 4     // Ended with an error status
+
+// Header of every session record, followed by `length` payload bytes
+typedef struct {
+    unsigned int type;          // RUDP_REC_*
+    unsigned int file_id;       // Index in the session's file table
+    unsigned long long offset;  // FILE_DATA: file offset of the payload
+    unsigned int length;        // Payload bytes after this header
+    int status;                 // FILE_END: RUDP_FILE_OK or an error
+} RUDP_Record;
+
+// A basis block as the receiver describes it
+typedef struct {
+    unsigned int weak;          // rudp_weak_sum() of the block
+    unsigned long long strong;  // rudp_siphash() of the block under rudp_delta_key
+} RUDP_Block_Sig;
+
+// FILE_COPY payload
+typedef struct {
+    unsigned long long source;  // Offset in the basis
+    unsigned long long length;  // Bytes to copy
+} RUDP_Copy;
+
+// Manifest entry flags
+#define RUDP_FILE_DELTA 0x01   // Send only what differs from the receiver's basis for the file
+#define RUDP_FILE_VERIFY 0x02  // Check the whole file against a Merkle tree of its content, resend only blocks that differ
+
+// A manifest entry
+typedef struct {
+    char name[RUDP_NAME_MAX];
+    unsigned long long size;    // Bytes the sender will send
+    unsigned int mode;          // Permission bits
+    long long mtime;            // Modification time, seconds since the epoch
+    unsigned char hash[RUDP_HASH_SIZE]; // SHA-256 of the content, all zero if the file is not resumable
+    unsigned int flags;         // RUDP_FILE_*
+} RUDP_File_Info;
+
+// Receiver's checkpoint file: this header, then one bit per RUDP_SESSION_BLOCK bytes of the file
+#define RUDP_CHECKPOINT_MAGIC 0x52434b31 // "RCK1"
+typedef struct {
+    unsigned int magic;
+    unsigned int block_size;    // RUDP_SESSION_BLOCK of the writer
+    RUDP_File_Info info;        // Identity of the file the bitmap belongs to
+} RUDP_Checkpoint;
+
+// Delta state of a file sent with RUDP_FILE_DELTA
+typedef struct {
+    unsigned int block;         // Bytes per basis block
+    unsigned int count;         // Full basis blocks described
+    RUDP_Block_Sig *sigs;       // Sender: the receiver's block signatures
+    bool complete;              // Sender: the whole signature arrived. Receiver: it was sent
+    unsigned int *head;         // Sender: first block with each weak sum bucket, UINT_MAX if none
+    unsigned int *next;         // Sender: next block in the same bucket
+    unsigned int mask;          // Sender: buckets - 1
+    const char *basis;          // Receiver: the old content, owned by the application
+    unsigned long long basis_size;
+} RUDP_Delta;
+
+// Merkle tree of a file sent with RUDP_FILE_VERIFY, built on both ends as the data passes
+typedef struct {
+    unsigned char (*leaves)[RUDP_HASH_SIZE]; // One per RUDP_MERKLE_LEAF bytes of the file
+    unsigned char (*nodes)[RUDP_HASH_SIZE];  // Subtree of each RUDP_SESSION_BLOCK block, the root is the tree over these
+    unsigned long long fed;     // File position just past the data hashed last
+    RUDP_SHA256 partial;        // Leaf in progress while fed is inside one
+    unsigned char (*peer)[RUDP_HASH_SIZE]; // Sender: the receiver's block hashes after a failed check
+    unsigned long long peer_count; // Sender: how many of them arrived
+    const char *source;         // Sender: the content to resend blocks from, owned by the application
+    unsigned long long source_size;
+    unsigned int rounds;        // Sender: repairs so far
+    bool pending;               // Sender: FILE_END with the root is out, the verdict has not come back
+    bool repairing;             // Receiver: the check failed, blocks may arrive again
+} RUDP_Merkle;
+
+typedef struct {
+    RUDP_File_Info info;
+    int state;                  // RUDP_FILE_*
+    int status;                 // Status carried by FILE_END
+    unsigned long long bytes;   // File position reached, blocks the receiver already stored included
+    unsigned int end_seq;       // Sender: stream position just past the FILE_END record
+
+    // Resuming, only for files with a content hash
+    unsigned char *blocks;      // Bit per RUDP_SESSION_BLOCK block the receiver has stored, NULL if not resumable
+    unsigned long long resumed; // Bytes stored by an earlier attempt
+    bool resume_known;          // Sender: the receiver's whole bitmap arrived
+    bool dirty;                 // Receiver: blocks changed since the last checkpoint write
+    long long checkpoint_us;    // Receiver: time of the last checkpoint write
+
+    RUDP_Delta *delta;          // NULL unless the file was announced with RUDP_FILE_DELTA
+    RUDP_Merkle *merkle;        // NULL unless the file was announced with RUDP_FILE_VERIFY
+} RUDP_File_Entry;
+
+// File table shared by both ends, grown by every manifest
+typedef struct {
+    RUDP_File_Entry *files;
+    unsigned int count;
+    unsigned int capacity;
+    bool finished;              // SESSION_END sent or received
+    char checkpoint_dir[RUDP_NAME_MAX]; // Receiver: where checkpoints live, empty to keep none
+    int stored_file;            // Receiver: file of the last FILE_DATA handed out, -1 if none
+    unsigned long long stored_end; // Receiver: offset just past that record, on disk once the application asks for more
+    char *reply;                // Sender: buffer for the receiver's RESUME and SIGNATURE records
+    unsigned int unanswered;    // Receiver: delta files the application has not given a basis for yet
+} RUDP_Session;
+
+// What rudp_session_recv() found in the next record
+typedef struct {
+    unsigned int type;          // RUDP_REC_*
+    unsigned int file_id;
+    const RUDP_File_Info *info; // FILE_START, FILE_DATA, FILE_END: the file's manifest entry
+    unsigned long long offset;  // FILE_DATA: file offset of data
+    const char *data;           // FILE_DATA: payload, inside the caller's buffer or, for copied blocks, the basis
+    size_t length;              // FILE_DATA: payload bytes. MANIFEST: entries added
+    unsigned long long resumed; // FILE_START: bytes an earlier attempt stored, keep them when opening the file
+    int status;                 // FILE_END: final status of the file. VERIFY: RUDP_FILE_CORRUPT, the blocks that differ come again
+} RUDP_Session_Event;
+
 // A struct that represents RUDP Socket
 typedef struct _rudp_socket {
     int socket_fd;              // UDP socket file descriptor
     bool isServer;              // True if the RUDP socket acts like a server, false for client.
     bool isConnected;           // True if there is an active connection, false otherwise.
     struct sockaddr_in dest_addr;  // Destination address. Client fills it when it connects via rudp_connect(), server fills it when it accepts a connection via rudp_accept().
+    bool syn_pending;           // Client: the server may not have committed yet, SYNs and handshake ACKs carry the cookie
+    unsigned long long cookie;  // Client: cookie from the server, 0 if none
+
+    // Send side
+    unsigned int snd_una;       // Oldest unacknowledged segment
+    unsigned int snd_nxt;       // Next segment to transmit
+    long long rto_deadline_us;  // When the oldest outstanding segment times out, 0 if none
+    unsigned int timeouts;      // Consecutive retransmission timeouts
+    long long srtt_us;          // Smoothed RTT, 0 until the first sample
+    long long rttvar_us;        // RTT variation
+    long long rto_us;           // Current retransmission timeout
+    unsigned int cwnd;          // Congestion window in segments
+    unsigned int cwnd_init;     // Window the connection and every new subflow start with
+    RUDP_Congestion congestion; // Reno unless rudp_set_congestion() or a rudp::Connection picked another
+    unsigned int cwnd_acked;    // Segments acknowledged toward the next congestion avoidance increase
+    unsigned int ssthresh;      // Slow start threshold
+    bool in_recovery;           // Fast recovery in progress
+    unsigned int recover;       // Recovery ends once this sequence number is acknowledged
+    unsigned int dupacks;       // Duplicate ACKs for snd_una
+    long long rack_sent_us;     // Send time of the most recently sent segment known to be delivered
+    long long tlp_deadline_us;  // When the tail-loss probe fires, 0 if not armed
+    bool tlp_sent;              // A probe is out and no ACK has advanced since
+    unsigned int snd_wnd_edge;  // Receiver's window right edge: first segment it has no room for
+    long long persist_deadline_us; // When to probe a closed window, 0 if not armed
+    long long persist_us;       // Current probe interval, backs off up to RUDP_MAX_PERSIST_MS
+    RUDP_Segment **snd_queue;   // Segments in flight, RUDP_SND_SEGS slots indexed by seq % RUDP_SND_SEGS
+    RUDP_Segment *snd_pool;     // RUDP_SND_SEGS segments, queued or in flight
+    RUDP_Segment *snd_free;     // Unused pool segments
+    unsigned int snd_pending;   // Queued segments waiting for their first transmission, over all streams
+    unsigned int snd_rr;        // Stream the scheduler is serving
+    RUDP_Stream streams[RUDP_MAX_STREAMS];
+
+    // Receive side
+    unsigned int rcv_nxt;       // Next in-order segment expected from the peer
+    unsigned int rcv_read;      // Oldest segment not yet handed to the application
+    RUDP_Segment *rcv_queue;    // RUDP_RCV_SEGS slots, indexed by seq % RUDP_RCV_SEGS
+    bool peer_fin;              // The peer's FIN arrived, it took sequence number rcv_nxt - 1
+    unsigned int rcv_adv_edge;  // Window right edge we last advertised
+
+    // ACK policy
+    unsigned int ack_every;     // ACK after this many unacknowledged in-order segments
+    unsigned int ack_delay_ms;  // Delayed-ACK timer
+    unsigned int ack_pending;   // In-order segments received since the last ACK
+    long long ack_deadline_us;  // When the delayed-ACK timer fires, 0 if no ACK is pending
+
+    // Forward error correction
+    unsigned int fec_k;         // Group size: requested before rudp_connect(), negotiated after
+    unsigned int fec_m;         // Max parity per group: requested before rudp_connect(), negotiated after
+    RUDP_FEC_State *fec;        // NULL unless FEC was negotiated
+
+    // Compression
+    bool compress;              // LZ payload compression: requested before rudp_connect(), negotiated after
+    bool compress_settled;      // The handshake decided compress, until then nothing is compressed
+    RUDP_LZ_State *lz;          // Compressor buffers, allocated with the first compressed chunk
+
+    // Low latency
+    unsigned int spin_us;       // rudp_poll() spins this long on non-blocking reads before it blocks, 0 = block at once
+    int spin_cpu;               // Core the spinning thread was pinned to, -1 = not pinned
+    bool busy_poll;             // The kernel took SO_BUSY_POLL on our sockets
+    unsigned int saved_ack_every;    // ACK policy in force before the mode was turned on, put back when it is turned off
+    unsigned int saved_ack_delay_ms;
+
+    // Payload checksum
+    bool no_checksum;           // Leave payloads to the UDP checksum: requested before rudp_connect(), negotiated after
+    unsigned short int (*payload_checksum)(void *data, unsigned int bytes); // Put in data headers, 0 once left to UDP
+    // Checked on receipt, true once left to UDP
+    bool (*payload_intact)(struct _rudp_socket *sockfd, const RUDP_Header *header, void *data, int bytes);
+
+    // Same-host path
+    bool shm_enabled;           // Offer or take shared-memory rings with a peer on this host, on unless turned off
+    RUDP_Shm_Region *shm;       // Rings offered or in use, NULL on UDP
+    int shm_fd;                 // Their memfd
+    int shm_side;               // RUDP_SHM_SERVER or RUDP_SHM_CLIENT: the rings we write, the doorbell we sleep on
+    bool shm_active;            // Data goes through the rings, the UDP socket only carries the handshake and the FINs
+    bool shm_peer_gone;         // The peer's process exited without closing
+    unsigned int shm_seen;      // Our doorbell when rudp_poll() last returned
+    unsigned int shm_left[RUDP_MAX_STREAMS];  // Bytes left of the record being read on each stream
+    unsigned int shm_flags[RUDP_MAX_STREAMS]; // Flags of that record
+
+    // Multipath
+    RUDP_Path paths[RUDP_MAX_PATHS];
+    unsigned int path_count;    // 1 until rudp_add_path() adds subflows or the client joins some
+    int ack_path;               // Subflow ACKs and other control packets go out on: the one data or a probe last came in on
+    unsigned int path_rr;       // Subflow socket rudp_poll() reads first next time, so a busy one cannot starve the others
+
+    RUDP_Session *session;      // NULL until a manifest is sent or received
+
+    // Kernel buffer sizing
+    int sockbuf_req;            // Buffer size last requested for SO_SNDBUF and SO_RCVBUF
+    long long rate_start_us;    // Start of the current delivery-rate sample, 0 if none
+    unsigned int rate_delivered; // Segments delivered since rate_start_us
+    double delivery_rate;       // Segments per second, a decaying max over the samples
+
+    // Teardown
+    bool closing;               // rudp_close() was called, the socket belongs to the teardown thread
+    bool fin_sent;              // Our FIN is out, it takes sequence number snd_nxt
+    bool fin_acked;             // The peer acknowledged our FIN
+    bool close_linger;          // We sent the last ACK of the exchange and wait in case it was lost
+    bool linger_restart;        // The peer resent its FIN, wait a full linger period again
+    unsigned int fin_transmissions;
+    long long close_start_us;
+    RUDP_Close_Callback close_callback;
+    void *close_arg;
+
+    RUDP_Stats stats;
 } RUDP_Socket;
 
 // Function prototypes
 RUDP_Socket *rudp_socket(bool isServer, unsigned short int listen_port);
 int rudp_connect(RUDP_Socket *sockfd, struct sockaddr_in *rcvr_addr, socklen_t rcvr_len,char *receiver_ip, unsigned short receiver_port);
 int rudp_accept(RUDP_Socket *sockfd,struct sockaddr_in *sndr_addr, socklen_t sndr_len,char *sender_ip, unsigned short sender_port);
-int rudp_send(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size);//need to add &receiver addr 
-int rudp_recv(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size);//need to add sndr addr 
+int rudp_send(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size);//need to add &receiver addr
+int rudp_recv(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size);//need to add sndr addr
 int rudp_recv_close(RUDP_Socket *sockfd,struct sockaddr_in *sndr_addr, socklen_t sndr_len,bool fin_recvd);
-int rudp_close(RUDP_Socket *sockfd);//need to implement
-int receive_acknowledgment(RUDP_Socket *sockfd);//need to delete 
+int rudp_close(RUDP_Socket *sockfd);
+int rudp_set_close_callback(RUDP_Socket *sockfd, RUDP_Close_Callback callback, void *arg);
+void rudp_wait_closed(void);
+int receive_acknowledgment(RUDP_Socket *sockfd);//need to delete
 int rudp_send_file(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size);//need to delete/update
 int receive_data_packet(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size, unsigned short int *checksum);
 int send_data_packet(RUDP_Socket *sockfd, char *data, size_t data_size, unsigned short int checksum);
 //int rudp_send_file_1(RUDP_Socket *sockfd, void *buffer, unsigned int buffer_size,char *receiver_ip, unsigned short receiver_port);
 int rudp_rcv_file_1(RUDP_Socket *sockfd, char *buffer, size_t buffer_size,struct sockaddr_in *sndr_addr,socklen_t sndr_len);
 int rudp_send_file_1(RUDP_Socket *sockfd, void *buffer, size_t buffer_size,char *receiver_ip, unsigned short receiver_port);
+int rudp_set_ack_policy(RUDP_Socket *sockfd, unsigned int ack_every, unsigned int ack_delay_ms);
+int rudp_get_stats(RUDP_Socket *sockfd, RUDP_Stats *stats);
+int rudp_set_fec(RUDP_Socket *sockfd, unsigned int k, unsigned int m);
+int rudp_set_compression(RUDP_Socket *sockfd, bool enable);
+int rudp_set_shared_memory(RUDP_Socket *sockfd, bool enable);
+int rudp_set_checksum(RUDP_Socket *sockfd, bool enable);
+int rudp_set_congestion(RUDP_Socket *sockfd, unsigned int initial_cwnd, bool fixed);
+int rudp_set_congestion_control(RUDP_Socket *sockfd, unsigned int initial_cwnd, const RUDP_Congestion *congestion);
+void rudp_reno_grow(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked);
+void rudp_reno_reduce(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout);
+int rudp_set_low_latency(RUDP_Socket *sockfd, unsigned int spin_us, int cpu);
+int rudp_queue_chunk(RUDP_Socket *sockfd, int stream_id, const struct iovec *iov, int iovcnt);
+int rudp_flush(RUDP_Socket *sockfd);
+int rudp_stream_send(RUDP_Socket *sockfd, int stream_id, const void *buffer, size_t buffer_size);
+int rudp_stream_recv(RUDP_Socket *sockfd, int *stream_id, char *buffer, size_t buffer_size);
+int rudp_set_stream_priority(RUDP_Socket *sockfd, int stream_id, int priority, unsigned int weight);
+int rudp_add_path(RUDP_Socket *sockfd, const char *local_ip, const char *remote_ip, unsigned short remote_port);
+int rudp_get_path_stats(RUDP_Socket *sockfd, unsigned int path, RUDP_Path_Stats *stats);
+RUDP_Group *rudp_group_open(bool isSender, const char *group_ip, unsigned short port, const char *local_ip);
+int rudp_group_set_rate(RUDP_Group *group, unsigned long bytes_per_second);
+int rudp_group_wait_members(RUDP_Group *group, unsigned int count, unsigned int timeout_ms);
+int rudp_group_send(RUDP_Group *group, const void *data, size_t size);
+int rudp_group_recv(RUDP_Group *group, char *buffer, size_t buffer_size);
+int rudp_group_get_stats(RUDP_Group *group, RUDP_Group_Stats *stats);
+int rudp_group_close(RUDP_Group *group);
+
+// Sessions (RUDP_Session.c)
+int rudp_session_manifest(RUDP_Socket *sockfd, const RUDP_File_Info *files, unsigned int count);
+int rudp_session_start_file(RUDP_Socket *sockfd, unsigned int file_id);
+int rudp_session_write(RUDP_Socket *sockfd, unsigned int file_id, const void *data, size_t size);
+int rudp_session_end_file(RUDP_Socket *sockfd, unsigned int file_id, int status);
+int rudp_session_finish(RUDP_Socket *sockfd);
+int rudp_session_file_state(RUDP_Socket *sockfd, unsigned int file_id);
+int rudp_session_recv(RUDP_Socket *sockfd, RUDP_Session_Event *event, char *buffer, size_t buffer_size);
+int rudp_session_set_checkpoint(RUDP_Socket *sockfd, const char *dir);
+int rudp_session_set_basis(RUDP_Socket *sockfd, unsigned int file_id, const void *basis, size_t size);
+int rudp_session_set_source(RUDP_Socket *sockfd, unsigned int file_id, const void *content, size_t size);
+int rudp_session_wait(RUDP_Socket *sockfd, unsigned int file_id);
+RUDP_Session *rudp_session_grow(RUDP_Socket *sockfd, unsigned int extra);
+int rudp_session_send_record(RUDP_Socket *sockfd, RUDP_Record *record, const void *payload);
+RUDP_File_Entry *rudp_session_file(RUDP_Socket *sockfd, unsigned int file_id, int state);
+void rudp_session_free(RUDP_Session *session);
+int rudp_session_prepare(RUDP_File_Entry *entry);
+bool rudp_session_resumable(const RUDP_File_Info *info);
+unsigned long long rudp_session_blocks(const RUDP_File_Info *info);
+unsigned long long rudp_session_stored_bytes(const RUDP_File_Entry *entry);
+bool rudp_session_stored(const RUDP_File_Entry *entry, unsigned long long offset);
+void rudp_session_skip_stored(RUDP_File_Entry *entry);
+void rudp_session_checkpoint_path(RUDP_Socket *sockfd, const RUDP_File_Info *info, char *path, size_t size);
+int rudp_session_load_checkpoint(RUDP_Socket *sockfd, RUDP_File_Entry *entry);
+int rudp_session_save_checkpoint(RUDP_Socket *sockfd, RUDP_File_Entry *entry);
+void rudp_session_commit(RUDP_Socket *sockfd, bool force);
+int rudp_session_send_resume(RUDP_Socket *sockfd, unsigned int file_id);
+int rudp_session_read_answer(RUDP_Socket *sockfd);
+int rudp_session_await_answers(RUDP_Socket *sockfd, RUDP_File_Entry *entry);
+int rudp_session_resume_record(RUDP_Session *session, RUDP_Record *record, const char *payload);
+int rudp_session_signature_record(RUDP_Session *session, RUDP_Record *record, const char *payload);
+int rudp_session_send_signature(RUDP_Socket *sockfd, unsigned int file_id);
+int rudp_session_index_basis(RUDP_Delta *delta);
+int rudp_session_emit(RUDP_Socket *sockfd, unsigned int file_id, const char *data, unsigned long long source, size_t size);
+int rudp_session_write_delta(RUDP_Socket *sockfd, unsigned int file_id, const char *data, size_t size);
+void rudp_session_hash(RUDP_File_Entry *entry, unsigned long long offset, const char *data, size_t size);
+int rudp_session_send_end(RUDP_Socket *sockfd, unsigned int file_id, int status);
+int rudp_session_check(RUDP_Socket *sockfd, unsigned int file_id, const char *root, size_t length);
+int rudp_session_verify_record(RUDP_Socket *sockfd, RUDP_Record *record, const char *payload);
+int rudp_session_repair(RUDP_Socket *sockfd, unsigned int file_id);
+
+// Multipath (RUDP_Multipath.c)
+void rudp_path_init(RUDP_Socket *sockfd, unsigned int path);
+int rudp_path_fd(RUDP_Socket *sockfd, unsigned int path);
+struct sockaddr_in *rudp_path_addr(RUDP_Socket *sockfd, unsigned int path);
+bool rudp_path_usable(RUDP_Socket *sockfd, unsigned int path);
+int rudp_control_path(RUDP_Socket *sockfd);
+int rudp_path_lookup(RUDP_Socket *sockfd, int fd, const struct sockaddr_in *from);
+int rudp_path_join(RUDP_Socket *sockfd, const RUDP_Header *header, const RUDP_Handshake *options,
+                   const struct sockaddr_in *from);
+void rudp_path_heard(RUDP_Socket *sockfd, int path, const RUDP_Header *header);
+int rudp_path_fds(RUDP_Socket *sockfd, fd_set *fds);
+int rudp_path_readable(RUDP_Socket *sockfd, fd_set *fds);
+void rudp_path_pipes(RUDP_Socket *sockfd, unsigned int *pipe);
+int rudp_path_pick(RUDP_Socket *sockfd, const unsigned int *pipe, int avoid);
+void rudp_path_delivered(RUDP_Socket *sockfd, RUDP_Segment *seg);
+void rudp_path_acked(RUDP_Socket *sockfd, long long now);
+void rudp_path_lost(RUDP_Socket *sockfd, RUDP_Segment *seg, long long now);
+void rudp_path_update_rtt(RUDP_Path *path, long long sample_us);
+long long rudp_path_rto(RUDP_Socket *sockfd);
+long long rudp_path_wake(RUDP_Socket *sockfd);
+int rudp_path_probe(RUDP_Socket *sockfd, unsigned int path);
+void rudp_path_timeout(RUDP_Socket *sockfd, unsigned int path, long long now);
+int rudp_path_timers(RUDP_Socket *sockfd);
+
+// Low latency (RUDP_Spin.c)
+void rudp_spin_socket(RUDP_Socket *sockfd, int fd);
+int rudp_spin(RUDP_Socket *sockfd, long long wake_us);
+
+// Distribution groups (RUDP_Multicast.c)
+void rudp_group_free_object(RUDP_Group *group);
+unsigned long long rudp_group_random(RUDP_Group *group, unsigned long long limit);
+int rudp_group_transmit(RUDP_Group *group, RUDP_Header *header, const void *payload, int payload_size,
+                        const struct sockaddr_in *to);
+int rudp_group_control(RUDP_Group *group, int flags, const struct sockaddr_in *to);
+int rudp_group_send_segment(RUDP_Group *group, unsigned int seq, bool repair);
+unsigned int rudp_group_next_repair(RUDP_Group *group);
+int rudp_group_member(RUDP_Group *group, unsigned long long id, const struct sockaddr_in *from);
+int rudp_group_process_nack(RUDP_Group *group, const RUDP_Header *header, const char *payload, int payload_size);
+int rudp_group_sender_packet(RUDP_Group *group, RUDP_Packet *packet, int length, const struct sockaddr_in *from);
+int rudp_group_start_object(RUDP_Group *group, const RUDP_Header *header);
+void rudp_group_gap(RUDP_Group *group, long long after_us);
+int rudp_group_send_nack(RUDP_Group *group, long long now);
+void rudp_group_suppress(RUDP_Group *group, const RUDP_Header *header, const char *payload, long long now);
+int rudp_group_receiver_packet(RUDP_Group *group, RUDP_Packet *packet, int length, const struct sockaddr_in *from);
+int rudp_group_poll(RUDP_Group *group, long long wake_us);
+int rudp_group_finish(RUDP_Group *group);
+
+// Helpers shared by the send and receive paths
+unsigned short int calculate_checksum(void *data, unsigned int bytes);
+long long rudp_now_us(void);
+unsigned long long rudp_siphash(const unsigned char *key, const unsigned char *data, size_t size);
+extern const unsigned char rudp_delta_key[16];
+void rudp_cookie_key_init(void);
+unsigned long long rudp_cookie(const struct sockaddr_in *peer, long long issued_us);
+bool rudp_cookie_valid(const struct sockaddr_in *peer, unsigned long long cookie);
+unsigned long long rudp_cookie_lookup(const struct sockaddr_in *peer);
+void rudp_cookie_store(const struct sockaddr_in *peer, unsigned long long cookie);
+int rudp_syn_ack(RUDP_Socket *sockfd, RUDP_Header *header, const RUDP_Handshake *options);
+int rudp_send_ack(RUDP_Socket *sockfd);
+ssize_t rudp_send_control(RUDP_Socket *sockfd, int flags, int path);
+int rudp_send_packet(RUDP_Socket *sockfd, int path, RUDP_Header *header, void *payload, int payload_size);
+void rudp_handshake_read(const RUDP_Header *header, char **payload, int *payload_size, RUDP_Handshake *options);
+void rudp_segment_header(RUDP_Socket *sockfd, RUDP_Segment *seg, RUDP_Header *header);
+int rudp_send_segment(RUDP_Socket *sockfd, RUDP_Segment *seg);
+int rudp_pump(RUDP_Socket *sockfd);
+void rudp_process_ack(RUDP_Socket *sockfd, RUDP_Header *header);
+unsigned long long rudp_sack_bitmap(RUDP_Socket *sockfd);
+void rudp_update_rtt(RUDP_Socket *sockfd, long long sample_us);
+void rudp_detect_losses(RUDP_Socket *sockfd);
+void rudp_arm_timers(RUDP_Socket *sockfd);
+int rudp_tail_loss_probe(RUDP_Socket *sockfd);
+unsigned int rudp_rcv_window(RUDP_Socket *sockfd);
+int rudp_window_update(RUDP_Socket *sockfd);
+int rudp_set_buffers(RUDP_Socket *sockfd, int bytes);
+void rudp_sample_rate(RUDP_Socket *sockfd, unsigned int delivered);
+int rudp_resize_buffers(RUDP_Socket *sockfd);
+int rudp_window_probe(RUDP_Socket *sockfd);
+void rudp_process_data(RUDP_Socket *sockfd, RUDP_Header *header, char *data, int data_size);
+void rudp_accept_segment(RUDP_Socket *sockfd, unsigned int seq, int flags, int stream, unsigned int stream_seq,
+                         char *data, int data_size);
+int rudp_schedule(RUDP_Socket *sockfd);
+RUDP_Segment *rudp_stream_next(RUDP_Socket *sockfd, int stream_id, unsigned int *seq);
+bool rudp_stream_ready(RUDP_Socket *sockfd, int stream_id, size_t room);
+void rudp_stream_append(RUDP_Socket *sockfd, int stream_id, RUDP_Segment *seg, int length, bool last);
+int rudp_segment_bytes(const RUDP_Segment *seg);
+int rudp_lz_gather(RUDP_Socket *sockfd, const struct iovec *iov, int iovcnt, size_t total);
+int rudp_lz_queue_chunk(RUDP_Socket *sockfd, int stream_id, const unsigned char *data, size_t size);
+void rudp_lz_job(void *arg);
+bool rudp_shm_local(const struct sockaddr_in *addr);
+void rudp_shm_offer(RUDP_Socket *sockfd);
+void rudp_shm_settle(RUDP_Socket *sockfd);
+void rudp_shm_take(RUDP_Socket *sockfd, const RUDP_Handshake *options, const struct sockaddr_in *peer);
+void rudp_shm_decline(RUDP_Socket *sockfd);
+bool rudp_shm_using(RUDP_Socket *sockfd, bool sending);
+bool rudp_shm_peer_closed(RUDP_Socket *sockfd);
+int rudp_shm_sleep(RUDP_Socket *sockfd, long long wake_us);
+int rudp_shm_queue_chunk(RUDP_Socket *sockfd, int stream_id, const struct iovec *iov, size_t total);
+bool rudp_shm_ready(RUDP_Socket *sockfd, int stream_id, size_t room);
+size_t rudp_shm_read(RUDP_Socket *sockfd, int stream_id, char *buffer, size_t buffer_size, bool *chunk_done);
+int rudp_shm_stream_recv(RUDP_Socket *sockfd, int *stream_id, char *buffer, size_t buffer_size);
+void rudp_shm_close(RUDP_Socket *sockfd);
+void rudp_fec_prefix(const RUDP_Segment *seg, unsigned char *prefix);
+void rudp_fec_negotiate(RUDP_Socket *sockfd, unsigned int peer_k, unsigned int peer_m);
+void rudp_lz_negotiate(RUDP_Socket *sockfd, bool peer_compress);
+void rudp_checksum_negotiate(RUDP_Socket *sockfd, bool peer_no_checksum);
+bool rudp_checksum_intact(RUDP_Socket *sockfd, const RUDP_Header *header, void *data, int bytes);
+unsigned short int rudp_checksum_none(void *data, unsigned int bytes);
+bool rudp_checksum_trusted(RUDP_Socket *sockfd, const RUDP_Header *header, void *data, int bytes);
+void rudp_fixed_grow(unsigned int *cwnd, unsigned int *cwnd_acked, unsigned int ssthresh, unsigned int acked);
+void rudp_fixed_reduce(unsigned int *cwnd, unsigned int *ssthresh, unsigned int flight, bool timeout);
+int rudp_fec_encode(RUDP_Socket *sockfd, RUDP_Segment *seg);
+bool rudp_rcv_has(RUDP_Socket *sockfd, unsigned int seq);
+void rudp_fec_process_parity(RUDP_Socket *sockfd, RUDP_Header *header, char *payload, int payload_size);
+int rudp_fec_try_decode(RUDP_Socket *sockfd, RUDP_FEC_Group *group);
+int rudp_fec_recommend(RUDP_Socket *sockfd);
+int rudp_retransmit_timeout(RUDP_Socket *sockfd);
+int rudp_poll(RUDP_Socket *sockfd, long long deadline_us);
+int rudp_wait_datagram(RUDP_Socket *sockfd, long long wake_us);
+int rudp_poll_datagram(RUDP_Socket *sockfd, int fd, struct msghdr *msg, ssize_t bytes_received);
+int rudp_send_fin(RUDP_Socket *sockfd);
+int rudp_process_fin(RUDP_Socket *sockfd, RUDP_Header *header);
+int rudp_teardown(RUDP_Socket *sockfd);
+void *rudp_close_thread(void *arg);
+void rudp_close_finish(RUDP_Socket *sockfd, int status);
+void rudp_free(RUDP_Socket *sockfd);
 #endif /* RUDP_SENDER_H */
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "RUDP_FEC.h"
+
+#define GF_POLY 0x11d // x^8 + x^4 + x^3 + x^2 + 1
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static unsigned char gf_mul_table[256][256]; // gf_mul_table[a][b] = a * b, one 256 byte row per coefficient
+static unsigned char fec_matrix[RUDP_FEC_MAX_M][RUDP_FEC_MAX_K];
+static bool gf_ready = false;
+
+void rudp_gf_init(void) {
+    if (gf_ready) {
+        return;
+    }
+
+    // Log/exp tables over the generator 2
+    unsigned int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = (unsigned char)x;
+        gf_log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= GF_POLY;
+        }
+    }
+    for (int i = 255; i < 512; i++) {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            gf_mul_table[a][b] = (a == 0 || b == 0) ? 0 : gf_exp[gf_log[a] + gf_log[b]];
+        }
+    }
+
+    // Cauchy matrix 1 / (x_j + y_i) with x_j = MAX_K + j and y_i = i, every column scaled so parity 0 is all ones.
+    // Scaling columns keeps every square submatrix non-singular, so the code stays MDS.
+    for (int i = 0; i < RUDP_FEC_MAX_K; i++) {
+        unsigned char first = rudp_gf_inv((unsigned char)(RUDP_FEC_MAX_K ^ i));
+        for (int j = 0; j < RUDP_FEC_MAX_M; j++) {
+            unsigned char c = rudp_gf_inv((unsigned char)((RUDP_FEC_MAX_K + j) ^ i));
+            fec_matrix[j][i] = gf_mul_table[c][rudp_gf_inv(first)];
+        }
+    }
+    gf_ready = true;
+}
+
+unsigned char rudp_gf_mul(unsigned char a, unsigned char b) {
+    return gf_mul_table[a][b];
+}
+
+unsigned char rudp_gf_inv(unsigned char a) {
+    if (a == 0) {
+        return 0; // No inverse, callers never ask for it
+    }
+    return gf_exp[255 - gf_log[a]];
+}
+
+void rudp_gf_mul_add(unsigned char *dst, const unsigned char *src, unsigned char coef, size_t len) {
+    if (coef == 0) {
+        return;
+    }
+    size_t i = 0;
+    if (coef == 1) {
+        // Plain XOR, eight bytes at a time
+        for (; i + 8 <= len; i += 8) {
+            uint64_t d, s;
+            memcpy(&d, dst + i, 8);
+            memcpy(&s, src + i, 8);
+            d ^= s;
+            memcpy(dst + i, &d, 8);
+        }
+        for (; i < len; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+
+    const unsigned char *row = gf_mul_table[coef];
+    for (; i + 4 <= len; i += 4) {
+        dst[i] ^= row[src[i]];
+        dst[i + 1] ^= row[src[i + 1]];
+        dst[i + 2] ^= row[src[i + 2]];
+        dst[i + 3] ^= row[src[i + 3]];
+    }
+    for (; i < len; i++) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+unsigned char rudp_fec_coef(int parity_index, int data_index) {
+    return fec_matrix[parity_index][data_index];
+}
+
+int rudp_fec_decode(int k, size_t symbol_size, unsigned char **data, const bool *present,
+                    unsigned char **parity, const int *parity_index, int parity_count) {
+    int missing[RUDP_FEC_MAX_M];
+    int erasures = 0;
+    for (int i = 0; i < k; i++) {
+        if (!present[i]) {
+            if (erasures == RUDP_FEC_MAX_M || erasures == parity_count) {
+                return -1; // More erasures than parity symbols
+            }
+            missing[erasures++] = i;
+        }
+    }
+    if (erasures == 0) {
+        return 0;
+    }
+
+    // Strip the known data out of the first `erasures` parity symbols
+    for (int r = 0; r < erasures; r++) {
+        for (int i = 0; i < k; i++) {
+            if (present[i]) {
+                rudp_gf_mul_add(parity[r], data[i], rudp_fec_coef(parity_index[r], i), symbol_size);
+            }
+        }
+    }
+
+    // Invert the erasures x erasures submatrix with Gauss-Jordan elimination
+    unsigned char a[RUDP_FEC_MAX_M][RUDP_FEC_MAX_M];
+    unsigned char inv[RUDP_FEC_MAX_M][RUDP_FEC_MAX_M];
+    for (int r = 0; r < erasures; r++) {
+        for (int c = 0; c < erasures; c++) {
+            a[r][c] = rudp_fec_coef(parity_index[r], missing[c]);
+            inv[r][c] = (r == c) ? 1 : 0;
+        }
+    }
+    for (int col = 0; col < erasures; col++) {
+        int pivot = col;
+        while (pivot < erasures && a[pivot][col] == 0) {
+            pivot++;
+        }
+        if (pivot == erasures) {
+            return -1; // Singular, cannot happen for distinct parity rows
+        }
+        if (pivot != col) {
+            for (int c = 0; c < erasures; c++) {
+                unsigned char t = a[col][c]; a[col][c] = a[pivot][c]; a[pivot][c] = t;
+                t = inv[col][c]; inv[col][c] = inv[pivot][c]; inv[pivot][c] = t;
+            }
+        }
+        unsigned char scale = rudp_gf_inv(a[col][col]);
+        for (int c = 0; c < erasures; c++) {
+            a[col][c] = rudp_gf_mul(a[col][c], scale);
+            inv[col][c] = rudp_gf_mul(inv[col][c], scale);
+        }
+        for (int r = 0; r < erasures; r++) {
+            unsigned char factor = a[r][col];
+            if (r == col || factor == 0) {
+                continue;
+            }
+            for (int c = 0; c < erasures; c++) {
+                a[r][c] ^= rudp_gf_mul(factor, a[col][c]);
+                inv[r][c] ^= rudp_gf_mul(factor, inv[col][c]);
+            }
+        }
+    }
+
+    // Each missing symbol is a combination of the reduced parity symbols
+    for (int c = 0; c < erasures; c++) {
+        unsigned char *out = data[missing[c]];
+        memset(out, 0, symbol_size);
+        for (int r = 0; r < erasures; r++) {
+            rudp_gf_mul_add(out, parity[r], inv[c][r], symbol_size);
+        }
+    }
+    return erasures;
+}
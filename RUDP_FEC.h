@@ -0,0 +1,37 @@
+#ifndef RUDP_FEC_H
+#define RUDP_FEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Limits for the systematic Reed-Solomon code: K data symbols, M parity symbols per group
+#define RUDP_FEC_MAX_K 32
+#define RUDP_FEC_MAX_M 8
+
+// Initialize the GF(256) log/exp and multiplication tables (idempotent)
+void rudp_gf_init(void);
+unsigned char rudp_gf_mul(unsigned char a, unsigned char b);
+unsigned char rudp_gf_inv(unsigned char a);
+
+// dst[i] ^= coef * src[i] for len bytes, table-driven with a word-wide XOR path for coef 1
+void rudp_gf_mul_add(unsigned char *dst, const unsigned char *src, unsigned char coef, size_t len);
+
+// Coefficient of data symbol data_index in parity symbol parity_index.
+// Normalized Cauchy matrix: parity 0 is the plain XOR of the group, any M rows stay invertible.
+unsigned char rudp_fec_coef(int parity_index, int data_index);
+
+/*
+* @brief Rebuild missing data symbols of a group from the present data and parity symbols.
+* @param k Data symbols in the group.
+* @param symbol_size Bytes per symbol, data symbols are zero padded to it.
+* @param data k symbol buffers, the missing ones are overwritten with the recovered data.
+* @param present Which data symbols were received.
+* @param parity Received parity symbols, used as scratch space and clobbered.
+* @param parity_index Parity row of each received parity symbol.
+* @param parity_count Number of received parity symbols.
+* @return Number of recovered symbols, -1 if there are more erasures than parity symbols.
+*/
+int rudp_fec_decode(int k, size_t symbol_size, unsigned char **data, const bool *present,
+                    unsigned char **parity, const int *parity_index, int parity_count);
+
+#endif /* RUDP_FEC_H */
@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "RUDP_Hash.h"
+#include "RUDP_Pool.h"
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define MERKLE_BATCH 64 // Leaves handed to the worker pool at once
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_block(unsigned int *state, const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+               (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void rudp_sha256_init(RUDP_SHA256 *ctx) {
+    static const unsigned int iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void rudp_sha256_update(RUDP_SHA256 *ctx, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    ctx->length += size;
+    if (ctx->used > 0) {
+        size_t take = 64 - ctx->used < size ? 64 - ctx->used : size;
+        memcpy(ctx->block + ctx->used, bytes, take);
+        ctx->used += take;
+        bytes += take;
+        size -= take;
+        if (ctx->used < 64) {
+            return;
+        }
+        sha256_block(ctx->state, ctx->block);
+        ctx->used = 0;
+    }
+    // Whole blocks straight from the input
+    for (; size >= 64; bytes += 64, size -= 64) {
+        sha256_block(ctx->state, bytes);
+    }
+    memcpy(ctx->block, bytes, size);
+    ctx->used = size;
+}
+
+void rudp_sha256_final(RUDP_SHA256 *ctx, unsigned char *digest) {
+    unsigned long long bits = ctx->length * 8;
+    ctx->block[ctx->used++] = 0x80;
+    if (ctx->used > 56) {
+        memset(ctx->block + ctx->used, 0, 64 - ctx->used);
+        sha256_block(ctx->state, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block + ctx->used, 0, 56 - ctx->used);
+    for (int i = 0; i < 8; i++) {
+        ctx->block[63 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    sha256_block(ctx->state, ctx->block);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+void rudp_sha256(const void *data, size_t size, unsigned char *digest) {
+    RUDP_SHA256 ctx;
+    rudp_sha256_init(&ctx);
+    rudp_sha256_update(&ctx, data, size);
+    rudp_sha256_final(&ctx, digest);
+}
+
+unsigned int rudp_weak_sum(const unsigned char *data, size_t size) {
+    // Eight independent lanes with no carried dependency, so the loop maps onto vector adds and multiplies.
+    // The sums may wrap, only their low 16 bits count.
+    uint32_t a[8] = {0}, b[8] = {0};
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint32_t weight = (uint32_t)(size - i);
+        for (int lane = 0; lane < 8; lane++) {
+            a[lane] += data[i + lane];
+            b[lane] += (weight - (uint32_t)lane) * data[i + lane];
+        }
+    }
+    uint32_t sum_a = 0, sum_b = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        sum_a += a[lane];
+        sum_b += b[lane];
+    }
+    for (; i < size; i++) {
+        sum_a += data[i];
+        sum_b += (uint32_t)(size - i) * data[i];
+    }
+    return (sum_b & 0xffff) << 16 | (sum_a & 0xffff);
+}
+
+// A leaf context: feed it the leaf's data, then finish it with rudp_sha256_final()
+void rudp_merkle_leaf_init(RUDP_SHA256 *ctx) {
+    static const unsigned char prefix = 0x00;
+    rudp_sha256_init(ctx);
+    rudp_sha256_update(ctx, &prefix, 1);
+}
+
+void rudp_merkle_node(const unsigned char *left, const unsigned char *right, unsigned char *node) {
+    static const unsigned char prefix = 0x01;
+    RUDP_SHA256 ctx;
+    rudp_sha256_init(&ctx);
+    rudp_sha256_update(&ctx, &prefix, 1);
+    rudp_sha256_update(&ctx, left, RUDP_HASH_SIZE);
+    rudp_sha256_update(&ctx, right, RUDP_HASH_SIZE);
+    rudp_sha256_final(&ctx, node);
+}
+
+void rudp_merkle_root(const unsigned char (*hashes)[RUDP_HASH_SIZE], size_t count, unsigned char *root) {
+    if (count == 0) {
+        rudp_sha256(NULL, 0, root);
+        return;
+    }
+    if (count == 1) {
+        memcpy(root, hashes[0], RUDP_HASH_SIZE);
+        return;
+    }
+    size_t split = 1;
+    while (split * 2 < count) {
+        split *= 2;
+    }
+    unsigned char left[RUDP_HASH_SIZE], right[RUDP_HASH_SIZE];
+    rudp_merkle_root(hashes, split, left);
+    rudp_merkle_root(hashes + split, count - split, right);
+    rudp_merkle_node(left, right, root);
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    unsigned char *leaf;
+} Merkle_Job;
+
+static void merkle_leaf_job(void *arg) {
+    Merkle_Job *job = (Merkle_Job *)arg;
+    RUDP_SHA256 ctx;
+    rudp_merkle_leaf_init(&ctx);
+    rudp_sha256_update(&ctx, job->data, job->size);
+    rudp_sha256_final(&ctx, job->leaf);
+}
+
+void rudp_merkle_leaves(const unsigned char *data, size_t size, size_t leaf_size, unsigned char (*leaves)[RUDP_HASH_SIZE]) {
+    Merkle_Job jobs[MERKLE_BATCH];
+    size_t offset = 0;
+    size_t leaf = 0;
+    while (offset < size) {
+        int count = 0;
+        for (; count < MERKLE_BATCH && offset < size; count++, leaf++) {
+            jobs[count].data = data + offset;
+            jobs[count].size = size - offset < leaf_size ? size - offset : leaf_size;
+            jobs[count].leaf = leaves[leaf];
+            offset += jobs[count].size;
+        }
+        rudp_parallel(merkle_leaf_job, jobs, sizeof(Merkle_Job), count);
+    }
+}
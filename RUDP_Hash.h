@@ -0,0 +1,42 @@
+#ifndef RUDP_HASH_H
+#define RUDP_HASH_H
+
+#include <stddef.h>
+
+#define RUDP_HASH_SIZE 32 // SHA-256 digest bytes
+
+// Incremental SHA-256 (FIPS 180-4)
+typedef struct {
+    unsigned int state[8];
+    unsigned long long length;  // Bytes hashed so far
+    unsigned char block[64];    // Partial input block
+    size_t used;                // Bytes in block
+} RUDP_SHA256;
+
+void rudp_sha256_init(RUDP_SHA256 *ctx);
+void rudp_sha256_update(RUDP_SHA256 *ctx, const void *data, size_t size);
+void rudp_sha256_final(RUDP_SHA256 *ctx, unsigned char *digest);
+
+// One-shot digest of a buffer
+void rudp_sha256(const void *data, size_t size, unsigned char *digest);
+
+// rsync's weak checksum: a = sum of the bytes, b = sum of (size - i) * byte i, both mod 2^16, packed b << 16 | a
+unsigned int rudp_weak_sum(const unsigned char *data, size_t size);
+
+// Slide a window of size bytes one byte on: drop out, take in
+static inline unsigned int rudp_weak_roll(unsigned int sum, unsigned char out, unsigned char in, size_t size) {
+    unsigned int a = (sum - out + in) & 0xffff;
+    unsigned int b = ((sum >> 16) - (unsigned int)size * out + a) & 0xffff;
+    return b << 16 | a;
+}
+
+// Merkle tree as in RFC 6962: leaf = SHA-256(0x00 || data), node = SHA-256(0x01 || left || right), the left
+// subtree of n entries the largest power of two below n. The tree of no entries is SHA-256 of nothing.
+void rudp_merkle_leaf_init(RUDP_SHA256 *ctx);
+void rudp_merkle_node(const unsigned char *left, const unsigned char *right, unsigned char *node);
+void rudp_merkle_root(const unsigned char (*hashes)[RUDP_HASH_SIZE], size_t count, unsigned char *root);
+
+// Leaf hashes of data cut into leaf_size pieces, the last one possibly shorter, computed on the worker threads
+void rudp_merkle_leaves(const unsigned char *data, size_t size, size_t leaf_size, unsigned char (*leaves)[RUDP_HASH_SIZE]);
+
+#endif /* RUDP_HASH_H */
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "RUDP_API.h" // Only for rudp_now_us(), so delays run on the protocol timers' clock
+
+// Impairment emulator: a UDP relay between one client and one server that drops, delays and rate-limits
+// datagrams like a link would, and can take the link down for a while. One relay per address pair turns
+// a single machine into several paths of different quality, to try multipath transfers against.
+
+#define IMPAIR_QUEUE 256      // Datagrams a direction buffers, a full queue drops the newest like a router
+#define IMPAIR_MAX_DGRAM 65536
+
+typedef struct {
+    long long due_us;         // When it leaves the relay
+    int length;
+    char data[IMPAIR_MAX_DGRAM];
+} Impair_Dgram;
+
+// One direction of the link
+typedef struct {
+    Impair_Dgram *queue;
+    unsigned int head;
+    unsigned int count;
+    long long free_us;        // When the link finishes sending what is queued, for the rate limit
+    unsigned long forwarded;
+    unsigned long dropped;    // Lost at random, on a full queue or while the link is down
+} Impair_Direction;
+
+static volatile sig_atomic_t impair_stop = 0;
+
+void impair_signal(int sig) {
+    (void)sig;
+    impair_stop = 1;
+}
+
+int impair_parse_addr(const char *text, struct sockaddr_in *addr) {
+    char ip[64];
+    unsigned int port;
+    if (sscanf(text, "%63[^:]:%u", ip, &port) != 2 || port == 0 || port > 65535) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((unsigned short)port);
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 ? 1 : -1;
+}
+
+/*
+* @brief Take a datagram into a direction, or drop it.
+* @param delay_us Fixed one-way delay.
+* @param rate Bytes per second the link carries, 0 for no limit.
+*/
+void impair_enqueue(Impair_Direction *dir, const char *data, int length, double loss, long long delay_us,
+                    double rate, bool down) {
+    if (down || (loss > 0 && rand() < loss * RAND_MAX) || dir->count == IMPAIR_QUEUE) {
+        dir->dropped++;
+        return;
+    }
+    long long now = rudp_now_us();
+    long long start = dir->free_us > now ? dir->free_us : now;
+    long long send_us = rate > 0 ? (long long)(length * 1000000.0 / rate) : 0;
+    dir->free_us = start + send_us;
+
+    Impair_Dgram *dgram = &dir->queue[(dir->head + dir->count) % IMPAIR_QUEUE];
+    dgram->due_us = dir->free_us + delay_us;
+    dgram->length = length;
+    memcpy(dgram->data, data, length);
+    dir->count++;
+}
+
+// Send every datagram that is due, return when the next one is, 0 if the direction is empty
+long long impair_release(Impair_Direction *dir, int fd, const struct sockaddr_in *to, bool have_to) {
+    long long now = rudp_now_us();
+    while (dir->count > 0 && dir->queue[dir->head].due_us <= now) {
+        Impair_Dgram *dgram = &dir->queue[dir->head];
+        if (have_to && sendto(fd, dgram->data, dgram->length, 0, (const struct sockaddr *)to, sizeof(*to)) >= 0) {
+            dir->forwarded++;
+        } else {
+            dir->dropped++;
+        }
+        dir->head = (dir->head + 1) % IMPAIR_QUEUE;
+        dir->count--;
+    }
+    return dir->count > 0 ? dir->queue[dir->head].due_us : 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in listen_addr, server_addr, client_addr;
+    bool have_listen = false, have_server = false, have_client = false;
+    double loss = 0, rate = 0;
+    long long delay_us = 0;
+    double down_from = -1, down_until = -1; // Seconds after start, the link drops everything in between
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-listen") == 0 && i + 1 < argc) {
+            have_listen = impair_parse_addr(argv[++i], &listen_addr) > 0;
+        } else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc) {
+            have_server = impair_parse_addr(argv[++i], &server_addr) > 0;
+        } else if (strcmp(argv[i], "-loss") == 0 && i + 1 < argc) {
+            loss = atof(argv[++i]) / 100;
+        } else if (strcmp(argv[i], "-delay") == 0 && i + 1 < argc) {
+            delay_us = (long long)(atof(argv[++i]) * 1000);
+        } else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) {
+            rate = atof(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "-down") == 0 && i + 1 < argc &&
+                   sscanf(argv[i + 1], "%lf,%lf", &down_from, &down_until) >= 1) {
+            i++;
+        } else {
+            have_listen = false;
+            break;
+        }
+    }
+    if (!have_listen || !have_server) {
+        fprintf(stderr, "Usage: %s -listen <IP>:<PORT> -to <IP>:<PORT> [-loss <percent>] [-delay <ms>] "
+                        "[-rate <KB/s>] [-down <from s>[,<until s>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The client talks to front, the server sees the relay as back
+    int front = socket(AF_INET, SOCK_DGRAM, 0);
+    int back = socket(AF_INET, SOCK_DGRAM, 0);
+    if (front < 0 || back < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    if (bind(front, (struct sockaddr *)&listen_addr, sizeof(listen_addr)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    int bytes = 4 * 1024 * 1024;
+    setsockopt(front, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+    setsockopt(back, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+
+    Impair_Direction up, down;
+    memset(&up, 0, sizeof(up));
+    memset(&down, 0, sizeof(down));
+    up.queue = (Impair_Dgram *)malloc(IMPAIR_QUEUE * sizeof(Impair_Dgram));
+    down.queue = (Impair_Dgram *)malloc(IMPAIR_QUEUE * sizeof(Impair_Dgram));
+    char *buffer = (char *)malloc(IMPAIR_MAX_DGRAM);
+    if (up.queue == NULL || down.queue == NULL || buffer == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, impair_signal);
+    signal(SIGTERM, impair_signal);
+    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+    printf("relaying %s:%u", inet_ntoa(listen_addr.sin_addr), ntohs(listen_addr.sin_port));
+    printf(" -> %s:%u, loss %.1f%%, delay %lld ms, rate %.0f KB/s\n", inet_ntoa(server_addr.sin_addr),
+           ntohs(server_addr.sin_port), loss * 100, delay_us / 1000, rate / 1024);
+    fflush(stdout);
+
+    long long start_us = rudp_now_us();
+    bool was_down = false;
+    while (!impair_stop) {
+        double elapsed = (rudp_now_us() - start_us) / 1000000.0;
+        bool is_down = down_from >= 0 && elapsed >= down_from && (down_until < 0 || elapsed < down_until);
+        if (is_down != was_down) {
+            printf(is_down ? "link down\n" : "link up\n");
+            fflush(stdout);
+            was_down = is_down;
+        }
+
+        long long next_us = impair_release(&up, back, &server_addr, true);
+        long long next_down_us = impair_release(&down, front, &client_addr, have_client);
+        if (next_us == 0 || (next_down_us != 0 && next_down_us < next_us)) {
+            next_us = next_down_us;
+        }
+        long long wait_us = next_us != 0 ? next_us - rudp_now_us() : 100000;
+        if (wait_us > 100000) {
+            wait_us = 100000; // Look at the clock now and then for -down
+        }
+        if (wait_us < 0) {
+            wait_us = 0;
+        }
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(front, &fds);
+        FD_SET(back, &fds);
+        struct timeval timeout;
+        timeout.tv_sec = wait_us / 1000000;
+        timeout.tv_usec = wait_us % 1000000;
+        int ready = select((front > back ? front : back) + 1, &fds, NULL, NULL, &timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            break;
+        }
+        if (ready > 0 && FD_ISSET(front, &fds)) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t length = recvfrom(front, buffer, IMPAIR_MAX_DGRAM, 0, (struct sockaddr *)&from, &from_len);
+            if (length >= 0) {
+                client_addr = from; // Answers go to whoever spoke last
+                have_client = true;
+                impair_enqueue(&up, buffer, (int)length, loss, delay_us, rate, is_down);
+            }
+        }
+        if (ready > 0 && FD_ISSET(back, &fds)) {
+            ssize_t length = recv(back, buffer, IMPAIR_MAX_DGRAM, 0);
+            if (length >= 0) {
+                impair_enqueue(&down, buffer, (int)length, loss, delay_us, rate, is_down);
+            }
+        }
+    }
+
+    printf("client to server: %lu forwarded, %lu dropped\n", up.forwarded, up.dropped);
+    printf("server to client: %lu forwarded, %lu dropped\n", down.forwarded, down.dropped);
+    free(up.queue);
+    free(down.queue);
+    free(buffer);
+    close(front);
+    close(back);
+    return EXIT_SUCCESS;
+}
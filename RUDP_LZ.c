@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "RUDP_LZ.h"
+
+#define LZ_SKIP_TRIGGER 6 // Misses in a row double the search step every 2^6 bytes, so random data is skipped quickly
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned int lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - RUDP_LZ_HASH_BITS);
+}
+
+// Bytes a length of at least 15 needs after its nibble
+static int lz_extra(int length) {
+    return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+static int lz_put_length(unsigned char *dst, int length) {
+    int n = 0;
+    for (length -= 15; length >= 255; length -= 255) {
+        dst[n++] = 255;
+    }
+    dst[n++] = (unsigned char)length;
+    return n;
+}
+
+int rudp_lz_compress(const unsigned char *src, int src_size, unsigned char *dst, int dst_capacity, int *consumed) {
+    unsigned short table[1 << RUDP_LZ_HASH_BITS]; // Position + 1 of the last 4 bytes with each hash, 0 if none
+    memset(table, 0, sizeof(table));
+    int ip = 0, anchor = 0, op = 0;
+    int misses = 0;
+
+    while (ip + RUDP_LZ_MIN_MATCH <= src_size) {
+        uint32_t seq = lz_read32(src + ip);
+        unsigned int h = lz_hash(seq);
+        int ref = (int)table[h] - 1;
+        table[h] = (unsigned short)(ip + 1);
+        if (ref < 0 || lz_read32(src + ref) != seq) {
+            ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+            continue;
+        }
+        misses = 0;
+        int length = RUDP_LZ_MIN_MATCH;
+        while (ip + length < src_size && src[ref + length] == src[ip + length]) {
+            length++;
+        }
+
+        // Emit only if the sequence leaves room for the closing literal-only token
+        int literals = ip - anchor;
+        int need = 1 + lz_extra(literals) + literals + 2 + lz_extra(length - RUDP_LZ_MIN_MATCH);
+        if (op + need + 1 > dst_capacity) {
+            break;
+        }
+        unsigned char *token = &dst[op++];
+        *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15) {
+            op += lz_put_length(dst + op, literals);
+        }
+        memcpy(dst + op, src + anchor, literals);
+        op += literals;
+        int offset = ip - ref;
+        dst[op++] = (unsigned char)(offset & 0xff);
+        dst[op++] = (unsigned char)(offset >> 8);
+        int match = length - RUDP_LZ_MIN_MATCH;
+        *token |= (unsigned char)(match < 15 ? match : 15);
+        if (match >= 15) {
+            op += lz_put_length(dst + op, match);
+        }
+        ip += length;
+        anchor = ip;
+    }
+
+    if (op + 1 > dst_capacity) {
+        *consumed = 0; // Not even a token fits, callers always leave more room than that
+        return 0;
+    }
+    // Closing sequence: as many of the remaining bytes as fit, as literals
+    int literals = src_size - anchor;
+    while (literals > 0 && op + 1 + lz_extra(literals) + literals > dst_capacity) {
+        literals -= op + 1 + lz_extra(literals) + literals - dst_capacity;
+    }
+    if (literals < 0) {
+        literals = 0;
+    }
+    dst[op++] = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) {
+        op += lz_put_length(dst + op, literals);
+    }
+    memcpy(dst + op, src + anchor, literals);
+    op += literals;
+    *consumed = anchor + literals;
+    return op;
+}
+
+int rudp_lz_decompress(const unsigned char *src, int src_size, unsigned char *dst, int dst_size) {
+    int ip = 0, op = 0;
+    while (ip < src_size) {
+        int token = src[ip++];
+        int literals = token >> 4;
+        if (literals == 15) {
+            int b;
+            do {
+                if (ip >= src_size) {
+                    return -1;
+                }
+                b = src[ip++];
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > src_size - ip || literals > dst_size - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == src_size) {
+            break; // The closing sequence has no match
+        }
+
+        if (src_size - ip < 2) {
+            return -1;
+        }
+        int offset = src[ip] | src[ip + 1] << 8;
+        ip += 2;
+        int length = token & 15;
+        if (length == 15) {
+            int b;
+            do {
+                if (ip >= src_size) {
+                    return -1;
+                }
+                b = src[ip++];
+                length += b;
+            } while (b == 255);
+        }
+        length += RUDP_LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || length > dst_size - op) {
+            return -1;
+        }
+        // Byte by byte, a match may overlap its own output
+        const unsigned char *ref = dst + op - offset;
+        for (int i = 0; i < length; i++) {
+            dst[op + i] = ref[i];
+        }
+        op += length;
+    }
+    return op == dst_size ? op : -1;
+}
@@ -0,0 +1,25 @@
+#ifndef RUDP_LZ_H
+#define RUDP_LZ_H
+
+#include <stddef.h>
+
+// LZ77 in LZ4's sequence format: a token with 4-bit literal and match lengths, the literals, a 16-bit offset,
+// 255-continued length bytes. Inputs are at most RUDP_LZ_MAX_INPUT bytes, so offsets always fit.
+#define RUDP_LZ_MIN_MATCH 4
+#define RUDP_LZ_MAX_INPUT 32767
+#define RUDP_LZ_HASH_BITS 12
+
+/*
+* @brief Compress a prefix of src that fits in dst_capacity bytes.
+* @param consumed Set to the number of input bytes the output covers, always the whole input if it fits.
+* @return Bytes written to dst.
+*/
+int rudp_lz_compress(const unsigned char *src, int src_size, unsigned char *dst, int dst_capacity, int *consumed);
+
+/*
+* @brief Decompress a whole block.
+* @return Bytes written to dst, -1 if the block is malformed or does not decode to exactly dst_size bytes.
+*/
+int rudp_lz_decompress(const unsigned char *src, int src_size, unsigned char *dst, int dst_size);
+
+#endif /* RUDP_LZ_H */
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#include "RUDP_API.h" // Include the RUDP API header file
+
+// Round-trip latency of small messages: the client sends a message, the server echoes it, the client times the
+// round trip. Run the server with -server, then the client against it; -spin and -cpu turn on the low-latency mode.
+// Peers on one host otherwise talk through shared-memory rings, which never reach the socket reads -spin busy-polls,
+// so -spin implies -udp on whichever end it is given to.
+#define DEFAULT_IP "127.0.0.1"
+#define DEFAULT_PORT 4567
+#define DEFAULT_COUNT 10000 // Timed round trips
+#define DEFAULT_SIZE 64     // Message size in bytes
+#define MAX_SIZE 65536
+#define WARMUP_DIVISOR 10   // Untimed round trips first, a tenth of the timed ones
+#define USAGE "Usage: %s -p <PORT> [-server | -ip <IP>] [-n <COUNT>] [-size <BYTES>] [-spin <US>] [-cpu <CORE>] " \
+              "[-udp]\n"
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Read until a whole message of size bytes is in, 0 if the peer closed first
+static int recv_message(RUDP_Socket *sockfd, char *buffer, int size) {
+    int got = 0;
+    while (got < size) {
+        int stream_id = RUDP_ANY_STREAM;
+        int bytes = rudp_stream_recv(sockfd, &stream_id, buffer + got, size - got);
+        if (bytes <= 0) {
+            return bytes;
+        }
+        got += bytes;
+    }
+    return got;
+}
+
+static void print_spin_stats(RUDP_Socket *sockfd) {
+    RUDP_Stats stats;
+    rudp_get_stats(sockfd, &stats);
+    printf("- Spins: %lu found a datagram, %lu fell back to blocking; SO_BUSY_POLL %s\n", stats.spin_hits,
+           stats.spin_misses, sockfd->busy_poll ? "on" : "off");
+}
+
+/*
+* @brief Echo every message back until the client closes.
+* @return EXIT_SUCCESS or EXIT_FAILURE.
+*/
+int serve(unsigned short port, int size, unsigned int spin_us, int cpu, bool shared_memory) {
+    RUDP_Socket *sockfd = rudp_socket(true, port);
+    if (sockfd == NULL) {
+        fprintf(stderr, "Error: Failed to create UDP socket\n");
+        return EXIT_FAILURE;
+    }
+    rudp_set_shared_memory(sockfd, shared_memory);
+    if (rudp_set_low_latency(sockfd, spin_us, cpu) < 0) {
+        fprintf(stderr, "Error: Failed to set the low-latency mode\n");
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
+    struct sockaddr_in sender_addr;
+    memset(&sender_addr, 0, sizeof(sender_addr));
+    if (rudp_accept(sockfd, &sender_addr, sizeof(sender_addr), NULL, 0) == 0) {
+        fprintf(stderr, "Error: Failed to accept connection\n");
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
+
+    char *buffer = (char *)malloc(size);
+    unsigned long echoed = 0;
+    int bytes;
+    while (buffer != NULL && (bytes = recv_message(sockfd, buffer, size)) > 0) {
+        if (rudp_stream_send(sockfd, 0, buffer, bytes) < 0) {
+            break;
+        }
+        echoed++;
+    }
+    printf("echoed %lu messages\n", echoed);
+    print_spin_stats(sockfd);
+    free(buffer);
+    rudp_close(sockfd);
+    rudp_wait_closed();
+    return EXIT_SUCCESS;
+}
+
+/*
+* @brief Time count round trips of size-byte messages after a warm-up, and print the latency distribution.
+* @return EXIT_SUCCESS or EXIT_FAILURE.
+*/
+int ping(const char *ip, unsigned short port, int count, int size, unsigned int spin_us, int cpu,
+         bool shared_memory) {
+    struct sockaddr_in receiver_addr;
+    memset(&receiver_addr, 0, sizeof(receiver_addr));
+    receiver_addr.sin_family = AF_INET;
+    receiver_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &receiver_addr.sin_addr) <= 0) {
+        perror("inet_pton");
+        return EXIT_FAILURE;
+    }
+    RUDP_Socket *sockfd = rudp_socket(false, port);
+    if (sockfd == NULL) {
+        fprintf(stderr, "Error: Failed to create UDP socket\n");
+        return EXIT_FAILURE;
+    }
+    rudp_set_shared_memory(sockfd, shared_memory);
+    if (rudp_set_low_latency(sockfd, spin_us, cpu) < 0) {
+        fprintf(stderr, "Error: Failed to set the low-latency mode\n");
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
+    if (rudp_connect(sockfd, &receiver_addr, sizeof(receiver_addr), (char *)ip, port) == 0) {
+        fprintf(stderr, "Error: Failed to connect to the server\n");
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
+
+    char *message = (char *)malloc(size);
+    char *reply = (char *)malloc(size);
+    long long *rtt_ns = (long long *)malloc(count * sizeof(long long));
+    if (message == NULL || reply == NULL || rtt_ns == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(message);
+        free(reply);
+        free(rtt_ns);
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < size; i++) {
+        message[i] = (char)(i * 31 + 7);
+    }
+
+    int warmup = count / WARMUP_DIVISOR;
+    int status = EXIT_SUCCESS;
+    for (int i = -warmup; i < count; i++) {
+        long long start_ns = now_ns();
+        if (rudp_stream_send(sockfd, 0, message, size) < 0 || recv_message(sockfd, reply, size) != size) {
+            fprintf(stderr, "Error: Round trip %d failed\n", i);
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (i >= 0) {
+            rtt_ns[i] = now_ns() - start_ns;
+        }
+    }
+
+    if (status == EXIT_SUCCESS) {
+        qsort(rtt_ns, count, sizeof(long long), compare_ns);
+        long long total_ns = 0;
+        for (int i = 0; i < count; i++) {
+            total_ns += rtt_ns[i];
+        }
+        printf("----------------------------------\n");
+        printf("- %d round trips of %d bytes, spin %uus%s\n", count, size, spin_us,
+               cpu >= 0 ? ", pinned" : "");
+        printf("- RTT p50: %.1fus; p99: %.1fus; p99.9: %.1fus; max: %.1fus; mean: %.1fus\n",
+               rtt_ns[count / 2] / 1000.0, rtt_ns[(long long)count * 99 / 100] / 1000.0,
+               rtt_ns[(long long)count * 999 / 1000] / 1000.0, rtt_ns[count - 1] / 1000.0,
+               (double)total_ns / count / 1000.0);
+        print_spin_stats(sockfd);
+        printf("----------------------------------\n");
+    }
+    free(message);
+    free(reply);
+    free(rtt_ns);
+    rudp_close(sockfd);
+    rudp_wait_closed();
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    char *ip = DEFAULT_IP;
+    unsigned short port = DEFAULT_PORT;
+    bool server = false, have_port = false;
+    int count = DEFAULT_COUNT, size = DEFAULT_SIZE, cpu = -1;
+    unsigned int spin_us = 0;
+    bool shared_memory = true;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+            have_port = true;
+        } else if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc) {
+            ip = argv[++i];
+        } else if (strcmp(argv[i], "-server") == 0) {
+            server = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-spin") == 0 && i + 1 < argc) {
+            spin_us = (unsigned int)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-udp") == 0) {
+            shared_memory = false;
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!have_port || port == 0 || count <= 0 || size <= 0 || size > MAX_SIZE) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (spin_us > 0) {
+        shared_memory = false; // Spinning only pays off on the socket path
+    }
+
+    // The server echoes messages of -size bytes, both ends need the same one
+    return server ? serve(port, size, spin_us, cpu, shared_memory)
+                  : ping(ip, port, count, size, spin_us, cpu, shared_memory);
+}
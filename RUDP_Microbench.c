@@ -0,0 +1,484 @@
+#define _GNU_SOURCE // sched_setaffinity() and sched_getcpu()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "RUDP_API.h" // Include the RUDP API header file
+
+// Timing harness for the routines every packet goes through. Each kernel is warmed up, sized to run about
+// RUN_MS, timed RUNS times on one pinned core and reported as the median, one tab-separated line per kernel,
+// payload size and loss pattern, so the output of two builds can be diffed. Lines starting with # are metadata.
+// The makefile links it with malloc/calloc/realloc counted and sendto/sendmsg swallowed (see BENCH_WRAP),
+// so the ACKs and retransmissions the kernels trigger are counted, not timed.
+#define RUNS 7          // Timed runs per case, the median is reported
+#define RUN_MS 20       // Length of one timed run
+#define BATCH RUDP_WINDOW // Segments per window in the reassembly and ACK kernels
+#define RNG_SEED 0x9e3779b97f4a7c15ULL // Every run sees the same loss and reorder patterns
+#define USAGE "Usage: %s [-cpu <CORE>] [-runs <N>] [-kernel <NAME>]\n"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_COUNTER "tsc"
+#define bench_cycles() __rdtsc()
+#else
+#define BENCH_COUNTER "ns" // No cycle counter user space can read everywhere, cycles are nanoseconds
+#define bench_cycles() ((unsigned long long)bench_ns())
+#endif
+
+// Arrival patterns of a window of segments
+enum { PATTERN_NONE, PATTERN_LOSS1, PATTERN_LOSS5, PATTERN_BURST, PATTERN_REORDER, PATTERN_COUNT };
+static const char *pattern_names[PATTERN_COUNT] = {"none", "loss1", "loss5", "burst8", "reorder"};
+
+// What a run measured, only counted between bench_start() and bench_stop()
+typedef struct {
+    unsigned long long cycles;
+    long long ns;
+    unsigned long allocations;
+    unsigned long sends;
+    unsigned long ops;
+    unsigned long long bytes;
+    unsigned long long start_cycles;
+    long long start_ns;
+    unsigned long start_allocations;
+    unsigned long start_sends;
+} Bench_Clock;
+
+typedef void (*Bench_Kernel)(Bench_Clock *clock, int payload, int pattern, unsigned long ops);
+
+static unsigned long allocations; // Calls to the allocator from the library, see the wrappers below
+static unsigned long sends;       // Datagrams the library tried to send
+static unsigned long long rng_state = RNG_SEED;
+static char payload_data[RUDP_MSS];
+static volatile unsigned int sink; // Keeps results the compiler would otherwise drop
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+ssize_t __wrap_sendto(int fd, const void *buffer, size_t length, int flags, const struct sockaddr *to,
+                      socklen_t to_length) {
+    (void)fd;
+    (void)buffer;
+    (void)flags;
+    (void)to;
+    (void)to_length;
+    sends++;
+    return (ssize_t)length;
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    (void)fd;
+    (void)flags;
+    size_t length = 0;
+    for (size_t i = 0; i < msg->msg_iovlen; i++) {
+        length += msg->msg_iov[i].iov_len;
+    }
+    sends++;
+    return (ssize_t)length;
+}
+
+static long long bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int bench_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned int)(rng_state >> 32);
+}
+
+static void bench_start(Bench_Clock *clock) {
+    clock->start_allocations = allocations;
+    clock->start_sends = sends;
+    clock->start_ns = bench_ns();
+    clock->start_cycles = bench_cycles();
+}
+
+static void bench_stop(Bench_Clock *clock, unsigned long ops, unsigned long long bytes) {
+    unsigned long long cycles = bench_cycles();
+    clock->ns += bench_ns() - clock->start_ns;
+    clock->cycles += cycles - clock->start_cycles;
+    clock->allocations += allocations - clock->start_allocations;
+    clock->sends += sends - clock->start_sends;
+    clock->ops += ops;
+    clock->bytes += bytes;
+}
+
+/*
+* @brief Order in which a window of BATCH segments arrives: lost ones come last, as their retransmissions would.
+* @param late Set to the number of lost segments at the end of order.
+* @return The number of arrivals written to order, always BATCH.
+*/
+static int bench_arrivals(int pattern, unsigned int *order, int *late) {
+    bool lost[BATCH];
+    int burst = 0;
+    for (int i = 0; i < BATCH; i++) {
+        switch (pattern) {
+        case PATTERN_LOSS1:
+            lost[i] = bench_random() % 100 == 0;
+            break;
+        case PATTERN_LOSS5:
+            lost[i] = bench_random() % 20 == 0;
+            break;
+        case PATTERN_BURST:
+            if (burst == 0 && bench_random() % 256 == 0) {
+                burst = 8; // About 3% of segments, eight at a time
+            }
+            lost[i] = burst > 0;
+            if (burst > 0) {
+                burst--;
+            }
+            break;
+        default:
+            lost[i] = false;
+        }
+    }
+    int count = 0;
+    for (int i = 0; i < BATCH; i++) {
+        if (pattern == PATTERN_REORDER && i % 8 == 0 && i + 1 < BATCH) {
+            order[count++] = i + 1; // Every eighth pair swapped, nothing lost
+            order[count++] = i;
+            i++;
+        } else if (!lost[i]) {
+            order[count++] = i;
+        }
+    }
+    *late = 0;
+    for (int i = 0; i < BATCH; i++) {
+        if (lost[i]) {
+            order[count++] = i;
+            (*late)++;
+        }
+    }
+    return count;
+}
+
+// A socket nothing is sent from, the wrapped send calls only count
+static RUDP_Socket *bench_socket(void) {
+    RUDP_Socket *sockfd = rudp_socket(false, 9);
+    if (sockfd == NULL) {
+        fprintf(stderr, "Error: Failed to create a socket\n");
+        exit(EXIT_FAILURE);
+    }
+    return sockfd;
+}
+
+// calculate_checksum() over one payload
+static void kernel_checksum(Bench_Clock *clock, int payload, int pattern, unsigned long ops) {
+    (void)pattern;
+    unsigned int sum = 0;
+    bench_start(clock);
+    for (unsigned long i = 0; i < ops; i++) {
+        sum += calculate_checksum(payload_data, payload);
+    }
+    bench_stop(clock, ops, (unsigned long long)ops * payload);
+    sink = sum;
+}
+
+// rudp_segment_header(): the header of a data segment, SACK bitmap and advertised window included.
+// With loss the reassembly queue holds a window's on-time segments above a hole, as it does before the
+// retransmissions arrive, and the SACK bitmap has them to describe.
+static void kernel_header_encode(Bench_Clock *clock, int payload, int pattern, unsigned long ops) {
+    RUDP_Socket *sockfd = bench_socket();
+    if (pattern != PATTERN_NONE) {
+        unsigned int order[BATCH];
+        int late;
+        int count = bench_arrivals(pattern, order, &late);
+        for (int i = 0; i < count - late; i++) {
+            if (order[i] != 0) {
+                RUDP_Segment *slot = &sockfd->rcv_queue[order[i]];
+                slot->in_use = true; // Held above the hole at rcv_nxt = 0
+                slot->seq = order[i];
+            }
+        }
+    }
+    RUDP_Segment *seg = sockfd->snd_free;
+    seg->length = payload;
+    seg->flags = DATA_FLAG;
+    RUDP_Header header;
+    unsigned int sum = 0;
+    bench_start(clock);
+    for (unsigned long i = 0; i < ops; i++) {
+        seg->seq = (unsigned int)i;
+        rudp_segment_header(sockfd, seg, &header);
+        sum += (unsigned int)header.sack + header.window;
+    }
+    bench_stop(clock, ops, (unsigned long long)ops * sizeof(RUDP_Header));
+    sink = sum;
+    rudp_close(sockfd);
+}
+
+// rudp_poll_datagram() on a pure ACK that acknowledges nothing new: address lookup, flag dispatch, ACK parsing
+static void kernel_header_decode(Bench_Clock *clock, int payload, int pattern, unsigned long ops) {
+    (void)payload;
+    (void)pattern;
+    RUDP_Socket *sockfd = bench_socket();
+    RUDP_Packet packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header.flags = ACK_FLAG;
+    packet.header.window = RUDP_RCV_SEGS;
+    struct sockaddr_in from = sockfd->dest_addr;
+    struct iovec iov;
+    iov.iov_base = &packet;
+    iov.iov_len = sizeof(packet);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    bench_start(clock);
+    for (unsigned long i = 0; i < ops; i++) {
+        rudp_poll_datagram(sockfd, sockfd->socket_fd, &msg, sizeof(RUDP_Header));
+    }
+    bench_stop(clock, ops, (unsigned long long)ops * sizeof(RUDP_Header));
+    rudp_close(sockfd);
+}
+
+// rudp_accept_segment(): windows of segments into the reassembly queue in the pattern's order, ACK policy included.
+// The application's reads between windows are not timed.
+static void kernel_reassembly(Bench_Clock *clock, int payload, int pattern, unsigned long ops) {
+    RUDP_Socket *sockfd = bench_socket();
+    unsigned int order[BATCH];
+    unsigned long done = 0;
+    while (done < ops) {
+        int late;
+        int count = bench_arrivals(pattern, order, &late);
+        unsigned int base = sockfd->rcv_nxt;
+        bench_start(clock);
+        for (int i = 0; i < count; i++) {
+            rudp_accept_segment(sockfd, base + order[i], DATA_FLAG, 0, base + order[i], payload_data, payload);
+        }
+        bench_stop(clock, count, (unsigned long long)count * payload);
+        while (SEQ_LT(sockfd->rcv_read, sockfd->rcv_nxt)) {
+            sockfd->rcv_queue[sockfd->rcv_read % RUDP_RCV_SEGS].in_use = false;
+            sockfd->rcv_read++;
+        }
+        done += count;
+    }
+    rudp_close(sockfd);
+}
+
+// rudp_process_ack(): the ACKs a receiver sends for a window arriving in the pattern's order, each retiring,
+// SACKing or finding lost segments in the retransmission queue. Filling the queue is not timed.
+static void kernel_ack_retire(Bench_Clock *clock, int payload, int pattern, unsigned long ops) {
+    RUDP_Socket *sockfd = bench_socket();
+    unsigned int order[BATCH];
+    RUDP_Header acks[2 * BATCH];
+    unsigned long done = 0;
+    while (done < ops) {
+        // Send a window
+        unsigned int base = sockfd->snd_nxt;
+        long long now = rudp_now_us();
+        for (int i = 0; i < BATCH; i++) {
+            RUDP_Segment *seg = sockfd->snd_free;
+            sockfd->snd_free = seg->next;
+            seg->in_use = true;
+            seg->seq = base + i;
+            seg->stream = 0;
+            seg->stream_seq = base + i;
+            seg->length = payload;
+            seg->flags = DATA_FLAG;
+            seg->sent_us = now;
+            seg->retransmitted = false;
+            seg->sacked = false;
+            seg->lost = false;
+            seg->fec_close_us = 0;
+            seg->path = 0;
+            seg->next = NULL;
+            sockfd->snd_queue[(base + i) % RUDP_SND_SEGS] = seg;
+        }
+        sockfd->snd_nxt = base + BATCH;
+
+        // The receiver's answers: every second in-order segment, every out-of-order one and every hole filled
+        int late;
+        int count = bench_arrivals(pattern, order, &late);
+        bool held[BATCH] = {false};
+        unsigned int rcv_nxt = 0;
+        int ack_count = 0, in_order = 0;
+        for (int i = 0; i < count; i++) {
+            held[order[i]] = true;
+            unsigned int before = rcv_nxt;
+            while (rcv_nxt < BATCH && held[rcv_nxt]) {
+                rcv_nxt++;
+            }
+            bool ack_now = rcv_nxt == before || rcv_nxt - before > 1 || ++in_order % 2 == 0 || i == count - 1;
+            if (!ack_now) {
+                continue;
+            }
+            RUDP_Header *header = &acks[ack_count++];
+            memset(header, 0, sizeof(*header));
+            header->flags = ACK_FLAG;
+            header->ack = base + rcv_nxt;
+            header->window = RUDP_RCV_SEGS;
+            for (unsigned int j = 0; j < 64 && rcv_nxt + 1 + j < BATCH; j++) {
+                if (held[rcv_nxt + 1 + j]) {
+                    header->sack |= 1ULL << j;
+                }
+            }
+        }
+
+        bench_start(clock);
+        for (int i = 0; i < ack_count; i++) {
+            rudp_process_ack(sockfd, &acks[i]);
+        }
+        bench_stop(clock, ack_count, (unsigned long long)BATCH * payload);
+        if (sockfd->snd_una != sockfd->snd_nxt) {
+            fprintf(stderr, "Error: %u segments left unacknowledged\n", sockfd->snd_nxt - sockfd->snd_una);
+            exit(EXIT_FAILURE);
+        }
+        done += ack_count;
+    }
+    rudp_close(sockfd);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+* @brief Warm the kernel up while finding how many ops take about RUN_MS, then time RUNS runs and print the medians.
+*/
+static void bench_case(const char *name, Bench_Kernel kernel, int payload, int pattern, int runs) {
+    unsigned long ops = 256;
+    for (;;) {
+        Bench_Clock clock;
+        memset(&clock, 0, sizeof(clock));
+        kernel(&clock, payload, pattern, ops);
+        if (clock.ns >= RUN_MS * 1000000LL / 4) {
+            ops = (unsigned long)((double)ops * RUN_MS * 1000000.0 / clock.ns);
+            break;
+        }
+        ops *= 4;
+    }
+
+    double ns_op[RUNS], cycles_op[RUNS], bytes_cycle[RUNS], allocs_op[RUNS], sends_op[RUNS];
+    for (int r = 0; r < runs; r++) {
+        Bench_Clock clock;
+        memset(&clock, 0, sizeof(clock));
+        rng_state = RNG_SEED;
+        kernel(&clock, payload, pattern, ops);
+        ns_op[r] = (double)clock.ns / clock.ops;
+        cycles_op[r] = (double)clock.cycles / clock.ops;
+        bytes_cycle[r] = clock.cycles > 0 ? (double)clock.bytes / clock.cycles : 0;
+        allocs_op[r] = (double)clock.allocations / clock.ops;
+        sends_op[r] = (double)clock.sends / clock.ops;
+    }
+    qsort(ns_op, runs, sizeof(double), compare_double);
+    qsort(cycles_op, runs, sizeof(double), compare_double);
+    qsort(bytes_cycle, runs, sizeof(double), compare_double);
+    qsort(allocs_op, runs, sizeof(double), compare_double);
+    qsort(sends_op, runs, sizeof(double), compare_double);
+    printf("%s\t%d\t%s\t%.2f\t%.1f\t%.3f\t%.4f\t%.4f\n", name, payload, pattern_names[pattern], ns_op[runs / 2],
+           cycles_op[runs / 2], bytes_cycle[runs / 2], allocs_op[runs / 2], sends_op[runs / 2]);
+    fflush(stdout);
+}
+
+// Counter ticks per nanosecond, measured against the monotonic clock
+static double bench_counter_ghz(void) {
+    long long start_ns = bench_ns();
+    unsigned long long start = bench_cycles();
+    while (bench_ns() - start_ns < 50000000LL) {
+    }
+    return (double)(bench_cycles() - start) / (bench_ns() - start_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int cpu = sched_getcpu();
+    int runs = RUNS;
+    const char *only = NULL;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-kernel") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs < 1 || runs > RUNS) {
+        fprintf(stderr, "Error: 1..%d runs per case\n", RUNS);
+        return EXIT_FAILURE;
+    }
+
+    // One core, so the timings do not include migrations
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (cpu < 0 || sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        perror("sched_setaffinity");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < RUDP_MSS; i++) {
+        payload_data[i] = (char)bench_random();
+    }
+
+#ifdef __OPTIMIZE__
+    int optimized = 1;
+#else
+    int optimized = 0;
+#endif
+    printf("# rudp microbench: counter=%s ghz=%.3f cpu=%d runs=%d run_ms=%d optimized=%d mss=%d window=%d\n",
+           BENCH_COUNTER, bench_counter_ghz(), cpu, runs, RUN_MS, optimized, RUDP_MSS, RUDP_WINDOW);
+    printf("kernel\tpayload\tpattern\tns_op\tcycles_op\tbytes_cycle\tallocs_op\tsends_op\n");
+
+    static const int checksum_sizes[] = {16, 64, 256, RUDP_MSS};
+    static const int segment_sizes[] = {64, 512, RUDP_MSS};
+    for (size_t s = 0; s < sizeof(checksum_sizes) / sizeof(checksum_sizes[0]); s++) {
+        if (only == NULL || strcmp(only, "checksum") == 0) {
+            bench_case("checksum", kernel_checksum, checksum_sizes[s], PATTERN_NONE, runs);
+        }
+    }
+    for (int p = 0; p < PATTERN_REORDER; p++) { // Reordering leaves the same hole as a loss
+        if (only == NULL || strcmp(only, "header_encode") == 0) {
+            bench_case("header_encode", kernel_header_encode, RUDP_MSS, p, runs);
+        }
+    }
+    if (only == NULL || strcmp(only, "header_decode") == 0) {
+        bench_case("header_decode", kernel_header_decode, 0, PATTERN_NONE, runs);
+    }
+    for (size_t s = 0; s < sizeof(segment_sizes) / sizeof(segment_sizes[0]); s++) {
+        for (int p = 0; p < PATTERN_COUNT; p++) {
+            if (only == NULL || strcmp(only, "reassembly") == 0) {
+                bench_case("reassembly", kernel_reassembly, segment_sizes[s], p, runs);
+            }
+        }
+    }
+    for (int p = 0; p < PATTERN_COUNT; p++) {
+        if (only == NULL || strcmp(only, "ack_retire") == 0) {
+            bench_case("ack_retire", kernel_ack_retire, RUDP_MSS, p, runs);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,871 @@
+#define _GNU_SOURCE // sendmmsg() and struct ip_mreq under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "RUDP_API.h"
+
+// A group sends an object to every receiver at once, over IP multicast or, where there is none, by handing each
+// datagram to all members in one sendmmsg(). Receivers stay silent while nothing is missing. A gap starts a random
+// backoff; whoever's timer fires first sends a NACK with all its missing ranges, and the sender echoes what it newly
+// learned to the whole group, which holds the other receivers' NACKs for the same segments. The sender collects
+// NACKs into one set of repairs, so a segment lost at many receivers still goes out again only once.
+// Receivers share the sender's port, so their joins, NACKs and completions lead with the receiver's id. Every
+// packet names the sender in the header's window field, which means nothing else to a group.
+
+/*
+* @brief Open one end of a distribution group. group_ip is a multicast address, or for fan-out the sender's own
+* unicast address. local_ip picks the interface, e.g. 127.0.0.1 for a group on this host, NULL for the default.
+* @return The group, NULL on error.
+*/
+RUDP_Group *rudp_group_open(bool isSender, const char *group_ip, unsigned short port, const char *local_ip) {
+    struct sockaddr_in group_addr, local;
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(port);
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (group_ip == NULL || inet_pton(AF_INET, group_ip, &group_addr.sin_addr) <= 0 || port == 0 ||
+        (local_ip != NULL && inet_pton(AF_INET, local_ip, &local.sin_addr) <= 0)) {
+        printf("Error: invalid group address\n");
+        return NULL;
+    }
+
+    RUDP_Group *group = (RUDP_Group *)calloc(1, sizeof(RUDP_Group));
+    if (group == NULL) {
+        perror("Failed to allocate memory for group structure");
+        return NULL;
+    }
+    group->isSender = isSender;
+    group->multicast = IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr));
+    group->group_addr = group_addr;
+    group->rate = RUDP_GROUP_RATE;
+    group->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (group->fd < 0) {
+        perror("Failed to create group socket");
+        free(group);
+        return NULL;
+    }
+
+    // Multicast: receivers share the group's port, the sender listens for them on a port of its own.
+    // Fan-out: the sender owns the group address, receivers talk to it from wherever they are bound.
+    struct sockaddr_in bind_addr = local;
+    if (isSender != group->multicast) {
+        bind_addr = group_addr;
+    }
+    int one = 1;
+    if (group->multicast && !isSender && setsockopt(group->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
+        perror("setsockopt SO_REUSEADDR");
+    }
+    if (bind(group->fd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) {
+        perror("Failed to bind group socket");
+        close(group->fd); // Not rudp_group_close(), a sender would announce the end of a group never opened
+        free(group);
+        return NULL;
+    }
+    if (group->multicast) {
+        unsigned char ttl = RUDP_GROUP_TTL, loop = 1; // Loop back to receivers on this host
+        if (setsockopt(group->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+            setsockopt(group->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+            (local_ip != NULL &&
+             setsockopt(group->fd, IPPROTO_IP, IP_MULTICAST_IF, &local.sin_addr, sizeof(local.sin_addr)) < 0)) {
+            perror("setsockopt multicast");
+        }
+        struct ip_mreq membership;
+        membership.imr_multiaddr = group_addr.sin_addr;
+        membership.imr_interface = local.sin_addr;
+        if (!isSender && setsockopt(group->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+            perror("Failed to join multicast group");
+            rudp_group_close(group);
+            return NULL;
+        }
+    }
+    int bytes = RUDP_GROUP_SOCKBUF;
+    if (setsockopt(group->fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) < 0 ||
+        setsockopt(group->fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+        perror("setsockopt group buffers");
+    }
+
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (random == NULL || fread(&group->rng, 1, sizeof(group->rng), random) != sizeof(group->rng)) {
+        group->rng = (unsigned long long)rudp_now_us() ^ ((unsigned long long)getpid() << 32);
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+    group->rng |= 1; // xorshift never leaves 0
+    if (isSender) {
+        group->sender_id = (unsigned int)rudp_group_random(group, 0) | 1; // 0 marks packets of receivers
+    } else {
+        group->member_id = rudp_group_random(group, 0) | 1;
+    }
+    return group;
+}
+
+int rudp_group_set_rate(RUDP_Group *group, unsigned long bytes_per_second) {
+    if (group == NULL || !group->isSender || bytes_per_second == 0) {
+        return -1;
+    }
+    group->rate = (double)bytes_per_second;
+    return 1;
+}
+
+/*
+* @brief Sender: wait until count receivers have made themselves known, asking for them over multicast.
+* Fan-out receivers join on their own, the sender has no other way to find them.
+* @return Members known when it returns, -1 on error.
+*/
+int rudp_group_wait_members(RUDP_Group *group, unsigned int count, unsigned int timeout_ms) {
+    if (group == NULL || !group->isSender) {
+        return -1;
+    }
+    long long deadline_us = rudp_now_us() + timeout_ms * 1000LL;
+    long long solicit_us = 0;
+    while (group->member_count < count) {
+        long long now = rudp_now_us();
+        if (now >= deadline_us) {
+            break;
+        }
+        if (group->multicast && now >= solicit_us) {
+            if (rudp_group_control(group, SYN_FLAG, NULL) < 0) {
+                return -1;
+            }
+            solicit_us = now + RUDP_GROUP_JOIN_MS * 1000LL;
+        }
+        long long wake_us = group->multicast && solicit_us < deadline_us ? solicit_us : deadline_us;
+        if (rudp_group_poll(group, wake_us) < 0) {
+            return -1;
+        }
+    }
+    return (int)group->member_count;
+}
+
+/*
+* @brief Sender: send one object to the group and repair it until every known member has it, or until no receiver
+* has spoken for RUDP_GROUP_LINGER_MS. The buffer must stay untouched until the call returns.
+* @return Members that reported the object complete, -1 on error.
+*/
+int rudp_group_send(RUDP_Group *group, const void *data, size_t size) {
+    if (group == NULL || !group->isSender || data == NULL || size == 0 || size > INT_MAX) {
+        return -1; // An empty object would read as the end of the group at the receivers
+    }
+    if (!group->multicast && group->member_count == 0) {
+        printf("Error: no members to fan out to\n");
+        return -1;
+    }
+    group->object++;
+    group->data = (char *)data;
+    group->size = size;
+    group->count = (unsigned int)((size + RUDP_MSS - 1) / RUDP_MSS);
+    group->repair = (unsigned char *)calloc(group->count / 8 + 1, 1);
+    group->repaired_us = (long long *)calloc(group->count + 1, sizeof(long long));
+    if (group->repair == NULL || group->repaired_us == NULL) {
+        perror("Failed to allocate repair state");
+        rudp_group_free_object(group);
+        return -1;
+    }
+    long long now = rudp_now_us();
+    group->next = 0;
+    group->repair_count = 0;
+    group->repair_next = 0;
+    group->repair_due_us = 0;
+    group->pace_us = now;
+    group->fin_deadline_us = 0;
+    group->fin_interval_us = RUDP_GROUP_FIN_MS * 1000LL;
+    group->heard_us = now;
+
+    int result = 1;
+    while (result > 0) {
+        now = rudp_now_us();
+        long long burst_us = (long long)(RUDP_GROUP_BURST * (sizeof(RUDP_Header) + RUDP_MSS) * 1000000.0 / group->rate);
+        if (group->pace_us < now - burst_us) {
+            group->pace_us = now - burst_us; // Time spent waiting is not saved up beyond a burst
+        }
+
+        // Repairs whose batch is due first, then new data, as fast as the rate allows
+        bool repairs_due = group->repair_count > 0 && now >= group->repair_due_us;
+        while (group->pace_us <= now && (repairs_due || group->next < group->count)) {
+            unsigned int seq = repairs_due ? rudp_group_next_repair(group) : group->next++;
+            if (rudp_group_send_segment(group, seq, repairs_due) < 0) {
+                result = -1;
+                break;
+            }
+            repairs_due = group->repair_count > 0 && now >= group->repair_due_us;
+        }
+        if (result < 0) {
+            break;
+        }
+
+        long long wake_us = 0;
+        if (group->next < group->count || repairs_due) {
+            wake_us = group->pace_us;
+        } else if (group->repair_count > 0) {
+            wake_us = group->repair_due_us;
+        } else {
+            // Everything went out: announce the end so receivers see a lost tail, until all have it
+            if (now >= group->fin_deadline_us) {
+                if (rudp_group_control(group, EOC_FLAG, NULL) < 0) {
+                    result = -1;
+                    break;
+                }
+                group->fin_deadline_us = now + group->fin_interval_us;
+                if (group->fin_interval_us < 1000000) {
+                    group->fin_interval_us *= 2;
+                }
+            }
+            unsigned int done = 0;
+            for (unsigned int m = 0; m < group->member_count; m++) {
+                done += group->members[m].done_object == group->object;
+            }
+            if ((group->member_count > 0 && done == group->member_count) ||
+                now - group->heard_us >= RUDP_GROUP_LINGER_MS * 1000LL) {
+                result = (int)done;
+                break;
+            }
+            wake_us = group->fin_deadline_us;
+            if (group->heard_us + RUDP_GROUP_LINGER_MS * 1000LL < wake_us) {
+                wake_us = group->heard_us + RUDP_GROUP_LINGER_MS * 1000LL;
+            }
+        }
+        if (rudp_group_poll(group, wake_us) < 0) {
+            result = -1;
+        }
+    }
+    rudp_group_free_object(group);
+    return result;
+}
+
+/*
+* @brief Receiver: receive the next object of the group into buffer. Segments land in place, nothing is copied twice.
+* Once a sender was heard, RUDP_GROUP_SILENCE_MS without a packet from it, counted from the call at the earliest,
+* is taken as the sender gone.
+* @return Bytes of the object, 0 once the sender closed the group, -1 on error, if the object does not fit or if
+* the sender fell silent.
+*/
+int rudp_group_recv(RUDP_Group *group, char *buffer, size_t buffer_size) {
+    if (group == NULL || group->isSender || buffer == NULL) {
+        return -1;
+    }
+    if (group->receiving && (group->data != buffer || group->capacity != buffer_size)) {
+        rudp_group_free_object(group); // An earlier call gave up on an object, what it stored is in its buffer
+    }
+    group->data = buffer;
+    group->capacity = buffer_size;
+    long long called_us = rudp_now_us();
+
+    while (true) {
+        if (group->receiving && group->have_count == group->count) {
+            group->done_object = group->object;
+            int size = (int)group->size;
+            rudp_group_free_object(group);
+            if (rudp_group_control(group, ACK_FLAG, NULL) < 0) {
+                return -1;
+            }
+            return size;
+        }
+        if (group->closed) {
+            return 0;
+        }
+
+        long long now = rudp_now_us();
+        long long give_up_us = 0;
+        if (group->sender_known) {
+            give_up_us = group->sender_heard_us > called_us ? group->sender_heard_us : called_us;
+            give_up_us += RUDP_GROUP_SILENCE_MS * 1000LL;
+            if (now >= give_up_us) {
+                printf("Sender is not responding, giving up\n");
+                return -1;
+            }
+        }
+        if (group->nack_deadline_us != 0 && now >= group->nack_deadline_us && rudp_group_send_nack(group, now) < 0) {
+            return -1;
+        }
+        if (!group->multicast && !group->sender_known && now >= group->join_deadline_us) {
+            if (rudp_group_control(group, SYN_FLAG | ACK_FLAG, NULL) < 0) {
+                return -1;
+            }
+            group->join_deadline_us = now + RUDP_GROUP_JOIN_MS * 1000LL;
+        }
+
+        long long wake_us = group->nack_deadline_us;
+        if (!group->multicast && !group->sender_known && (wake_us == 0 || group->join_deadline_us < wake_us)) {
+            wake_us = group->join_deadline_us;
+        }
+        if (give_up_us != 0 && (wake_us == 0 || give_up_us < wake_us)) {
+            wake_us = give_up_us;
+        }
+        if (rudp_group_poll(group, wake_us) < 0) {
+            return -1;
+        }
+    }
+}
+
+int rudp_group_get_stats(RUDP_Group *group, RUDP_Group_Stats *stats) {
+    if (group == NULL || stats == NULL) {
+        return -1;
+    }
+    *stats = group->stats;
+    stats->members = group->member_count;
+    stats->members_done = 0;
+    for (unsigned int m = 0; m < group->member_count; m++) {
+        stats->members_done += group->object != 0 && group->members[m].done_object == group->object;
+    }
+    return 1;
+}
+
+// Leave the group, a sender first tells the receivers there is nothing more (see rudp_group_finish())
+int rudp_group_close(RUDP_Group *group) {
+    if (group == NULL) {
+        return -1;
+    }
+    int result = group->isSender ? rudp_group_finish(group) : 1;
+    if (group->fd >= 0) {
+        close(group->fd);
+    }
+    rudp_group_free_object(group);
+    free(group);
+    return result;
+}
+
+/*
+* @brief Sender: announce the end of the group the way rudp_group_send() announces the end of an object, again at
+* doubling intervals until every known member has acknowledged it or no receiver has spoken for
+* RUDP_GROUP_LINGER_MS, counted from the close at the earliest.
+* @return 1 on success, -1 on error.
+*/
+int rudp_group_finish(RUDP_Group *group) {
+    long long now = rudp_now_us();
+    long long fin_us = now;
+    long long interval_us = RUDP_GROUP_FIN_MS * 1000LL;
+    if (group->heard_us < now) {
+        group->heard_us = now;
+    }
+    while (true) {
+        unsigned int closed = 0;
+        for (unsigned int m = 0; m < group->member_count; m++) {
+            closed += group->members[m].closed;
+        }
+        long long linger_us = group->heard_us + RUDP_GROUP_LINGER_MS * 1000LL;
+        if ((group->member_count > 0 && closed == group->member_count) || now >= linger_us) {
+            return 1;
+        }
+        if (now >= fin_us) {
+            if (rudp_group_control(group, FIN_FLAG, NULL) < 0) {
+                return -1;
+            }
+            fin_us = now + interval_us;
+            if (interval_us < 1000000) {
+                interval_us *= 2;
+            }
+        }
+        if (rudp_group_poll(group, fin_us < linger_us ? fin_us : linger_us) < 0) {
+            return -1;
+        }
+        now = rudp_now_us();
+    }
+}
+
+void rudp_group_free_object(RUDP_Group *group) {
+    free(group->repair);
+    free(group->repaired_us);
+    free(group->have);
+    free(group->hold_us);
+    group->repair = NULL;
+    group->repaired_us = NULL;
+    group->have = NULL;
+    group->hold_us = NULL;
+    group->receiving = false;
+    group->nack_deadline_us = 0;
+}
+
+// xorshift64*, below limit, the whole 64 bits if limit is 0
+unsigned long long rudp_group_random(RUDP_Group *group, unsigned long long limit) {
+    group->rng ^= group->rng >> 12;
+    group->rng ^= group->rng << 25;
+    group->rng ^= group->rng >> 27;
+    unsigned long long value = group->rng * 0x2545F4914F6CDD1DULL;
+    return limit == 0 ? value : value % limit;
+}
+
+/*
+* @brief Send a datagram to one address, or with to NULL to the whole group: the multicast address, or every member.
+* @return 1 on success, -1 on error.
+*/
+int rudp_group_transmit(RUDP_Group *group, RUDP_Header *header, const void *payload, int payload_size,
+                        const struct sockaddr_in *to) {
+    unsigned char tagged[sizeof(group->member_id) + sizeof(unsigned int[RUDP_GROUP_NACK_RANGES][2])];
+    if (!group->isSender) {
+        if (payload_size > (int)(sizeof(tagged) - sizeof(group->member_id))) {
+            return -1;
+        }
+        memcpy(tagged, &group->member_id, sizeof(group->member_id));
+        memcpy(tagged + sizeof(group->member_id), payload, payload_size);
+        payload = tagged;
+        payload_size += sizeof(group->member_id);
+    }
+    header->flags |= GROUP_FLAG;
+    header->length = payload_size;
+    header->checksum = calculate_checksum((void *)payload, payload_size);
+    header->window = group->sender_id;
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(RUDP_Header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = payload_size;
+
+    // One message per destination, all sharing the same iovec
+    struct mmsghdr messages[RUDP_GROUP_MAX_MEMBERS];
+    unsigned int count = 0;
+    if (to != NULL || group->multicast || !group->isSender) {
+        const struct sockaddr_in *addr = to != NULL ? to : group->isSender ? &group->group_addr : &group->sender_addr;
+        if (!group->isSender && to == NULL && !group->sender_known) {
+            addr = &group->group_addr; // Fan-out receivers join at the address they were given
+        }
+        memset(&messages[0], 0, sizeof(messages[0]));
+        messages[0].msg_hdr.msg_name = (void *)addr;
+        count = 1;
+    } else {
+        for (; count < group->member_count; count++) {
+            memset(&messages[count], 0, sizeof(messages[count]));
+            messages[count].msg_hdr.msg_name = &group->members[count].addr;
+        }
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        messages[i].msg_hdr.msg_iov = iov;
+        messages[i].msg_hdr.msg_iovlen = payload_size > 0 ? 2 : 1;
+    }
+
+    unsigned int sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(group->fd, messages + sent, count - sent, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error sending group packet");
+            return -1;
+        }
+        sent += (unsigned int)result;
+    }
+    return 1;
+}
+
+// A packet without payload: solicit, join, end of object, completion, FIN or its acknowledgement. Receivers address
+// the sender.
+int rudp_group_control(RUDP_Group *group, int flags, const struct sockaddr_in *to) {
+    RUDP_Header header;
+    memset(&header, 0, sizeof(header));
+    header.flags = flags;
+    header.stream_seq = group->isSender ? group->object : group->done_object;
+    header.ack = group->count;
+    header.sack = group->size;
+    return rudp_group_transmit(group, &header, NULL, 0, to);
+}
+
+// Sender: one data segment of the object, the first time or as a repair
+int rudp_group_send_segment(RUDP_Group *group, unsigned int seq, bool repair) {
+    unsigned long long offset = (unsigned long long)seq * RUDP_MSS;
+    int length = group->size - offset < RUDP_MSS ? (int)(group->size - offset) : RUDP_MSS;
+    RUDP_Header header;
+    memset(&header, 0, sizeof(header));
+    header.flags = DATA_FLAG;
+    header.seq = seq;
+    header.ack = group->count;
+    header.sack = group->size;
+    header.stream_seq = group->object;
+    if (rudp_group_transmit(group, &header, group->data + offset, length, NULL) < 0) {
+        return -1;
+    }
+    group->pace_us += (long long)((sizeof(RUDP_Header) + length) * 1000000.0 / group->rate);
+    if (repair) {
+        group->repaired_us[seq] = rudp_now_us();
+        group->stats.repairs_sent++;
+    } else {
+        group->stats.segments_sent++;
+    }
+    return 1;
+}
+
+// Sender: lowest segment waiting for a repair, taken off the set
+unsigned int rudp_group_next_repair(RUDP_Group *group) {
+    unsigned int seq = group->repair_next;
+    while (!(group->repair[seq / 8] & (1 << (seq % 8)))) {
+        seq++;
+    }
+    group->repair[seq / 8] &= (unsigned char)~(1 << (seq % 8));
+    group->repair_count--;
+    group->repair_next = seq + 1;
+    return seq;
+}
+
+// Sender: the member a packet came from, added if it is new. -1 if the table is full.
+int rudp_group_member(RUDP_Group *group, unsigned long long id, const struct sockaddr_in *from) {
+    for (unsigned int m = 0; m < group->member_count; m++) {
+        if (group->members[m].id == id) {
+            group->members[m].addr = *from;
+            return (int)m;
+        }
+    }
+    if (group->member_count == RUDP_GROUP_MAX_MEMBERS) {
+        return -1;
+    }
+    RUDP_Group_Member *member = &group->members[group->member_count];
+    memset(member, 0, sizeof(*member));
+    member->id = id;
+    member->addr = *from;
+    printf("member %u joined from %s:%u\n", group->member_count, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    return (int)group->member_count++;
+}
+
+/*
+* @brief Sender: add a NACK's ranges to the repair set and echo to the group the segments it added, so receivers
+* that miss them too hold their own NACKs. Segments already waiting for a repair are the aggregation: asked for by
+* any number of receivers, they still go out once. A segment repaired moments ago is not taken, the NACK crossed it.
+*/
+int rudp_group_process_nack(RUDP_Group *group, const RUDP_Header *header, const char *payload, int payload_size) {
+    if (header->stream_seq != group->object || group->repair == NULL) {
+        return 1; // About an object that is over
+    }
+    group->stats.nacks_received++;
+    long long now = rudp_now_us();
+    unsigned int echo[RUDP_GROUP_NACK_RANGES][2];
+    unsigned int echo_count = 0;
+    bool batch_open = group->repair_count > 0;
+    unsigned int ranges = (unsigned int)payload_size / sizeof(echo[0]);
+    for (unsigned int r = 0; r < ranges && r < RUDP_GROUP_NACK_RANGES; r++) {
+        unsigned int range[2];
+        memcpy(range, payload + r * sizeof(range), sizeof(range));
+        unsigned int end = range[0] + range[1];
+        if (end > group->next || end < range[0]) {
+            end = group->next; // Segments not sent yet come anyway
+        }
+        for (unsigned int seq = range[0]; seq < end; seq++) {
+            if ((group->repair[seq / 8] & (1 << (seq % 8))) ||
+                (group->repaired_us[seq] != 0 && now - group->repaired_us[seq] < RUDP_GROUP_BACKOFF_MS * 1000LL)) {
+                continue;
+            }
+            group->repair[seq / 8] |= (unsigned char)(1 << (seq % 8));
+            group->repair_count++;
+            if (seq < group->repair_next) {
+                group->repair_next = seq;
+            }
+            if (echo_count > 0 && echo[echo_count - 1][0] + echo[echo_count - 1][1] == seq) {
+                echo[echo_count - 1][1]++;
+            } else if (echo_count < RUDP_GROUP_NACK_RANGES) {
+                echo[echo_count][0] = seq;
+                echo[echo_count][1] = 1;
+                echo_count++;
+            }
+        }
+    }
+    if (echo_count == 0) {
+        return 1;
+    }
+    if (!batch_open) {
+        group->repair_due_us = now + RUDP_GROUP_AGGREGATE_MS * 1000LL;
+    }
+    RUDP_Header reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.flags = NACK_FLAG;
+    reply.stream_seq = group->object;
+    reply.ack = group->count;
+    reply.sack = group->size;
+    group->stats.nacks_echoed++;
+    return rudp_group_transmit(group, &reply, echo, (int)(echo_count * sizeof(echo[0])), NULL);
+}
+
+// Sender: a join, NACK, completion or FIN acknowledgement from a receiver
+int rudp_group_sender_packet(RUDP_Group *group, RUDP_Packet *packet, int length, const struct sockaddr_in *from) {
+    RUDP_Header *header = &packet->header;
+    bool join = (header->flags & (SYN_FLAG | ACK_FLAG)) == (SYN_FLAG | ACK_FLAG);
+    if (header->window != group->sender_id && !(join && header->window == 0)) {
+        return 1; // Speaks to another sender of the group
+    }
+    if (header->length < 0 || header->length > length - (int)sizeof(RUDP_Header) ||
+        header->checksum != calculate_checksum(packet->data, header->length)) {
+        return 1;
+    }
+    unsigned long long id = 0;
+    if (header->length >= (int)sizeof(id)) {
+        memcpy(&id, packet->data, sizeof(id));
+    }
+    if (id == 0) {
+        return 1;
+    }
+    int m = rudp_group_member(group, id, from);
+    if (m < 0) {
+        return 1;
+    }
+    long long now = rudp_now_us();
+    group->members[m].heard_us = now;
+    group->heard_us = now;
+    if (join) {
+        return group->multicast ? 1 : rudp_group_control(group, SYN_FLAG, from); // Tell a fan-out receiver it is in
+    }
+    if (header->flags & NACK_FLAG) {
+        return rudp_group_process_nack(group, header, packet->data + sizeof(id), header->length - (int)sizeof(id));
+    }
+    if (header->flags & FIN_FLAG) {
+        group->members[m].closed = true;
+    } else if (header->flags & ACK_FLAG) {
+        group->members[m].done_object = header->stream_seq;
+    }
+    return 1;
+}
+
+// Receiver: take the object a packet belongs to as the one in progress
+int rudp_group_start_object(RUDP_Group *group, const RUDP_Header *header) {
+    rudp_group_free_object(group);
+    if (header->sack == 0 || header->sack > INT_MAX || header->ack != (header->sack + RUDP_MSS - 1) / RUDP_MSS) {
+        return 1; // Not a size this end can return
+    }
+    if (header->sack > group->capacity) {
+        printf("Error: object of %llu bytes does not fit in %zu\n", header->sack, group->capacity);
+        return -1;
+    }
+    group->have = (unsigned char *)calloc(header->ack / 8 + 1, 1);
+    group->hold_us = (long long *)calloc(header->ack + 1, sizeof(long long));
+    if (group->have == NULL || group->hold_us == NULL) {
+        perror("Failed to allocate receive state");
+        rudp_group_free_object(group);
+        return -1;
+    }
+    group->object = header->stream_seq;
+    group->count = header->ack;
+    group->size = header->sack;
+    group->have_count = 0;
+    group->seen = 0;
+    group->receiving = true;
+    return 1;
+}
+
+// Receiver: segments went missing, NACK them a random backoff after after_us unless a NACK is due sooner anyway
+void rudp_group_gap(RUDP_Group *group, long long after_us) {
+    long long due_us = after_us + (long long)rudp_group_random(group, RUDP_GROUP_BACKOFF_MS * 1000ULL + 1);
+    if (group->nack_deadline_us == 0 || due_us < group->nack_deadline_us) {
+        group->nack_deadline_us = due_us;
+    }
+}
+
+/*
+* @brief Receiver: the backoff ran out. NACK, in one packet, every missing segment nobody has asked for within the
+* hold time, then wait for the earliest hold to run out plus a fresh backoff before asking again.
+* @return 1 on success, -1 on error.
+*/
+int rudp_group_send_nack(RUDP_Group *group, long long now) {
+    unsigned int ranges[RUDP_GROUP_NACK_RANGES][2];
+    unsigned int range_count = 0;
+    long long retry_us = 0;
+    for (unsigned int seq = 0; seq < group->seen; seq++) {
+        if (group->have[seq / 8] & (1 << (seq % 8))) {
+            continue;
+        }
+        if (group->hold_us[seq] > now) {
+            if (retry_us == 0 || group->hold_us[seq] < retry_us) {
+                retry_us = group->hold_us[seq];
+            }
+            continue;
+        }
+        if (range_count > 0 && ranges[range_count - 1][0] + ranges[range_count - 1][1] == seq) {
+            ranges[range_count - 1][1]++;
+        } else if (range_count < RUDP_GROUP_NACK_RANGES) {
+            ranges[range_count][0] = seq;
+            ranges[range_count][1] = 1;
+            range_count++;
+        } else {
+            retry_us = now; // No room left, the rest goes in the next NACK
+            continue;
+        }
+        group->hold_us[seq] = now + RUDP_GROUP_HOLD_MS * 1000LL;
+        if (retry_us == 0 || group->hold_us[seq] < retry_us) {
+            retry_us = group->hold_us[seq];
+        }
+    }
+    group->nack_deadline_us = 0;
+    if (retry_us != 0) {
+        group->nack_deadline_us = retry_us + (long long)rudp_group_random(group, RUDP_GROUP_BACKOFF_MS * 1000ULL + 1);
+    }
+    if (range_count == 0) {
+        return 1; // Others asked for all of it
+    }
+    RUDP_Header header;
+    memset(&header, 0, sizeof(header));
+    header.flags = NACK_FLAG;
+    header.stream_seq = group->object;
+    group->stats.nacks_sent++;
+    return rudp_group_transmit(group, &header, ranges, (int)(range_count * sizeof(ranges[0])), &group->sender_addr);
+}
+
+// Receiver: the sender echoed a NACK, hold ours for those segments until the repairs had time to come
+void rudp_group_suppress(RUDP_Group *group, const RUDP_Header *header, const char *payload, long long now) {
+    unsigned int ranges = (unsigned int)header->length / (2 * sizeof(unsigned int));
+    unsigned int seen = group->seen;
+    for (unsigned int r = 0; r < ranges && r < RUDP_GROUP_NACK_RANGES; r++) {
+        unsigned int range[2];
+        memcpy(range, payload + r * sizeof(range), sizeof(range));
+        for (unsigned int seq = range[0]; seq < range[0] + range[1] && seq < group->count; seq++) {
+            if (group->have[seq / 8] & (1 << (seq % 8))) {
+                continue;
+            }
+            if (group->hold_us[seq] <= now) {
+                group->stats.segments_suppressed++;
+            }
+            group->hold_us[seq] = now + RUDP_GROUP_HOLD_MS * 1000LL;
+            if (seq + 1 > seen) {
+                seen = seq + 1; // Sent already, a tail we lost too
+            }
+        }
+    }
+    if (seen > group->seen) {
+        group->seen = seen;
+        rudp_group_gap(group, now + RUDP_GROUP_HOLD_MS * 1000LL);
+    }
+}
+
+// Receiver: data, an end-of-object announcement, a NACK echo, a solicit or the FIN from the sender
+int rudp_group_receiver_packet(RUDP_Group *group, RUDP_Packet *packet, int length, const struct sockaddr_in *from) {
+    RUDP_Header *header = &packet->header;
+    if (header->window == 0) {
+        return 1; // Not from a sender
+    }
+    if (!group->sender_known) {
+        group->sender_known = true;
+        group->sender_id = header->window;
+        group->sender_addr = *from;
+    } else if (header->window != group->sender_id) {
+        return 1; // Another sender on the same group
+    }
+    if (header->length < 0 || header->length > length - (int)sizeof(RUDP_Header) ||
+        header->checksum != calculate_checksum(packet->data, header->length)) {
+        group->stats.checksum_errors++;
+        return 1;
+    }
+
+    long long now = rudp_now_us();
+    group->sender_heard_us = now;
+    if (header->flags & FIN_FLAG) {
+        group->closed = true;
+        return rudp_group_control(group, FIN_FLAG | ACK_FLAG, NULL); // Every copy is answered, ours may be lost
+    }
+    if (header->flags & SYN_FLAG) {
+        return rudp_group_control(group, SYN_FLAG | ACK_FLAG, NULL); // Solicit: answer with a join
+    }
+    unsigned int object = header->stream_seq;
+    if (header->flags & DATA_FLAG) {
+        group->stats.segments_received++;
+    }
+    if (object <= group->done_object) {
+        if (header->flags & DATA_FLAG) {
+            group->stats.duplicates++;
+        } else if ((header->flags & EOC_FLAG) && object == group->done_object) {
+            return rudp_group_control(group, ACK_FLAG, NULL); // Our completion was lost
+        }
+        return 1;
+    }
+    if (!(header->flags & (DATA_FLAG | EOC_FLAG | NACK_FLAG))) {
+        return 1;
+    }
+    if ((!group->receiving || object != group->object) && rudp_group_start_object(group, header) < 0) {
+        return -1;
+    }
+    if (!group->receiving || object != group->object) {
+        return 1;
+    }
+
+    if (header->flags & NACK_FLAG) {
+        rudp_group_suppress(group, header, packet->data, now);
+    } else if (header->flags & EOC_FLAG) {
+        if (group->seen < group->count) {
+            group->seen = group->count;
+            rudp_group_gap(group, now);
+        }
+    } else {
+        unsigned int seq = header->seq;
+        unsigned long long offset = (unsigned long long)seq * RUDP_MSS;
+        if (seq >= group->count ||
+            header->length != (group->size - offset < RUDP_MSS ? (int)(group->size - offset) : RUDP_MSS)) {
+            return 1;
+        }
+        if (group->have[seq / 8] & (1 << (seq % 8))) {
+            group->stats.duplicates++;
+            return 1;
+        }
+        memcpy(group->data + offset, packet->data, header->length);
+        group->have[seq / 8] |= (unsigned char)(1 << (seq % 8));
+        group->have_count++;
+        if (seq > group->seen) {
+            rudp_group_gap(group, now); // Skipped over segments
+        }
+        if (seq >= group->seen) {
+            group->seen = seq + 1;
+        }
+    }
+    return 1;
+}
+
+/*
+* @brief Wait for packets until wake_us (0: no limit) and handle whatever arrived.
+* @return 1 on success, -1 on error.
+*/
+int rudp_group_poll(RUDP_Group *group, long long wake_us) {
+    struct timeval timeout;
+    struct timeval *timeout_ptr = NULL;
+    if (wake_us != 0) {
+        long long wait_us = wake_us - rudp_now_us();
+        if (wait_us < 0) {
+            wait_us = 0;
+        }
+        timeout.tv_sec = wait_us / 1000000;
+        timeout.tv_usec = wait_us % 1000000;
+        timeout_ptr = &timeout;
+    }
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(group->fd, &read_fds);
+    int ready = select(group->fd + 1, &read_fds, NULL, NULL, timeout_ptr);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 1;
+        }
+        perror("select");
+        return -1;
+    }
+
+    // Drain what is queued, bounded so a flood of NACKs cannot hold up the sender's pacing
+    RUDP_Packet packet;
+    for (int i = 0; ready > 0 && i < 64; i++) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t length = recvfrom(group->fd, &packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (length < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            perror("recvfrom");
+            return -1;
+        }
+        if (length < (ssize_t)sizeof(RUDP_Header) || !(packet.header.flags & GROUP_FLAG)) {
+            continue;
+        }
+        int result = group->isSender ? rudp_group_sender_packet(group, &packet, (int)length, &from)
+                                     : rudp_group_receiver_packet(group, &packet, (int)length, &from);
+        if (result < 0) {
+            return -1;
+        }
+        if (!group->isSender && group->receiving && group->have_count == group->count) {
+            break; // Complete, hand it over before reading on
+        }
+    }
+    return 1;
+}
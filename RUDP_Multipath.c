@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "RUDP_API.h"
+
+// A connection over several address pairs shares one sequence space, one SACK bitmap and one reassembly queue.
+// What differs per subflow is what the network decides: the RTT, the congestion window and which losses it causes.
+// Segments remember the subflow they last went out on, so every ACK credits, and every loss charges, the right one.
+
+/*
+* @brief Add a subflow to a connected client: a socket bound to local_ip that talks to remote_ip:remote_port,
+* or to the address the connection was made to if remote_ip is NULL. Data uses it once the server answers its join.
+* @return Index of the new path, -1 on error.
+*/
+int rudp_add_path(RUDP_Socket *sockfd, const char *local_ip, const char *remote_ip, unsigned short remote_port) {
+    if (sockfd == NULL || local_ip == NULL || sockfd->isServer || !sockfd->isConnected || sockfd->cookie == 0) {
+        return -1; // Joins carry the cookie of an established connection
+    }
+    if (sockfd->shm_active) {
+        printf("Error: the connection uses shared memory, it has no paths to add to\n");
+        return -1;
+    }
+    if (sockfd->path_count >= RUDP_MAX_PATHS) {
+        printf("Error: at most %d paths per connection\n", RUDP_MAX_PATHS);
+        return -1;
+    }
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    struct sockaddr_in remote = sockfd->dest_addr;
+    if (inet_pton(AF_INET, local_ip, &local.sin_addr) <= 0 ||
+        (remote_ip != NULL && inet_pton(AF_INET, remote_ip, &remote.sin_addr) <= 0)) {
+        printf("Error: invalid path address\n");
+        return -1;
+    }
+    if (remote_ip != NULL) {
+        remote.sin_port = htons(remote_port);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("Failed to create path socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("Failed to bind path socket");
+        close(fd);
+        return -1;
+    }
+    int bytes = sockfd->sockbuf_req;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+        perror("setsockopt path buffers");
+    }
+    rudp_spin_socket(sockfd, fd);
+
+    if (sockfd->path_count == 1) {
+        rudp_path_init(sockfd, 0);
+    }
+    unsigned int path = sockfd->path_count;
+    rudp_path_init(sockfd, path);
+    sockfd->paths[path].fd = fd;
+    sockfd->paths[path].remote = remote;
+    sockfd->path_count++;
+    if (rudp_path_probe(sockfd, path) < 0) {
+        return -1;
+    }
+    return (int)path;
+}
+
+int rudp_get_path_stats(RUDP_Socket *sockfd, unsigned int path, RUDP_Path_Stats *stats) {
+    if (sockfd == NULL || stats == NULL || path >= sockfd->path_count) {
+        return -1;
+    }
+    // A single path runs on the connection's own RTT and window
+    bool single = sockfd->path_count == 1;
+    RUDP_Path *p = &sockfd->paths[path];
+    memset(stats, 0, sizeof(*stats));
+    stats->remote = *rudp_path_addr(sockfd, path);
+    stats->validated = path == 0 || p->validated;
+    stats->dead = p->dead;
+    stats->srtt_us = single ? sockfd->srtt_us : p->srtt_us;
+    stats->cwnd = single ? sockfd->cwnd : p->cwnd;
+    stats->segments_sent = p->segments_sent;
+    stats->segments_lost = p->segments_lost;
+    stats->segments_received = p->segments_received;
+    return 1;
+}
+
+// Fresh congestion state for a subflow. Path 0 carries on from what the connection learned alone, counters included.
+void rudp_path_init(RUDP_Socket *sockfd, unsigned int path) {
+    RUDP_Path *p = &sockfd->paths[path];
+    if (path == 0) {
+        p->fd = sockfd->socket_fd;
+        p->remote = sockfd->dest_addr;
+        p->validated = true;
+        p->dead = false;
+        p->srtt_us = sockfd->srtt_us;
+        p->rttvar_us = sockfd->rttvar_us;
+        p->rto_us = sockfd->rto_us;
+        p->cwnd = sockfd->cwnd;
+        p->cwnd_acked = 0;
+        p->ssthresh = sockfd->ssthresh;
+        p->in_recovery = false;
+        p->rack_sent_us = sockfd->rack_sent_us;
+        p->sample_sent_us = 0;
+        p->unanswered_us = 0;
+        p->timeouts = 0;
+        p->probe_deadline_us = 0;
+        return;
+    }
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->rto_us = RUDP_RTO_MS * 1000LL;
+    p->cwnd = sockfd->cwnd_init;
+    p->ssthresh = RUDP_WINDOW;
+}
+
+// Path 0 is whatever dest_addr and socket_fd are at the moment, they move during the handshake
+int rudp_path_fd(RUDP_Socket *sockfd, unsigned int path) {
+    return path == 0 ? sockfd->socket_fd : sockfd->paths[path].fd;
+}
+
+struct sockaddr_in *rudp_path_addr(RUDP_Socket *sockfd, unsigned int path) {
+    return path == 0 ? &sockfd->dest_addr : &sockfd->paths[path].remote;
+}
+
+// Data may go out on the subflow
+bool rudp_path_usable(RUDP_Socket *sockfd, unsigned int path) {
+    RUDP_Path *p = &sockfd->paths[path];
+    if (path == 0) {
+        return !p->dead;
+    }
+    return p->fd >= 0 && p->validated && !p->dead;
+}
+
+// ACKs follow the data back, unless that subflow has died since
+int rudp_control_path(RUDP_Socket *sockfd) {
+    if (sockfd->path_count < 2) {
+        return 0;
+    }
+    if (rudp_path_usable(sockfd, sockfd->ack_path)) {
+        return sockfd->ack_path;
+    }
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        if (rudp_path_usable(sockfd, p)) {
+            return (int)p;
+        }
+    }
+    return 0;
+}
+
+// The subflow a datagram belongs to: the socket it arrived on and the address it came from, -1 if neither is ours
+int rudp_path_lookup(RUDP_Socket *sockfd, int fd, const struct sockaddr_in *from) {
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        struct sockaddr_in *addr = rudp_path_addr(sockfd, p);
+        if (rudp_path_fd(sockfd, p) == fd && addr->sin_addr.s_addr == from->sin_addr.s_addr &&
+            addr->sin_port == from->sin_port) {
+            return (int)p;
+        }
+    }
+    return -1;
+}
+
+/*
+* @brief Server side of a join: a packet from an unknown address whose handshake options echo the connection's
+* cookie opens, or moves, the subflow it names. The cookie is only known to the client the handshake ran with.
+* @return Index of the subflow, -1 if the packet is not a valid join.
+*/
+int rudp_path_join(RUDP_Socket *sockfd, const RUDP_Header *header, const RUDP_Handshake *options,
+                   const struct sockaddr_in *from) {
+    if (!sockfd->isServer || !sockfd->isConnected || sockfd->shm_active || !(header->flags & PATH_FLAG) ||
+        sockfd->cookie == 0 || options->cookie != sockfd->cookie || header->path == 0 || header->path >= RUDP_MAX_PATHS) {
+        return -1;
+    }
+    if (sockfd->path_count == 1) {
+        rudp_path_init(sockfd, 0);
+    }
+    while (sockfd->path_count <= header->path) {
+        rudp_path_init(sockfd, sockfd->path_count); // Joins may arrive out of order, the gaps stay unusable until theirs
+        sockfd->path_count++;
+    }
+    RUDP_Path *path = &sockfd->paths[header->path];
+    if (path->fd < 0) {
+        rudp_path_init(sockfd, header->path);
+    }
+    path->fd = sockfd->socket_fd;
+    path->remote = *from;
+    path->validated = true;
+    printf("path %u joined from %s:%u\n", header->path, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    return header->path;
+}
+
+// A packet arrived on the subflow: it works in both directions, and ACKs for its data go back on it
+void rudp_path_heard(RUDP_Socket *sockfd, int path, const RUDP_Header *header) {
+    RUDP_Path *p = &sockfd->paths[path];
+    if (header->flags & DATA_FLAG) {
+        p->segments_received++;
+    }
+    if (header->flags & (DATA_FLAG | PROBE_FLAG | FIN_FLAG)) {
+        sockfd->ack_path = path;
+    }
+    if (sockfd->path_count < 2) {
+        return;
+    }
+    if (!p->validated) {
+        p->validated = true;
+        if (p->probe_us != 0) {
+            rudp_path_update_rtt(p, rudp_now_us() - p->probe_us);
+        }
+        p->unanswered_us = 0;
+        p->probe_deadline_us = 0;
+        printf("path %d open\n", path);
+    } else if (p->dead) {
+        // Start over as a new subflow would, the old window says nothing about the path now
+        p->dead = false;
+        p->timeouts = 0;
+        p->cwnd = sockfd->cwnd_init;
+        p->cwnd_acked = 0;
+        p->in_recovery = false;
+        p->unanswered_us = 0;
+        p->probe_deadline_us = 0;
+        printf("path %d answers again\n", path);
+    } else if (p->timeouts > 0) {
+        p->timeouts = 0; // Only slow, it slow-starts from the window the timeout left
+        p->unanswered_us = 0;
+    }
+}
+
+// Add every subflow socket to the set, return the highest descriptor
+int rudp_path_fds(RUDP_Socket *sockfd, fd_set *fds) {
+    FD_ZERO(fds);
+    FD_SET(sockfd->socket_fd, fds);
+    int max_fd = sockfd->socket_fd;
+    for (unsigned int p = 1; p < sockfd->path_count; p++) {
+        int fd = sockfd->paths[p].fd;
+        if (fd >= 0 && fd != sockfd->socket_fd) {
+            FD_SET(fd, fds);
+            if (fd > max_fd) {
+                max_fd = fd;
+            }
+        }
+    }
+    return max_fd;
+}
+
+// A readable subflow socket, starting at a different one each time so a busy subflow cannot starve the others
+int rudp_path_readable(RUDP_Socket *sockfd, fd_set *fds) {
+    for (unsigned int i = 0; i < sockfd->path_count; i++) {
+        unsigned int p = (sockfd->path_rr + i) % sockfd->path_count;
+        int fd = rudp_path_fd(sockfd, p);
+        if (fd >= 0 && FD_ISSET(fd, fds)) {
+            sockfd->path_rr = p + 1;
+            return fd;
+        }
+    }
+    return sockfd->socket_fd;
+}
+
+// Segments in the network per subflow: outstanding, neither SACKed nor marked lost
+void rudp_path_pipes(RUDP_Socket *sockfd, unsigned int *pipe) {
+    memset(pipe, 0, RUDP_MAX_PATHS * sizeof(unsigned int));
+    for (unsigned int seq = sockfd->snd_una; seq != sockfd->snd_nxt; seq++) {
+        RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        if (!seg->sacked && !seg->lost) {
+            pipe[sockfd->path_count > 1 ? seg->path : 0]++;
+        }
+    }
+}
+
+/*
+* @brief Scheduler: of the answering subflows with room in their window, the one expected to deliver the next segment first,
+* its smoothed RTT stretched by how much of its window is already in flight. Segments so spread in proportion to
+* each subflow's measured capacity, cwnd / srtt.
+* @param pipe Segments in flight per subflow, NULL to ignore the windows.
+* @param avoid Subflow to use only if it is clearly the best, -1 for none.
+* @return The subflow, -1 if none has room.
+*/
+int rudp_path_pick(RUDP_Socket *sockfd, const unsigned int *pipe, int avoid) {
+    if (sockfd->path_count < 2) {
+        return pipe == NULL || pipe[0] < sockfd->cwnd ? 0 : -1;
+    }
+    // A subflow that timed out waits for its probe to be answered, unless every subflow did
+    bool any_answering = false;
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        if (rudp_path_usable(sockfd, p) && sockfd->paths[p].timeouts == 0) {
+            any_answering = true;
+        }
+    }
+    int best = -1;
+    double best_cost = 0;
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        RUDP_Path *path = &sockfd->paths[p];
+        if (!rudp_path_usable(sockfd, p) || (any_answering && path->timeouts > 0)) {
+            continue;
+        }
+        unsigned int in_flight = pipe != NULL ? pipe[p] : 0;
+        if (pipe != NULL && in_flight >= path->cwnd) {
+            continue;
+        }
+        double srtt = path->srtt_us > 0 ? (double)path->srtt_us : (double)path->rto_us;
+        double cost = srtt * (in_flight + 1) / path->cwnd;
+        if ((int)p == avoid) {
+            cost *= 2;
+        }
+        if (best < 0 || cost < best_cost) {
+            best = (int)p;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+// A segment reached the receiver, SACKed or cumulatively: credit the subflow it went out on
+void rudp_path_delivered(RUDP_Socket *sockfd, RUDP_Segment *seg) {
+    if (sockfd->path_count < 2) {
+        return;
+    }
+    RUDP_Path *path = &sockfd->paths[seg->path];
+    if (seg->sent_us > path->rack_sent_us) {
+        path->rack_sent_us = seg->sent_us;
+    }
+    path->unanswered_us = 0;
+    path->timeouts = 0;
+    if (!seg->retransmitted && seg->sent_us > path->sample_sent_us) {
+        path->sample_sent_us = seg->sent_us; // Karn: a resent segment gives no sample
+    }
+    if (path->in_recovery) {
+        if (seg->sent_us > path->recover_us) {
+            path->in_recovery = false; // Sent after the loss and delivered, the reduced window holds
+        }
+        return;
+    }
+    sockfd->congestion.grow(&path->cwnd, &path->cwnd_acked, path->ssthresh, 1);
+    if (path->cwnd > RUDP_WINDOW) {
+        path->cwnd = RUDP_WINDOW;
+    }
+}
+
+// After an ACK: one RTT sample per subflow, from the newest segment it delivered, as the connection does
+void rudp_path_acked(RUDP_Socket *sockfd, long long now) {
+    for (unsigned int p = 0; sockfd->path_count > 1 && p < sockfd->path_count; p++) {
+        RUDP_Path *path = &sockfd->paths[p];
+        if (path->sample_sent_us != 0) {
+            rudp_path_update_rtt(path, now - path->sample_sent_us);
+            path->sample_sent_us = 0;
+        }
+    }
+}
+
+// Loss detection marked a segment lost: halve its subflow's window, once per loss episode
+void rudp_path_lost(RUDP_Socket *sockfd, RUDP_Segment *seg, long long now) {
+    RUDP_Path *path = &sockfd->paths[sockfd->path_count > 1 ? seg->path : 0];
+    path->segments_lost++;
+    if (sockfd->path_count < 2 || path->in_recovery) {
+        return;
+    }
+    path->in_recovery = true;
+    path->recover_us = now;
+    sockfd->congestion.reduce(&path->cwnd, &path->ssthresh, path->cwnd, false);
+    path->cwnd_acked = 0;
+}
+
+// RFC 6298, per subflow
+void rudp_path_update_rtt(RUDP_Path *path, long long sample_us) {
+    if (sample_us <= 0) {
+        sample_us = 1;
+    }
+    if (path->srtt_us == 0) {
+        path->srtt_us = sample_us;
+        path->rttvar_us = sample_us / 2;
+    } else {
+        long long delta = path->srtt_us > sample_us ? path->srtt_us - sample_us : sample_us - path->srtt_us;
+        path->rttvar_us = (3 * path->rttvar_us + delta) / 4;
+        path->srtt_us = (7 * path->srtt_us + sample_us) / 8;
+    }
+    path->rto_us = path->srtt_us + 4 * path->rttvar_us;
+    if (path->rto_us < RUDP_MIN_RTO_MS * 1000LL) {
+        path->rto_us = RUDP_MIN_RTO_MS * 1000LL;
+    }
+    if (path->rto_us > RUDP_MAX_RTO_MS * 1000LL) {
+        path->rto_us = RUDP_MAX_RTO_MS * 1000LL;
+    }
+}
+
+// With subflows the connection's own timeout is a backstop: twice the slowest live subflow's, so theirs act first
+long long rudp_path_rto(RUDP_Socket *sockfd) {
+    if (sockfd->path_count < 2) {
+        return sockfd->rto_us;
+    }
+    long long rto_us = sockfd->rto_us;
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        if (rudp_path_usable(sockfd, p) && sockfd->paths[p].rto_us > rto_us) {
+            rto_us = sockfd->paths[p].rto_us;
+        }
+    }
+    return 2 * rto_us;
+}
+
+// Next subflow timer: a join or probe to send, or a subflow's timeout. 0 if none is armed.
+long long rudp_path_wake(RUDP_Socket *sockfd) {
+    long long wake_us = 0;
+    for (unsigned int p = 0; sockfd->path_count > 1 && p < sockfd->path_count; p++) {
+        RUDP_Path *path = &sockfd->paths[p];
+        long long deadline_us = path->probe_deadline_us;
+        if (rudp_path_usable(sockfd, p) && path->unanswered_us != 0 &&
+            (deadline_us == 0 || path->unanswered_us + path->rto_us < deadline_us)) {
+            deadline_us = path->unanswered_us + path->rto_us;
+        }
+        if (deadline_us != 0 && (wake_us == 0 || deadline_us < wake_us)) {
+            wake_us = deadline_us;
+        }
+    }
+    return wake_us;
+}
+
+// Ask the peer to answer on the subflow: a join from the client, which also re-registers it, a plain probe from the server
+int rudp_path_probe(RUDP_Socket *sockfd, unsigned int path) {
+    int flags = ACK_FLAG | PROBE_FLAG | (sockfd->isServer ? 0 : PATH_FLAG);
+    if (rudp_send_control(sockfd, flags, path) < 0) {
+        return -1;
+    }
+    RUDP_Path *p = &sockfd->paths[path];
+    long long now = rudp_now_us();
+    p->probe_us = now;
+    if (p->unanswered_us == 0) {
+        p->unanswered_us = now;
+    }
+    // Joins and dead subflows are asked again at a fixed interval, a subflow that timed out once its RTO is up
+    p->probe_deadline_us = !p->validated || p->dead ? now + RUDP_PATH_PROBE_MS * 1000LL : 0;
+    return 1;
+}
+
+// Nothing sent on the subflow was answered for an RTO: its segments are lost and go to the others, and it is
+// probed before it gets more. After RUDP_PATH_TIMEOUTS in a row it is left for dead and probed less often.
+void rudp_path_timeout(RUDP_Socket *sockfd, unsigned int path, long long now) {
+    RUDP_Path *p = &sockfd->paths[path];
+    for (unsigned int seq = sockfd->snd_una; seq != sockfd->snd_nxt; seq++) {
+        RUDP_Segment *seg = sockfd->snd_queue[seq % RUDP_SND_SEGS];
+        if (seg->path == path && !seg->sacked && !seg->lost) {
+            seg->lost = true;
+            p->segments_lost++;
+        }
+    }
+    sockfd->congestion.reduce(&p->cwnd, &p->ssthresh, p->cwnd, true);
+    p->cwnd_acked = 0;
+    p->in_recovery = false;
+    p->rto_us *= 2;
+    if (p->rto_us > RUDP_MAX_RTO_MS * 1000LL) {
+        p->rto_us = RUDP_MAX_RTO_MS * 1000LL;
+    }
+    p->unanswered_us = 0;
+    p->timeouts++;
+    if (p->timeouts >= RUDP_PATH_TIMEOUTS) {
+        p->dead = true;
+        p->probe_deadline_us = now + RUDP_PATH_PROBE_MS * 1000LL;
+        printf("path %u is not responding, moving its data to the other paths\n", path);
+    }
+}
+
+/*
+* @brief Fire the subflow timers: joins and probes that are due, and timeouts of subflows that stopped delivering.
+* @return 1 on success, -1 on error.
+*/
+int rudp_path_timers(RUDP_Socket *sockfd) {
+    if (sockfd->path_count < 2) {
+        return 1;
+    }
+    long long now = rudp_now_us();
+    bool moved = false;
+    for (unsigned int p = 0; p < sockfd->path_count; p++) {
+        RUDP_Path *path = &sockfd->paths[p];
+        if (rudp_path_fd(sockfd, p) < 0) {
+            continue;
+        }
+        if (path->probe_deadline_us != 0 && now >= path->probe_deadline_us && rudp_path_probe(sockfd, p) < 0) {
+            return -1;
+        }
+        if (!rudp_path_usable(sockfd, p)) {
+            continue;
+        }
+        if (path->unanswered_us != 0 && now - path->unanswered_us >= path->rto_us) {
+            rudp_path_timeout(sockfd, p, now);
+            if (rudp_path_probe(sockfd, p) < 0) {
+                return -1;
+            }
+            moved = true;
+        }
+    }
+    return moved ? rudp_pump(sockfd) : 1;
+}
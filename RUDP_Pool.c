@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "RUDP_Pool.h"
+
+#define POOL_MAX_WORKERS 8
+
+// Fork-join pool shared by all sockets, one batch at a time
+static pthread_mutex_t pool_dispatch = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static int pool_workers = -1;        // Started worker threads, -1 before the first batch
+static void (*pool_fn)(void *job);
+static char *pool_jobs;
+static size_t pool_job_size;
+static int pool_count;               // Jobs in the current batch
+static int pool_next;                // Next job to hand out
+static int pool_finished;            // Jobs of the batch completed
+
+// Take jobs until the batch is handed out, pool_lock held on entry and exit
+static void pool_drain(void) {
+    while (pool_next < pool_count) {
+        int job = pool_next++;
+        pthread_mutex_unlock(&pool_lock);
+        pool_fn(pool_jobs + (size_t)job * pool_job_size);
+        pthread_mutex_lock(&pool_lock);
+        if (++pool_finished == pool_count) {
+            pthread_cond_broadcast(&pool_done);
+        }
+    }
+}
+
+static void *pool_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    while (true) {
+        while (pool_next >= pool_count) {
+            pthread_cond_wait(&pool_work, &pool_lock);
+        }
+        pool_drain();
+    }
+    return NULL;
+}
+
+void rudp_parallel(void (*fn)(void *job), void *jobs, size_t job_size, int count) {
+    pthread_mutex_lock(&pool_dispatch);
+    if (pool_workers < 0) {
+        // One worker per spare core, the caller works too
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int wanted = cores > 1 ? (int)(cores - 1 < POOL_MAX_WORKERS ? cores - 1 : POOL_MAX_WORKERS) : 0;
+        pool_workers = 0;
+        for (int i = 0; i < wanted; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, pool_worker, NULL) != 0) {
+                break; // Fewer workers, the caller picks up the slack
+            }
+            pthread_detach(thread);
+            pool_workers++;
+        }
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    pool_fn = fn;
+    pool_jobs = (char *)jobs;
+    pool_job_size = job_size;
+    pool_count = count;
+    pool_next = 0;
+    pool_finished = 0;
+    if (count > 1 && pool_workers > 0) {
+        pthread_cond_broadcast(&pool_work);
+    }
+    pool_drain();
+    while (pool_finished < pool_count) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pool_count = 0;
+    pool_next = 0;
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&pool_dispatch);
+}
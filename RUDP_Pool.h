@@ -0,0 +1,10 @@
+#ifndef RUDP_POOL_H
+#define RUDP_POOL_H
+
+#include <stddef.h>
+
+// Run fn on each of count jobs of job_size bytes, spread over the worker threads and the caller, and wait for all of them.
+// The workers are started with the first batch, one per spare core.
+void rudp_parallel(void (*fn)(void *job), void *jobs, size_t job_size, int count);
+
+#endif /* RUDP_POOL_H */
@@ -11,23 +11,116 @@
 
 #define DEFAULT_PORT 4567 // Port number to listen on
 #define DEFAULT_IP "127.0.0.1"
+#define GROUP_MAX_FILE (64 * 1024 * 1024) // Largest file a group run may carry
+#define USAGE "Usage: %s -p <PORT> [-checkpoint <DIR>] [-group <IP> [-if <LOCAL IP>]]\n"
 
-int main(int argc, char *argv[]) {
-    // Check the number of command-line arguments
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s -p <PORT>\n", argv[0]);
+// Called once the connection's FIN exchange is over
+void report_close(const RUDP_Close_Result *result, void *arg) {
+    (void)arg;
+    if (result->status == RUDP_CLOSE_OK) {
+        printf("Connection closed after %.1fms\n", result->duration_us / 1000.0);
+    } else {
+        printf("Connection closed with status %d after %.1fms\n", result->status, result->duration_us / 1000.0);
+    }
+}
+
+/*
+* @brief Receive the runs a sender distributes to a group: a multicast group, or the sender's address for a fan-out.
+* Several receivers share one directory, so the runs are only checked and summarized, not written out.
+* @return EXIT_SUCCESS or EXIT_FAILURE.
+*/
+int receive_group(const char *group_ip, unsigned short port, const char *local_ip) {
+    RUDP_Group *group = rudp_group_open(false, group_ip, port, local_ip);
+    char *buffer = (char *)malloc(GROUP_MAX_FILE);
+    if (group == NULL || buffer == NULL) {
+        fprintf(stderr, "Error: Failed to join the group\n");
+        rudp_group_close(group);
+        free(buffer);
         return EXIT_FAILURE;
     }
+    printf("Waiting for the group's sender...\n");
+
+    int run_counter = 0;
+    int size;
+    while ((size = rudp_group_recv(group, buffer, GROUP_MAX_FILE)) > 0) {
+        unsigned char digest[RUDP_HASH_SIZE];
+        rudp_sha256(buffer, size, digest);
+        printf("Run #%d: %d bytes, SHA-256 %02x%02x%02x%02x...\n", ++run_counter, size, digest[0], digest[1],
+               digest[2], digest[3]);
+    }
+    if (size < 0) {
+        fprintf(stderr, "Error: Failed to receive data\n");
+    }
+
+    RUDP_Group_Stats stats;
+    rudp_group_get_stats(group, &stats);
+    printf("----------------------------------\n");
+    printf("- Runs received: %d\n", run_counter);
+    printf("- Segments received: %lu; duplicates: %lu\n", stats.segments_received, stats.duplicates);
+    printf("- NACKs sent: %lu; missing segments left to other receivers' NACKs: %lu\n", stats.nacks_sent,
+           stats.segments_suppressed);
+    printf("----------------------------------\n");
+    rudp_group_close(group);
+    free(buffer);
+    printf("Receiver program finished\n");
+    return size < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+* @brief Open <dir>/<name> for a file of the session, next to its checkpoint. A resumed file is opened in place
+* and the blocks an earlier attempt stored are read into content, the rest arrives as data.
+* @return The open file, NULL on error.
+*/
+FILE *open_stored(const char *dir, const RUDP_File_Info *info, unsigned long long resumed, char *content) {
+    char path[2 * RUDP_NAME_MAX];
+    int n = snprintf(path, sizeof(path), "%s/", dir);
+    for (int i = 0; info->name[i] != '\0' && n >= 0 && (size_t)n + 1 < sizeof(path); i++) {
+        path[n++] = info->name[i] == '/' ? '_' : info->name[i]; // Flattened like the checkpoint's name
+    }
+    path[n] = '\0';
+
+    FILE *file = fopen(path, resumed > 0 ? "r+b" : "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Failed to open %s, a checkpoint without its file cannot be resumed\n", path);
+        return NULL;
+    }
+    if (resumed > 0 && content != NULL) {
+        size_t stored = fread(content, 1, info->size, file); // Blocks the sender skips, gaps come as data
+        (void)stored;
+        printf("Resuming %s: %llu of %llu bytes already stored\n", path, resumed, info->size);
+    }
+    return file;
+}
 
+int main(int argc, char *argv[]) {
     unsigned short port = DEFAULT_PORT;
+    char *group_ip = NULL, *local_ip = NULL;
+    char *checkpoint_dir = NULL; // Write each file there under its name and resume it after an interruption
+    bool have_port = false;
 
     // Parse command-line arguments
-    if (strcmp(argv[1], "-p") == 0 && argc == 3) {
-        port = atoi(argv[2]);
-    } else {
-        fprintf(stderr, "Usage: %s -p <port>\n", argv[0]);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+            have_port = true;
+        } else if (strcmp(argv[i], "-group") == 0 && i + 1 < argc) {
+            group_ip = argv[++i];
+        } else if (strcmp(argv[i], "-if") == 0 && i + 1 < argc) {
+            local_ip = argv[++i];
+        } else if (strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) {
+            checkpoint_dir = argv[++i];
+        } else {
+            have_port = false;
+            break;
+        }
+    }
+    if (!have_port) {
+        fprintf(stderr, USAGE, argv[0]);
         return EXIT_FAILURE;
     }
+    if (group_ip != NULL) {
+        return receive_group(group_ip, port, local_ip);
+    }
 
     // Create a UDP connection between the Receiver and the Sender
     RUDP_Socket *sockfd = rudp_socket(true, port); // Create a server socket
@@ -35,6 +128,11 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Failed to create UDP socket\n");
         return EXIT_FAILURE;
     }
+    if (checkpoint_dir != NULL && rudp_session_set_checkpoint(sockfd, checkpoint_dir) < 0) {
+        fprintf(stderr, "Error: Bad checkpoint directory %s\n", checkpoint_dir);
+        rudp_close(sockfd);
+        return EXIT_FAILURE;
+    }
     struct sockaddr_in sndr_addr;
     socklen_t addr_len = sizeof(sndr_addr);
     memset(&sndr_addr, 0, addr_len);
@@ -56,80 +154,148 @@ int main(int argc, char *argv[]) {
     printf("- * Statistics For  Each Run * -\n");
 
 
-    // Receive the file
-    char buffer[2097152]; // Buffer to store received data
+    // Receive the files of the session, one per run
+    static char buffer[sizeof(RUDP_Record) + RUDP_SESSION_BLOCK]; // One session record
 
-    FILE *output_file = fopen("received_file.txt", "wb"); // Open file for writing
-    if (output_file == NULL) {
+    // All runs go one after another into received_file.txt, or with a checkpoint directory each file into its own
+    FILE *output_file = checkpoint_dir == NULL ? fopen("received_file.txt", "wb") : NULL;
+    if (checkpoint_dir == NULL && output_file == NULL) {
         fprintf(stderr, "Error: Failed to open output file\n");
         rudp_close(sockfd);
         return EXIT_FAILURE;
     }
 
+    // The last completed run, the basis the sender matches the next one against
+    char *basis = NULL, *current = NULL;
+    size_t basis_size = 0;
+
+    long run_start = 0; // Where the current run begins in the output file
+    unsigned long long run_bytes = 0; // Data bytes the current run brought
+
     struct timeval start, end;
     double total_time = 0.0;
     int run_counter = 0;
     double total_bandwidth = 0.0;
 
     while (true) {
-        int bytes_received;
-        gettimeofday(&start, NULL); // Start measuring time
-        for(int i=0;i<50;i++) {// 2MB/50000==42
-
-            bytes_received = rudp_rcv_file_1(sockfd, buffer, sizeof (buffer), &sndr_addr, addr_len);
-            // Check for "EXIT" message
-            if (strncmp(buffer, "EXIT", 4) == 0) {
-                printf("Received EXIT message from sender. Exiting...\n");
-                break;
-            }}
-        if (bytes_received < 0) {
+        RUDP_Session_Event event;
+        int result = rudp_session_recv(sockfd, &event, buffer, sizeof(buffer));
+        if (result < 0) {
             fprintf(stderr, "Error: Failed to receive data\n");
-            fclose(output_file);
+            if (output_file != NULL) {
+                fclose(output_file);
+            }
             rudp_close(sockfd);
             return EXIT_FAILURE;
-        } else if (bytes_received == 0) {
-            break; // End of file or connection closed
+        } else if (result == 0) {
+            break; // Connection closed
         }
 
-        // Check for "EXIT" message
-        if (strncmp(buffer, "EXIT", 4) == 0) {
-            printf("Received EXIT message from sender. Exiting...\n");
+        if (event.type == RUDP_REC_MANIFEST) {
+            for (unsigned int id = event.file_id; basis != NULL && id < event.file_id + event.length; id++) {
+                rudp_session_set_basis(sockfd, id, basis, basis_size);
+            }
+        } else if (event.type == RUDP_REC_FILE_START) {
+            gettimeofday(&start, NULL); // Start measuring time
+            free(current);
+            current = (char *)malloc(event.info->size > 0 ? event.info->size : 1);
+            run_bytes = 0;
+            if (checkpoint_dir != NULL) {
+                if (output_file != NULL) {
+                    fclose(output_file);
+                }
+                output_file = open_stored(checkpoint_dir, event.info, event.resumed, current);
+                if (output_file == NULL) {
+                    rudp_close(sockfd);
+                    return EXIT_FAILURE;
+                }
+                run_start = 0;
+            } else {
+                fseek(output_file, 0, SEEK_END);
+                run_start = ftell(output_file);
+            }
+        } else if (event.type == RUDP_REC_FILE_DATA) {
+            // Write received data to file, blocks that failed verification come again at their offset
+            fseek(output_file, run_start + (long)event.offset, SEEK_SET);
+            fwrite(event.data, 1, event.length, output_file);
+            fflush(output_file); // The checkpoint counts the block as stored once we ask for the next record
+            run_bytes += event.length;
+            if (current != NULL) {
+                memcpy(current + event.offset, event.data, event.length);
+            }
+        } else if (event.type == RUDP_REC_VERIFY) {
+            printf("%s failed verification, waiting for the damaged blocks\n", event.info->name);
+        } else if (event.type == RUDP_REC_FILE_END) {
+            gettimeofday(&end, NULL); // Stop measuring time
+            if (event.status != RUDP_FILE_OK) {
+                printf("%s failed with status %d\n", event.info->name, event.status);
+                continue;
+            }
+            if (current != NULL) {
+                free(basis);
+                basis = current;
+                basis_size = event.info->size;
+                current = NULL;
+            }
+            double elapsed_time = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+            double bandwidth = (event.info->size / elapsed_time) * 1000.0 / (1024 * 1024); // MB/s
+            total_time += elapsed_time;
+            total_bandwidth += bandwidth;
+            run_counter++;
+
+            printf("Run #%d: %llu of %llu bytes received; Time=%.1fms; Bandwidth=%.2fMB/s\n", run_counter, run_bytes,
+                   event.info->size, elapsed_time, bandwidth);
+        } else if (event.type == RUDP_REC_SESSION_END) {
+            printf("Sender finished the session. Exiting...\n");
             break;
         }
+    }
 
-        // Write received data to file
-        fwrite(buffer, 1, bytes_received, output_file);
-
-        gettimeofday(&end, NULL); // Stop measuring time
-        double elapsed_time = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
-        double bandwidth = ((2097152) / elapsed_time) * 1000.0 / (1024 * 1024); // MB/s
-        total_time += elapsed_time;
-        total_bandwidth += bandwidth;
-        run_counter++;
-
-        printf("Run #%d: Time=%.1fms; Bandwidth=%.2fMB/s\n", run_counter, elapsed_time, bandwidth);
-
+    // Counters first, the socket is gone once the close finishes
+    RUDP_Stats stats;
+    bool have_stats = rudp_get_stats(sockfd, &stats) > 0;
+    RUDP_Path_Stats paths[RUDP_MAX_PATHS];
+    unsigned int path_count = 0;
+    while (path_count < RUDP_MAX_PATHS && rudp_get_path_stats(sockfd, path_count, &paths[path_count]) > 0) {
+        path_count++;
     }
 
-    // Close the connection
+    // Close the connection, the FIN exchange finishes in the background
+    rudp_set_close_callback(sockfd, report_close, NULL);
     if (rudp_recv_close(sockfd, &sndr_addr, addr_len, false) < 0) {
         perror("close failed");
         return EXIT_FAILURE;
     }
 
-    fclose(output_file); // Close the output file
+    if (output_file != NULL) {
+        fclose(output_file); // Close the output file
+    }
+    free(current);
 
     // Calculate average time and total average bandwidth
-    double average_time = total_time / run_counter;
-    double average_bandwidth = total_bandwidth / run_counter;
+    double average_time = run_counter > 0 ? total_time / run_counter : 0.0;
+    double average_bandwidth = run_counter > 0 ? total_bandwidth / run_counter : 0.0;
 
     printf("----------------------------------\n");
     printf("- * Statistics For All Runs * -\n");
     printf("-\n");
     printf("- Average time: %.1fms\n", average_time);
     printf("- Average bandwidth: %.2fMB/s\n", average_bandwidth);
+    if (have_stats) {
+        printf("- Segments received: %lu; ACKs sent: %lu\n", stats.segments_received, stats.acks_sent);
+        printf("- Window updates sent: %lu\n", stats.window_updates);
+        printf("- Socket buffers granted: rcv %lu, snd %lu bytes; kernel drops: %lu\n",
+               stats.rcvbuf_bytes, stats.sndbuf_bytes, stats.rx_queue_drops);
+        printf("- Shared memory: %lu bytes received, %lu sent\n", stats.shm_bytes_received, stats.shm_bytes_sent);
+    }
+    for (unsigned int p = 0; path_count > 1 && p < path_count; p++) {
+        printf("- Path %u (%s:%u): %lu segments received%s\n", p, inet_ntoa(paths[p].remote.sin_addr),
+               ntohs(paths[p].remote.sin_port), paths[p].segments_received, paths[p].dead ? ", dead" : "");
+    }
     printf("----------------------------------\n");
 
+    rudp_wait_closed();
+    free(basis);
     printf("Receiver program finished\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Resume test for the shipped programs: a transfer through a rate-limited RUDP_Impair is cut off by killing the
+# Receiver mid-file, then a second session with the same checkpoint directory must bring only the blocks the first
+# one did not store, and the file must arrive whole. Run by make resume.
+
+PORT=4600            # The Receiver listens here, the relay on PORT + 1
+SIZE_KB=4096
+RATE_KB=1024         # Relay rate of the first session, slow enough to interrupt it
+KILL_AFTER=2         # Seconds into the first session
+WORK=$(mktemp -d)
+trap 'kill $RELAY $RECEIVER $SENDER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/checkpoints"
+head -c $((SIZE_KB * 1024)) /dev/urandom > "$WORK/payload.bin"
+
+# First session: killed part way through
+./RUDP_Impair -listen 127.0.0.1:$((PORT + 1)) -to 127.0.0.1:$PORT -rate $RATE_KB > /dev/null &
+RELAY=$!
+./RUDP_Receiver -p $PORT -checkpoint "$WORK/checkpoints" > "$WORK/first.log" 2>&1 &
+RECEIVER=$!
+sleep 0.2
+echo n | ./RUDP_Sender -ip 127.0.0.1 -p $((PORT + 1)) -udp -file "$WORK/payload.bin" > /dev/null 2>&1 &
+SENDER=$!
+sleep $KILL_AFTER
+kill -9 $RECEIVER
+kill $SENDER $RELAY
+wait 2>/dev/null
+
+# Second session: straight to the Receiver
+./RUDP_Receiver -p $PORT -checkpoint "$WORK/checkpoints" > "$WORK/second.log" 2>&1 &
+RECEIVER=$!
+sleep 0.2
+echo n | ./RUDP_Sender -ip 127.0.0.1 -p $PORT -udp -file "$WORK/payload.bin" > "$WORK/sender.log" 2>&1
+wait $RECEIVER
+
+stored=$(sed -n 's/^Resuming .*: \([0-9]*\) of [0-9]* bytes already stored$/\1/p' "$WORK/second.log")
+received=$(sed -n 's/^Run #1: \([0-9]*\) of [0-9]* bytes received.*/\1/p' "$WORK/second.log")
+total=$((SIZE_KB * 1024))
+echo "stored by the first session: ${stored:-0} bytes; sent by the second: ${received:-none} of $total"
+if [ -z "$stored" ] || [ "$stored" -eq 0 ] || [ "$stored" -ge $total ]; then
+    echo "resume FAILED: the first session left no partial checkpoint"
+    exit 1
+fi
+if [ "$received" != $((total - stored)) ]; then
+    echo "resume FAILED: the second session resent stored blocks"
+    cat "$WORK/second.log"
+    exit 1
+fi
+if ! cmp -s "$WORK/payload.bin" "$WORK/checkpoints/payload.bin"; then
+    echo "resume FAILED: the file differs from what was sent"
+    exit 1
+fi
+echo "resume ok"
@@ -5,10 +5,15 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "RUDP_API.h" // Include the RUDP API header file
 #define DEFAULT_IP "127.0.0.1" // Receiver's IP address
 #define DEFAULT_PORT 4567 // Port number of the receiver
+#define FILE_SIZE 2097152 // 2MB
+#define USAGE "Usage: %s -ip <IP> -p <PORT> [-fec <K>,<M>] [-lz] [-udp] [-file <PATH>] " \
+              "[-path <LOCAL IP>[,<IP>:<PORT>]]... [-group <RECEIVERS> [-if <LOCAL IP>]]\n"
+#define GROUP_WAIT_MS 30000 // Longest wait for the receivers of a group to show up
 
 /*
 * @brief A random data generator function based on srand() and rand().
@@ -32,16 +37,133 @@ char *util_generate_random_data(unsigned int size) {
     return buffer;
 }
 
+/*
+* @brief Read a whole file and describe it for the manifest under its base name, with its size, mode and mtime.
+* @return A pointer to the content, NULL on error.
+*/
+char *util_read_file(const char *path, RUDP_File_Info *info) {
+    struct stat st;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL || fstat(fileno(file), &st) < 0 || st.st_size > 0xffffffffLL) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        return NULL;
+    }
+    char *buffer = (char *)malloc(st.st_size > 0 ? st.st_size : 1);
+    if (buffer == NULL || fread(buffer, 1, st.st_size, file) != (size_t)st.st_size) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    const char *name = strrchr(path, '/');
+    snprintf(info->name, sizeof(info->name), "%s", name != NULL ? name + 1 : path);
+    info->size = st.st_size;
+    info->mode = st.st_mode & 0777;
+    info->mtime = (long long)st.st_mtime;
+    return buffer;
+}
+
+/*
+* @brief Send the data as one more file of the session and wait until the receiver has all of it.
+* The receiver keeps the previous run as a basis, so repeated runs mostly travel as block references,
+* and checks every run against its Merkle root. The content hash lets a receiver with a checkpoint of the
+* same file skip the blocks it already stored. A file without a name goes out as run-<N>.
+* @return 1 on success, -1 on error.
+*/
+int send_run(RUDP_Socket *sockfd, const RUDP_File_Info *file, char *data, int run) {
+    RUDP_File_Info info = *file;
+    if (info.name[0] == '\0') {
+        snprintf(info.name, sizeof(info.name), "run-%d", run);
+    }
+    info.flags = RUDP_FILE_DELTA | RUDP_FILE_VERIFY; // Runs after the first only send what the receiver's copy lacks
+
+    int file_id = rudp_session_manifest(sockfd, &info, 1);
+    if (file_id < 0 || rudp_session_set_source(sockfd, file_id, data, info.size) < 0 ||
+        rudp_session_start_file(sockfd, file_id) < 0 ||
+        rudp_session_write(sockfd, file_id, data, info.size) < 0 ||
+        rudp_session_end_file(sockfd, file_id, RUDP_FILE_OK) < 0) {
+        return -1;
+    }
+    // Drain before waiting on the user, nothing is sent while we block on the prompt
+    if (rudp_session_wait(sockfd, file_id) != RUDP_FILE_DONE) {
+        return -1;
+    }
+    unsigned long long resumed = sockfd->session->files[file_id].resumed;
+    if (resumed > 0) {
+        printf("Run #%d: %llu of %llu bytes were already at the receiver\n", run, resumed, info.size);
+    }
+    return 1;
+}
+
+/*
+* @brief Distribute the data to a group: -ip and -p name a multicast group, or this host's address that receivers
+* join for a unicast fan-out. Every run goes out once to all receivers, whatever they miss is repaired.
+* @return EXIT_SUCCESS or EXIT_FAILURE.
+*/
+int send_group(const char *group_ip, unsigned short port, const char *local_ip, unsigned int receivers,
+               char *data, unsigned int size) {
+    RUDP_Group *group = rudp_group_open(true, group_ip, port, local_ip);
+    if (group == NULL) {
+        fprintf(stderr, "Error: Failed to open the group\n");
+        return EXIT_FAILURE;
+    }
+    printf("waiting for %u receivers...\n", receivers);
+    int members = rudp_group_wait_members(group, receivers, GROUP_WAIT_MS);
+    if (members <= 0) {
+        fprintf(stderr, "Error: No receivers joined the group\n");
+        rudp_group_close(group);
+        return EXIT_FAILURE;
+    }
+
+    char choice = 'y';
+    for (int run = 1; choice == 'y'; run++) {
+        long long start_us = rudp_now_us();
+        int done = rudp_group_send(group, data, size);
+        if (done < 0) {
+            fprintf(stderr, "Error: Failed to send file\n");
+            rudp_group_close(group);
+            return EXIT_FAILURE;
+        }
+        double elapsed_ms = (rudp_now_us() - start_us) / 1000.0;
+        printf("Run #%d: %d of %d receivers complete, Time=%.1fms; Bandwidth=%.2fMB/s\n", run, done, members,
+               elapsed_ms, size / elapsed_ms * 1000.0 / (1024 * 1024));
+
+        do {
+            printf("Do you want to send the file again? (y/n): ");
+            scanf(" %c", &choice);
+        } while (choice != 'y' && choice != 'n');
+    }
+
+    RUDP_Group_Stats stats;
+    rudp_group_get_stats(group, &stats);
+    printf("- Segments sent: %lu; repairs: %lu for %lu NACKs\n", stats.segments_sent, stats.repairs_sent,
+           stats.nacks_received);
+    rudp_group_close(group);
+    printf("Sender program finished\n");
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
 
     // Check the number of command-line arguments
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <IP> <PORT>\n", argv[0]);
+    if (argc < 5) {
+        fprintf(stderr, USAGE, argv[0]);
         return EXIT_FAILURE;
     }
 
     char *receiver_ip = DEFAULT_IP;
     unsigned short receiver_port = DEFAULT_PORT;
+    unsigned int fec_k = 0, fec_m = 0; // FEC off unless asked for
+    bool compress = false;
+    bool shared_memory = true; // A receiver on this host is reached through shared memory unless -udp is given
+    char *paths[RUDP_MAX_PATHS - 1]; // Extra subflows: a local address, optionally the remote address it talks to
+    int path_count = 0;
+    unsigned int group_receivers = 0; // Distribute to this many receivers instead of connecting to one
+    char *local_ip = NULL;
+    char *file_path = NULL; // Send this file instead of random data
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
@@ -51,8 +173,28 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
             receiver_port = atoi(argv[i + 1]);
             i++;
+        } else if (strcmp(argv[i], "-fec") == 0 && i + 1 < argc &&
+                   sscanf(argv[i + 1], "%u,%u", &fec_k, &fec_m) == 2) {
+            i++;
+        } else if (strcmp(argv[i], "-lz") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "-udp") == 0) {
+            shared_memory = false;
+        } else if (strcmp(argv[i], "-file") == 0 && i + 1 < argc) {
+            file_path = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "-path") == 0 && i + 1 < argc && path_count < RUDP_MAX_PATHS - 1) {
+            paths[path_count++] = argv[i + 1];
+            shared_memory = false; // Subflows are UDP
+            i++;
+        } else if (strcmp(argv[i], "-group") == 0 && i + 1 < argc &&
+                   sscanf(argv[i + 1], "%u", &group_receivers) == 1 && group_receivers > 0) {
+            i++;
+        } else if (strcmp(argv[i], "-if") == 0 && i + 1 < argc) {
+            local_ip = argv[i + 1];
+            i++;
         } else {
-            fprintf(stderr, "Usage: %s -ip <IP> -p <port>\n", argv[0]);
+            fprintf(stderr, USAGE, argv[0]);
             return EXIT_FAILURE;
         }
     }
@@ -75,9 +217,31 @@ int main(int argc, char *argv[]) {
     receiver_addr.sin_port = htons(receiver_port);
 
 
-    // Read the created file
-    char *file_data = util_generate_random_data(2097152); // Generate random data for a 2MB file
+    // Read the file, or generate random data for a 2MB one
+    RUDP_File_Info file_info;
+    memset(&file_info, 0, sizeof(file_info));
+    char *file_data;
+    if (file_path != NULL) {
+        file_data = util_read_file(file_path, &file_info);
+        if (file_data == NULL) {
+            fprintf(stderr, "Error: Failed to read %s\n", file_path);
+            return EXIT_FAILURE;
+        }
+    } else {
+        file_data = util_generate_random_data(FILE_SIZE);
+        file_info.size = FILE_SIZE;
+        file_info.mode = 0644;
+        file_info.mtime = (long long)time(NULL);
+    }
+    unsigned int file_size = (unsigned int)file_info.size;
+    if (group_receivers > 0) {
+        int status = send_group(receiver_ip, receiver_port, local_ip, group_receivers, file_data, file_size);
+        free(file_data);
+        return status;
+    }
 
+    // Content hash of the file, what makes it resumable
+    rudp_sha256(file_data, file_size, file_info.hash);
 
     // Create a UDP socket between the Sender and the Receiver
     RUDP_Socket *sender_socket = rudp_socket(false, receiver_port); // Create a client socket
@@ -86,6 +250,12 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
     printf("sender socket created\n");
+    if ((fec_k > 0 || fec_m > 0) && rudp_set_fec(sender_socket, fec_k, fec_m) < 0) {
+        fprintf(stderr, "Error: FEC needs 1..%d data and 1..%d parity segments per group\n", RUDP_FEC_MAX_K, RUDP_FEC_MAX_M);
+        return EXIT_FAILURE;
+    }
+    rudp_set_compression(sender_socket, compress);
+    rudp_set_shared_memory(sender_socket, shared_memory);
 
     // Connect to the Receiver
     int connect_status = rudp_connect(sender_socket, &receiver_addr, sizeof(receiver_addr), receiver_ip , receiver_port);
@@ -96,21 +266,27 @@ int main(int argc, char *argv[]) {
     } else {
         printf("Connected to the Receiver\n");
     }
-
-    // Send the file via the RUDP protocol
-    int chunk_size = 2097152 / 50;
-    for (int i = 0; i < 50; ++i) {
-        int offset = i * chunk_size;
-        int bytes_sent = rudp_send_file_1(sender_socket, file_data + offset, chunk_size, receiver_ip , receiver_port);
-        if (bytes_sent < 0) {
-            fprintf(stderr, "Error: Failed to send file\n");
-            free(file_data);
+    for (int i = 0; i < path_count; i++) {
+        // <local IP> alone reaches the receiver's own address, <local IP>,<IP>:<PORT> somewhere else, e.g. a relay
+        char local_ip[64], remote_ip[64];
+        unsigned int remote_port = 0;
+        int fields = sscanf(paths[i], "%63[^,],%63[^:]:%u", local_ip, remote_ip, &remote_port);
+        if (fields < 1 || fields == 2 ||
+            rudp_add_path(sender_socket, local_ip, fields == 3 ? remote_ip : NULL, (unsigned short)remote_port) < 0) {
+            fprintf(stderr, "Error: Failed to add path %s\n", paths[i]);
             rudp_close(sender_socket);
             return EXIT_FAILURE;
         }
     }
 
-
+    // Send the file via the RUDP protocol, every run is one file of the session
+    int run = 0;
+    if (send_run(sender_socket, &file_info, file_data, ++run) < 0) {
+        fprintf(stderr, "Error: Failed to send file\n");
+        free(file_data);
+        rudp_close(sender_socket);
+        return EXIT_FAILURE;
+    }
 
     // User decision: Send the file again?
     char choice;
@@ -121,29 +297,23 @@ int main(int argc, char *argv[]) {
             break;
         } else if (choice == 'y') {
             // Resend the file
-            for (int i = 0; i < 50; ++i) {
-                int offset = i * chunk_size;
-                int bytes_sent = rudp_send_file_1(sender_socket, file_data + offset, chunk_size, receiver_ip , receiver_port);
-                if (bytes_sent < 0) {
-                    fprintf(stderr, "Error: Failed to send file\n");
-                    free(file_data);
-                    rudp_close(sender_socket);
-                    return EXIT_FAILURE;
-                }
+            if (send_run(sender_socket, &file_info, file_data, ++run) < 0) {
+                fprintf(stderr, "Error: Failed to send file\n");
+                free(file_data);
+                rudp_close(sender_socket);
+                return EXIT_FAILURE;
             }
         }
     } while (choice == 'y');
 
-    // Send an exit message to the receiver
-    if (rudp_send_file_1(sender_socket, "EXIT", strlen("EXIT"), receiver_ip , receiver_port) < 0) {
-        perror("Failed sending EXIT\n");
+    // Tell the receiver no more files follow
+    if (rudp_session_finish(sender_socket) < 0) {
+        fprintf(stderr, "Error: Failed to end the session\n");
         return EXIT_FAILURE;
     }
+    printf("session finished\n");
 
-
-    printf("exit sent\n");
-
-    // Close the connection
+    // Close the connection, the FIN exchange finishes in the background
     if (rudp_close(sender_socket) < 0) {
         perror("close failed in sender file\n");
         return EXIT_FAILURE;
@@ -152,6 +322,9 @@ int main(int argc, char *argv[]) {
     // Free the allocated memory for file data
     free(file_data);
 
+    // Let the FIN exchange finish before the process exits
+    rudp_wait_closed();
+
     printf("Sender program finished\n");
     return EXIT_SUCCESS;
 }
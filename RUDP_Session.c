@@ -0,0 +1,1149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "RUDP_API.h"
+
+const unsigned char rudp_delta_key[16] = "rudp-delta-sig-1";
+
+// The session's file table, with room for `extra` more entries
+RUDP_Session *rudp_session_grow(RUDP_Socket *sockfd, unsigned int extra) {
+    if (sockfd->session == NULL) {
+        sockfd->session = (RUDP_Session *)calloc(1, sizeof(RUDP_Session));
+        if (sockfd->session == NULL) {
+            perror("Failed to allocate the session");
+            return NULL;
+        }
+        sockfd->session->stored_file = -1;
+    }
+    RUDP_Session *session = sockfd->session;
+    if (session->count + extra > session->capacity) {
+        unsigned int capacity = session->capacity > 0 ? session->capacity : 16;
+        while (capacity < session->count + extra) {
+            capacity *= 2;
+        }
+        RUDP_File_Entry *files = (RUDP_File_Entry *)realloc(session->files, capacity * sizeof(RUDP_File_Entry));
+        if (files == NULL) {
+            perror("Failed to grow the file table");
+            return NULL;
+        }
+        session->files = files;
+        session->capacity = capacity;
+    }
+    return session;
+}
+
+void rudp_session_free(RUDP_Session *session) {
+    if (session == NULL) {
+        return;
+    }
+    for (unsigned int i = 0; i < session->count; i++) {
+        RUDP_Delta *delta = session->files[i].delta;
+        if (delta != NULL) {
+            free(delta->sigs);
+            free(delta->head);
+            free(delta->next);
+            free(delta);
+        }
+        RUDP_Merkle *merkle = session->files[i].merkle;
+        if (merkle != NULL) {
+            free(merkle->leaves);
+            free(merkle->nodes);
+            free(merkle->peer);
+            free(merkle);
+        }
+        free(session->files[i].blocks);
+    }
+    free(session->files);
+    free(session->reply);
+    free(session);
+}
+
+// Files announced with a content hash can be resumed
+bool rudp_session_resumable(const RUDP_File_Info *info) {
+    for (int i = 0; i < RUDP_HASH_SIZE; i++) {
+        if (info->hash[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long long rudp_session_blocks(const RUDP_File_Info *info) {
+    return (info->size + RUDP_SESSION_BLOCK - 1) / RUDP_SESSION_BLOCK;
+}
+
+// Whether the block holding offset is already at the receiver
+bool rudp_session_stored(const RUDP_File_Entry *entry, unsigned long long offset) {
+    if (entry->blocks == NULL || offset >= entry->info.size) {
+        return false;
+    }
+    unsigned long long block = offset / RUDP_SESSION_BLOCK;
+    return (entry->blocks[block / 8] >> (block % 8)) & 1;
+}
+
+unsigned long long rudp_session_stored_bytes(const RUDP_File_Entry *entry) {
+    unsigned long long bytes = 0;
+    for (unsigned long long offset = 0; offset < entry->info.size; offset += RUDP_SESSION_BLOCK) {
+        if (rudp_session_stored(entry, offset)) {
+            bytes += entry->info.size - offset < RUDP_SESSION_BLOCK ? entry->info.size - offset : RUDP_SESSION_BLOCK;
+        }
+    }
+    return bytes;
+}
+
+// Move the file position past stored blocks, the sender does not send them again
+void rudp_session_skip_stored(RUDP_File_Entry *entry) {
+    while (entry->bytes % RUDP_SESSION_BLOCK == 0 && rudp_session_stored(entry, entry->bytes)) {
+        unsigned long long left = entry->info.size - entry->bytes;
+        entry->bytes += left < RUDP_SESSION_BLOCK ? left : RUDP_SESSION_BLOCK;
+    }
+}
+
+// <dir>/<name>.ckpt, with the slashes of the name flattened
+void rudp_session_checkpoint_path(RUDP_Socket *sockfd, const RUDP_File_Info *info, char *path, size_t size) {
+    int n = snprintf(path, size, "%s/", sockfd->session->checkpoint_dir);
+    for (int i = 0; info->name[i] != '\0' && n >= 0 && (size_t)n + 1 < size; i++) {
+        path[n++] = info->name[i] == '/' ? '_' : info->name[i];
+    }
+    path[n] = '\0';
+    strncat(path, ".ckpt", size - strlen(path) - 1);
+}
+
+/*
+* @brief Fill a resumable entry's bitmap from its checkpoint, if one exists for the same name, size, mtime, hash
+* and flags. A verified file also gets back the subtree hashes of its stored blocks.
+* @return 1 if blocks were restored, 0 if there is no usable checkpoint.
+*/
+int rudp_session_load_checkpoint(RUDP_Socket *sockfd, RUDP_File_Entry *entry) {
+    if (sockfd->session->checkpoint_dir[0] == '\0') {
+        return 0;
+    }
+    char path[2 * RUDP_NAME_MAX + 8];
+    rudp_session_checkpoint_path(sockfd, &entry->info, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    RUDP_Checkpoint header;
+    size_t bitmap = (rudp_session_blocks(&entry->info) + 7) / 8;
+    bool usable = fread(&header, sizeof(header), 1, file) == 1 &&
+                  header.magic == RUDP_CHECKPOINT_MAGIC && header.block_size == RUDP_SESSION_BLOCK &&
+                  header.info.size == entry->info.size && header.info.mtime == entry->info.mtime &&
+                  strncmp(header.info.name, entry->info.name, RUDP_NAME_MAX) == 0 &&
+                  memcmp(header.info.hash, entry->info.hash, RUDP_HASH_SIZE) == 0 &&
+                  header.info.flags == entry->info.flags &&
+                  fread(entry->blocks, 1, bitmap, file) == bitmap;
+    size_t nodes = entry->merkle != NULL ? rudp_session_blocks(&entry->info) : 0;
+    usable = usable && (nodes == 0 || fread(entry->merkle->nodes, RUDP_HASH_SIZE, nodes, file) == nodes);
+    fclose(file);
+    if (!usable) {
+        memset(entry->blocks, 0, bitmap);
+        printf("Ignoring stale checkpoint %s\n", path);
+        return 0;
+    }
+    entry->resumed = rudp_session_stored_bytes(entry);
+    entry->checkpoint_us = rudp_now_us();
+    return 1;
+}
+
+/*
+* @brief Write a file's bitmap, and a verified file's block hashes, next to a temporary name and rename it over the old checkpoint, so a crash
+* leaves either checkpoint intact. No fsync: the checkpoint survives the process, not the machine.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_save_checkpoint(RUDP_Socket *sockfd, RUDP_File_Entry *entry) {
+    char path[2 * RUDP_NAME_MAX + 8];
+    char temp[2 * RUDP_NAME_MAX + 16];
+    rudp_session_checkpoint_path(sockfd, &entry->info, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    RUDP_Checkpoint header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RUDP_CHECKPOINT_MAGIC;
+    header.block_size = RUDP_SESSION_BLOCK;
+    header.info = entry->info;
+    size_t bitmap = (rudp_session_blocks(&entry->info) + 7) / 8;
+
+    entry->dirty = false;
+    entry->checkpoint_us = rudp_now_us();
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL) {
+        printf("Failed to write checkpoint %s: %s\n", temp, strerror(errno));
+        return -1;
+    }
+    size_t nodes = entry->merkle != NULL ? rudp_session_blocks(&entry->info) : 0;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(entry->blocks, 1, bitmap, file) == bitmap &&
+                   (nodes == 0 || fwrite(entry->merkle->nodes, RUDP_HASH_SIZE, nodes, file) == nodes);
+    if (fclose(file) != 0 || !written || rename(temp, path) != 0) {
+        printf("Failed to write checkpoint %s: %s\n", path, strerror(errno));
+        remove(temp);
+        return -1;
+    }
+    return 1;
+}
+
+/*
+* @brief Receiver: the application asked for the next record, so the data of the last FILE_DATA is on disk.
+* Mark its block once complete and write the checkpoint if RUDP_CHECKPOINT_MS passed since the last write,
+* or right away with force. A failed write only costs resending data, the transfer goes on.
+*/
+void rudp_session_commit(RUDP_Socket *sockfd, bool force) {
+    RUDP_Session *session = sockfd->session;
+    if (session == NULL) {
+        return;
+    }
+    if (session->stored_file >= 0) {
+        RUDP_File_Entry *entry = &session->files[session->stored_file];
+        if (entry->blocks != NULL &&
+            (session->stored_end % RUDP_SESSION_BLOCK == 0 || session->stored_end == entry->info.size)) {
+            unsigned long long block = (session->stored_end - 1) / RUDP_SESSION_BLOCK;
+            entry->blocks[block / 8] |= (unsigned char)(1 << (block % 8));
+            entry->dirty = true;
+        }
+        if (!force && entry->dirty && session->checkpoint_dir[0] != '\0' &&
+            rudp_now_us() - entry->checkpoint_us >= RUDP_CHECKPOINT_MS * 1000LL) {
+            rudp_session_save_checkpoint(sockfd, entry);
+        }
+        session->stored_file = -1;
+    }
+    if (force && session->checkpoint_dir[0] != '\0') {
+        for (unsigned int i = 0; i < session->count; i++) {
+            if (session->files[i].dirty) {
+                rudp_session_save_checkpoint(sockfd, &session->files[i]);
+            }
+        }
+    }
+}
+
+// Receiver: answer a resumable manifest entry with the blocks already stored, in records of up to a block each
+int rudp_session_send_resume(RUDP_Socket *sockfd, unsigned int file_id) {
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    size_t bitmap = entry->resumed > 0 ? (rudp_session_blocks(&entry->info) + 7) / 8 : 0;
+    size_t sent = 0;
+    do {
+        size_t piece = bitmap - sent < RUDP_SESSION_BLOCK ? bitmap - sent : RUDP_SESSION_BLOCK;
+        RUDP_Record record;
+        memset(&record, 0, sizeof(record));
+        record.type = RUDP_REC_RESUME;
+        record.file_id = file_id;
+        record.offset = sent;
+        record.length = (unsigned int)piece;
+        if (rudp_session_send_record(sockfd, &record, entry->blocks + sent) < 0) {
+            return -1;
+        }
+        sent += piece;
+    } while (sent < bitmap);
+    return 1;
+}
+
+// Sender: one piece of a file's stored-block bitmap
+int rudp_session_resume_record(RUDP_Session *session, RUDP_Record *record, const char *payload) {
+    RUDP_File_Entry *entry = &session->files[record->file_id];
+    size_t bitmap = (rudp_session_blocks(&entry->info) + 7) / 8;
+    if (entry->blocks == NULL || entry->resume_known || record->offset + record->length > bitmap) {
+        return -1;
+    }
+    memcpy(entry->blocks + record->offset, payload, record->length);
+    if (record->length == 0 || record->offset + record->length == bitmap) {
+        entry->resume_known = true;
+        entry->resumed = rudp_session_stored_bytes(entry);
+    }
+    return 1;
+}
+
+// Sender: one piece of a file's basis signature, or its end
+int rudp_session_signature_record(RUDP_Session *session, RUDP_Record *record, const char *payload) {
+    RUDP_Delta *delta = session->files[record->file_id].delta;
+    if (delta == NULL || delta->complete || record->offset != delta->count || record->length % sizeof(RUDP_Block_Sig) != 0 ||
+        record->status < RUDP_DELTA_MIN_BLOCK || record->status > RUDP_DELTA_MAX_BLOCK) {
+        return -1;
+    }
+    if (record->length == 0) {
+        delta->complete = true;
+        return delta->count > 0 ? rudp_session_index_basis(delta) : 1;
+    }
+    unsigned int added = record->length / sizeof(RUDP_Block_Sig);
+    RUDP_Block_Sig *sigs = (RUDP_Block_Sig *)realloc(delta->sigs, (delta->count + added) * sizeof(RUDP_Block_Sig));
+    if (sigs == NULL) {
+        perror("Failed to grow the basis signature");
+        return -1;
+    }
+    memcpy(sigs + delta->count, payload, record->length);
+    delta->sigs = sigs;
+    delta->count += added;
+    delta->block = (unsigned int)record->status;
+    return 1;
+}
+
+/*
+* @brief Sender: read one RESUME, SIGNATURE or VERIFY record from the receiver and act on it.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_read_answer(RUDP_Socket *sockfd) {
+    RUDP_Session *session = sockfd->session;
+    size_t reply_size = sizeof(RUDP_Record) + RUDP_SESSION_BLOCK;
+    if (session->reply == NULL && (session->reply = (char *)malloc(reply_size)) == NULL) {
+        perror("Failed to allocate the answer buffer");
+        return -1;
+    }
+    int stream = RUDP_SESSION_STREAM;
+    int bytes_received = rudp_stream_recv(sockfd, &stream, session->reply, reply_size);
+    if (bytes_received <= 0) {
+        printf("Receiver went away before answering\n");
+        return -1;
+    }
+    RUDP_Record record;
+    memcpy(&record, session->reply, sizeof(record));
+    int result = -1;
+    if ((size_t)bytes_received == sizeof(RUDP_Record) + record.length && record.file_id < session->count) {
+        if (record.type == RUDP_REC_RESUME) {
+            result = rudp_session_resume_record(session, &record, session->reply + sizeof(RUDP_Record));
+        } else if (record.type == RUDP_REC_SIGNATURE) {
+            result = rudp_session_signature_record(session, &record, session->reply + sizeof(RUDP_Record));
+        } else if (record.type == RUDP_REC_VERIFY) {
+            result = rudp_session_verify_record(sockfd, &record, session->reply + sizeof(RUDP_Record));
+        }
+    }
+    if (result < 0) {
+        printf("Malformed answer from the receiver\n");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+* @brief Sender: read the receiver's answers until the file's RESUME and SIGNATURE records are complete.
+* Answers for the other files of the manifest arrive together, so a session waits one round trip in total.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_await_answers(RUDP_Socket *sockfd, RUDP_File_Entry *entry) {
+    while ((entry->blocks != NULL && !entry->resume_known) || (entry->delta != NULL && !entry->delta->complete)) {
+        if (rudp_session_read_answer(sockfd) < 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Sender: bucket the basis blocks by weak sum, a table of about two buckets per block
+int rudp_session_index_basis(RUDP_Delta *delta) {
+    unsigned int buckets = 1;
+    while (buckets < 2 * delta->count) {
+        buckets *= 2;
+    }
+    delta->head = (unsigned int *)malloc(buckets * sizeof(unsigned int));
+    delta->next = (unsigned int *)malloc(delta->count * sizeof(unsigned int));
+    if (delta->head == NULL || delta->next == NULL) {
+        perror("Failed to allocate the basis index");
+        return -1;
+    }
+    delta->mask = buckets - 1;
+    memset(delta->head, 0xff, buckets * sizeof(unsigned int));
+    // Walk backwards so every bucket lists its blocks in basis order
+    for (unsigned int i = delta->count; i-- > 0;) {
+        unsigned int bucket = (delta->sigs[i].weak ^ (delta->sigs[i].weak >> 16)) & delta->mask;
+        delta->next[i] = delta->head[bucket];
+        delta->head[bucket] = i;
+    }
+    return 1;
+}
+
+// Receiver: describe the basis of a delta file, or only end the signature if there is none
+int rudp_session_send_signature(RUDP_Socket *sockfd, unsigned int file_id) {
+    RUDP_Delta *delta = sockfd->session->files[file_id].delta;
+    unsigned int per_record = RUDP_SESSION_BLOCK / sizeof(RUDP_Block_Sig);
+    RUDP_Block_Sig *sigs = (RUDP_Block_Sig *)malloc(per_record * sizeof(RUDP_Block_Sig));
+    if (sigs == NULL) {
+        perror("Failed to allocate the basis signature");
+        return -1;
+    }
+    RUDP_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = RUDP_REC_SIGNATURE;
+    record.file_id = file_id;
+    record.status = (int)delta->block;
+    unsigned int index = 0;
+    while (true) {
+        unsigned int batch = delta->count - index < per_record ? delta->count - index : per_record;
+        for (unsigned int i = 0; i < batch; i++) {
+            const unsigned char *block = (const unsigned char *)delta->basis + (unsigned long long)(index + i) * delta->block;
+            sigs[i].weak = rudp_weak_sum(block, delta->block);
+            sigs[i].strong = rudp_siphash(rudp_delta_key, block, delta->block);
+        }
+        record.offset = index;
+        record.length = batch * sizeof(RUDP_Block_Sig);
+        if (rudp_session_send_record(sockfd, &record, sigs) < 0) {
+            free(sigs);
+            return -1;
+        }
+        if (batch == 0) {
+            break; // That was the empty record ending the signature
+        }
+        index += batch;
+    }
+    free(sigs);
+    delta->complete = true;
+    sockfd->session->unanswered--;
+    return 1;
+}
+
+/*
+* @brief Receiver: keep checkpoints of resumable files in dir, so a new session can skip what is already stored.
+* Call before the manifest arrives.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_set_checkpoint(RUDP_Socket *sockfd, const char *dir) {
+    if (sockfd == NULL || dir == NULL || strlen(dir) >= RUDP_NAME_MAX) {
+        return -1;
+    }
+    RUDP_Session *session = rudp_session_grow(sockfd, 0);
+    if (session == NULL) {
+        return -1;
+    }
+    strcpy(session->checkpoint_dir, dir);
+    return 1;
+}
+
+/*
+* @brief Receiver: use basis, the application's old copy of a file announced with RUDP_FILE_DELTA, so the
+* sender only transmits what changed. Call after the MANIFEST event and before asking for the next record,
+* a file left without a basis then goes out in full. The basis must stay valid until the file's FILE_END.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_set_basis(RUDP_Socket *sockfd, unsigned int file_id, const void *basis, size_t size) {
+    if (sockfd == NULL || sockfd->session == NULL || file_id >= sockfd->session->count || (size > 0 && basis == NULL)) {
+        return -1;
+    }
+    RUDP_Delta *delta = sockfd->session->files[file_id].delta;
+    if (delta == NULL || delta->complete) {
+        printf("File %u does not take a basis\n", file_id);
+        return -1;
+    }
+    delta->block = RUDP_DELTA_MIN_BLOCK;
+    while ((unsigned long long)delta->block * delta->block < size && delta->block < RUDP_DELTA_MAX_BLOCK) {
+        delta->block *= 2;
+    }
+    delta->count = (unsigned int)(size / delta->block);
+    delta->basis = (const char *)basis;
+    delta->basis_size = size;
+    return rudp_session_send_signature(sockfd, file_id);
+}
+
+/*
+* @brief Sender: the whole content of a file announced with RUDP_FILE_VERIFY, so blocks the receiver's check
+* rejects can be sent again. It must stay valid until the file is done. Without it such a file fails as
+* RUDP_FILE_CORRUPT instead.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_set_source(RUDP_Socket *sockfd, unsigned int file_id, const void *content, size_t size) {
+    if (sockfd == NULL || sockfd->session == NULL || file_id >= sockfd->session->count || (size > 0 && content == NULL)) {
+        return -1;
+    }
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    if (entry->merkle == NULL || size != entry->info.size) {
+        printf("File %u does not take a source\n", file_id);
+        return -1;
+    }
+    entry->merkle->source = (const char *)content;
+    entry->merkle->source_size = size;
+    return 1;
+}
+
+// Queue one record as its own chunk, header and payload gathered straight into the segments
+int rudp_session_send_record(RUDP_Socket *sockfd, RUDP_Record *record, const void *payload) {
+    struct iovec iov[2];
+    iov[0].iov_base = record;
+    iov[0].iov_len = sizeof(RUDP_Record);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = record->length;
+    return rudp_queue_chunk(sockfd, RUDP_SESSION_STREAM, iov, record->length > 0 ? 2 : 1) < 0 ? -1 : 1;
+}
+
+// Resume bitmap and delta state of a new manifest entry, as its info asks for
+int rudp_session_prepare(RUDP_File_Entry *entry) {
+    if (rudp_session_resumable(&entry->info)) {
+        size_t bitmap = (rudp_session_blocks(&entry->info) + 7) / 8;
+        entry->blocks = (unsigned char *)calloc(bitmap > 0 ? bitmap : 1, 1);
+        if (entry->blocks == NULL) {
+            perror("Failed to allocate a block bitmap");
+            return -1;
+        }
+    }
+    if (entry->info.flags & RUDP_FILE_DELTA) {
+        entry->delta = (RUDP_Delta *)calloc(1, sizeof(RUDP_Delta));
+        if (entry->delta == NULL) {
+            perror("Failed to allocate the delta state");
+            return -1;
+        }
+        entry->delta->block = RUDP_DELTA_MIN_BLOCK;
+    }
+    if (entry->info.flags & RUDP_FILE_VERIFY) {
+        unsigned long long leaves = (entry->info.size + RUDP_MERKLE_LEAF - 1) / RUDP_MERKLE_LEAF;
+        unsigned long long blocks = rudp_session_blocks(&entry->info);
+        entry->merkle = (RUDP_Merkle *)calloc(1, sizeof(RUDP_Merkle));
+        if (entry->merkle == NULL ||
+            (entry->merkle->leaves = calloc(leaves > 0 ? leaves : 1, RUDP_HASH_SIZE)) == NULL ||
+            (entry->merkle->nodes = calloc(blocks > 0 ? blocks : 1, RUDP_HASH_SIZE)) == NULL) {
+            perror("Failed to allocate the Merkle tree");
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// A file the sender may act on in the given state, NULL otherwise
+RUDP_File_Entry *rudp_session_file(RUDP_Socket *sockfd, unsigned int file_id, int state) {
+    if (sockfd->session == NULL || file_id >= sockfd->session->count) {
+        printf("Unknown file %u in session\n", file_id);
+        return NULL;
+    }
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    if (entry->state != state) {
+        printf("File %u is in state %d, expected %d\n", file_id, entry->state, state);
+        return NULL;
+    }
+    return entry;
+}
+
+/*
+* @brief Announce files to the receiver. Can be called again to append more files to the session.
+* @return The id of the first file added, -1 on error.
+*/
+int rudp_session_manifest(RUDP_Socket *sockfd, const RUDP_File_Info *files, unsigned int count) {
+    if (sockfd == NULL || !sockfd->isConnected || (count > 0 && files == NULL)) {
+        return -1;
+    }
+    RUDP_Session *session = rudp_session_grow(sockfd, count);
+    if (session == NULL || session->finished) {
+        return -1;
+    }
+
+    unsigned int first = session->count;
+    for (unsigned int i = 0; i < count; i++) {
+        RUDP_File_Entry *entry = &session->files[first + i];
+        memset(entry, 0, sizeof(*entry));
+        entry->info = files[i];
+        entry->info.name[RUDP_NAME_MAX - 1] = '\0';
+        entry->state = RUDP_FILE_PENDING;
+        session->count++;
+        if (rudp_session_prepare(entry) < 0) {
+            return -1;
+        }
+    }
+
+    // As many entries per record as fit in a data block
+    unsigned int per_record = RUDP_SESSION_BLOCK / sizeof(RUDP_File_Info);
+    for (unsigned int i = 0; i < count; i += per_record) {
+        unsigned int batch = count - i < per_record ? count - i : per_record;
+        RUDP_Record record;
+        memset(&record, 0, sizeof(record));
+        record.type = RUDP_REC_MANIFEST;
+        record.file_id = first + i;
+        record.length = batch * sizeof(RUDP_File_Info);
+        if (rudp_session_send_record(sockfd, &record, &files[i]) < 0) {
+            return -1;
+        }
+    }
+    return (int)first;
+}
+
+/*
+* @brief Mark the start of a file's data. Returns as soon as the record is queued, except that the first
+* resumable or delta file waits for the receiver to say which blocks it already has.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_start_file(RUDP_Socket *sockfd, unsigned int file_id) {
+    RUDP_File_Entry *entry = rudp_session_file(sockfd, file_id, RUDP_FILE_PENDING);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (rudp_session_await_answers(sockfd, entry) < 0) {
+        return -1;
+    }
+    RUDP_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = RUDP_REC_FILE_START;
+    record.file_id = file_id;
+    if (rudp_session_send_record(sockfd, &record, NULL) < 0) {
+        return -1;
+    }
+    entry->state = RUDP_FILE_ACTIVE;
+    return 1;
+}
+
+/*
+* @brief Send size bytes of a started file at its current position, literally from data or, with data NULL,
+* as a copy of the receiver's basis from source on. Records never cross a RUDP_SESSION_BLOCK boundary and
+* blocks the receiver already stored are skipped.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_emit(RUDP_Socket *sockfd, unsigned int file_id, const char *data, unsigned long long source, size_t size) {
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    size_t written = 0;
+    while (written < size) {
+        size_t block = RUDP_SESSION_BLOCK - entry->bytes % RUDP_SESSION_BLOCK;
+        if (size - written < block) {
+            block = size - written;
+        }
+        if (!rudp_session_stored(entry, entry->bytes)) {
+            RUDP_Record record;
+            memset(&record, 0, sizeof(record));
+            record.file_id = file_id;
+            record.offset = entry->bytes;
+            int result;
+            if (data != NULL) {
+                record.type = RUDP_REC_FILE_DATA;
+                record.length = (unsigned int)block;
+                result = rudp_session_send_record(sockfd, &record, data + written);
+            } else {
+                RUDP_Copy copy;
+                copy.source = source + written;
+                copy.length = block;
+                record.type = RUDP_REC_FILE_COPY;
+                record.length = sizeof(copy);
+                result = rudp_session_send_record(sockfd, &record, &copy);
+            }
+            if (result < 0) {
+                return -1;
+            }
+        }
+        entry->bytes += block;
+        written += block;
+    }
+    return 1;
+}
+
+/*
+* @brief Match data against the receiver's basis blocks, rsync style: slide a window of one block over the data,
+* look its rolling weak sum up and confirm candidates with the strong hash. Matched blocks go out as copies,
+* runs of adjacent ones merged, everything between them as literal data. Matches do not span write calls.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_write_delta(RUDP_Socket *sockfd, unsigned int file_id, const char *data, size_t size) {
+    RUDP_Delta *delta = sockfd->session->files[file_id].delta;
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t block = delta->block;
+    size_t literal = 0;             // Start of the data not yet sent
+    unsigned long long copy_source = 0;
+    size_t copy_length = 0;         // Pending copy, grown while matches stay adjacent in the basis
+    size_t i = 0;
+    unsigned int weak = size >= block ? rudp_weak_sum(bytes, block) : 0;
+    while (i + block <= size) {
+        unsigned int match = UINT_MAX;
+        unsigned int candidate = delta->head[(weak ^ (weak >> 16)) & delta->mask];
+        bool hashed = false;
+        unsigned long long strong = 0;
+        for (; candidate != UINT_MAX; candidate = delta->next[candidate]) {
+            if (delta->sigs[candidate].weak != weak) {
+                continue;
+            }
+            if (!hashed) {
+                strong = rudp_siphash(rudp_delta_key, bytes + i, block);
+                hashed = true;
+            }
+            if (delta->sigs[candidate].strong == strong) {
+                match = candidate;
+                break;
+            }
+        }
+
+        if (match == UINT_MAX) {
+            if (i + block < size) {
+                weak = rudp_weak_roll(weak, bytes[i], bytes[i + block], block);
+            }
+            i++;
+            continue;
+        }
+
+        unsigned long long source = (unsigned long long)match * block;
+        if (i > literal || (copy_length > 0 && copy_source + copy_length != source)) {
+            if (copy_length > 0 && rudp_session_emit(sockfd, file_id, NULL, copy_source, copy_length) < 0) {
+                return -1;
+            }
+            copy_length = 0;
+            if (i > literal && rudp_session_emit(sockfd, file_id, data + literal, 0, i - literal) < 0) {
+                return -1;
+            }
+        }
+        if (copy_length == 0) {
+            copy_source = source;
+        }
+        copy_length += block;
+        i += block;
+        literal = i;
+        if (i + block <= size) {
+            weak = rudp_weak_sum(bytes + i, block);
+        }
+    }
+
+    if (copy_length > 0 && rudp_session_emit(sockfd, file_id, NULL, copy_source, copy_length) < 0) {
+        return -1;
+    }
+    if (literal < size && rudp_session_emit(sockfd, file_id, data + literal, 0, size - literal) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+/*
+* @brief Add file data at offset to the file's Merkle tree, on either end. Data continues where the last call
+* stopped or starts on a leaf boundary. Whole leaves are hashed side by side, a leaf cut by the end of the data
+* is carried over to the next call, and a block's subtree is built once its last leaf is in.
+*/
+void rudp_session_hash(RUDP_File_Entry *entry, unsigned long long offset, const char *data, size_t size) {
+    RUDP_Merkle *merkle = entry->merkle;
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned long long file_size = entry->info.size;
+    if (offset != merkle->fed) {
+        if (offset % RUDP_MERKLE_LEAF != 0) {
+            return; // Not a place data can come from, the leaf stays wrong and the check says so
+        }
+        merkle->fed = offset;
+    }
+    unsigned long long first_leaf = offset / RUDP_MERKLE_LEAF;
+    size_t done = 0;
+
+    if (merkle->fed % RUDP_MERKLE_LEAF != 0) {
+        size_t take = RUDP_MERKLE_LEAF - merkle->fed % RUDP_MERKLE_LEAF;
+        if (take > size) {
+            take = size;
+        }
+        rudp_sha256_update(&merkle->partial, bytes, take);
+        done = take;
+        merkle->fed += take;
+        if (merkle->fed % RUDP_MERKLE_LEAF == 0 || merkle->fed == file_size) {
+            rudp_sha256_final(&merkle->partial, merkle->leaves[(merkle->fed - 1) / RUDP_MERKLE_LEAF]);
+        }
+    }
+    size_t whole = (size - done) / RUDP_MERKLE_LEAF * RUDP_MERKLE_LEAF;
+    if (merkle->fed + (size - done) == file_size) {
+        whole = size - done; // The file's last leaf may be short
+    }
+    if (whole > 0) {
+        rudp_merkle_leaves(bytes + done, whole, RUDP_MERKLE_LEAF, &merkle->leaves[merkle->fed / RUDP_MERKLE_LEAF]);
+        done += whole;
+        merkle->fed += whole;
+    }
+    if (done < size) {
+        rudp_merkle_leaf_init(&merkle->partial);
+        rudp_sha256_update(&merkle->partial, bytes + done, size - done);
+        merkle->fed += size - done;
+    }
+
+    unsigned long long per_block = RUDP_SESSION_BLOCK / RUDP_MERKLE_LEAF;
+    unsigned long long leaf_count = (file_size + RUDP_MERKLE_LEAF - 1) / RUDP_MERKLE_LEAF;
+    unsigned long long complete = merkle->fed == file_size ? leaf_count : merkle->fed / RUDP_MERKLE_LEAF;
+    for (unsigned long long block = first_leaf / per_block; block * per_block < leaf_count; block++) {
+        unsigned long long end = (block + 1) * per_block < leaf_count ? (block + 1) * per_block : leaf_count;
+        if (end > complete) {
+            break;
+        }
+        rudp_merkle_root((const unsigned char (*)[RUDP_HASH_SIZE])&merkle->leaves[block * per_block], end - block * per_block,
+                         merkle->nodes[block]);
+    }
+}
+
+/*
+* @brief Receiver: compare a verified file's tree with the root its FILE_END carries and send the verdict.
+* On a mismatch the verdict carries our block hashes, so the sender can resend only the blocks that differ.
+* @return 1 if the file is settled, 0 if blocks will come again, -1 on error.
+*/
+int rudp_session_check(RUDP_Socket *sockfd, unsigned int file_id, const char *root, size_t length) {
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    RUDP_Merkle *merkle = entry->merkle;
+    unsigned long long blocks = rudp_session_blocks(&entry->info);
+    unsigned char ours[RUDP_HASH_SIZE];
+    rudp_merkle_root((const unsigned char (*)[RUDP_HASH_SIZE])merkle->nodes, blocks, ours);
+
+    RUDP_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = RUDP_REC_VERIFY;
+    record.file_id = file_id;
+    record.status = entry->status;
+    if (entry->status != RUDP_FILE_OK || (length == RUDP_HASH_SIZE && memcmp(ours, root, RUDP_HASH_SIZE) == 0)) {
+        merkle->repairing = false;
+        return rudp_session_send_record(sockfd, &record, NULL) < 0 ? -1 : 1;
+    }
+
+    record.status = RUDP_FILE_CORRUPT;
+    unsigned long long per_record = RUDP_SESSION_BLOCK / RUDP_HASH_SIZE;
+    unsigned long long sent = 0;
+    do {
+        unsigned long long count = blocks - sent < per_record ? blocks - sent : per_record;
+        record.offset = sent;
+        record.length = (unsigned int)(count * RUDP_HASH_SIZE);
+        if (rudp_session_send_record(sockfd, &record, merkle->nodes[sent]) < 0) {
+            return -1;
+        }
+        sent += count;
+    } while (sent < blocks);
+    merkle->repairing = true;
+    return 0;
+}
+
+// Sender: the receiver's verdict on a verified file, or one piece of the block hashes of a failed check
+int rudp_session_verify_record(RUDP_Socket *sockfd, RUDP_Record *record, const char *payload) {
+    RUDP_File_Entry *entry = &sockfd->session->files[record->file_id];
+    RUDP_Merkle *merkle = entry->merkle;
+    if (merkle == NULL || !merkle->pending) {
+        return -1;
+    }
+    if (record->status != RUDP_FILE_CORRUPT) {
+        merkle->pending = false;
+        if (record->status != RUDP_FILE_OK) {
+            entry->status = record->status;
+            entry->state = RUDP_FILE_FAILED;
+        }
+        return 1;
+    }
+
+    unsigned long long blocks = rudp_session_blocks(&entry->info);
+    unsigned long long count = record->length / RUDP_HASH_SIZE;
+    if (record->offset != merkle->peer_count || record->length % RUDP_HASH_SIZE != 0 || record->offset + count > blocks) {
+        return -1;
+    }
+    if (merkle->peer == NULL && (merkle->peer = calloc(blocks > 0 ? blocks : 1, RUDP_HASH_SIZE)) == NULL) {
+        perror("Failed to allocate the receiver's block hashes");
+        return -1;
+    }
+    memcpy(merkle->peer[record->offset], payload, record->length);
+    merkle->peer_count += count;
+    if (merkle->peer_count < blocks) {
+        return 1;
+    }
+    merkle->peer_count = 0;
+    return rudp_session_repair(sockfd, record->file_id);
+}
+
+/*
+* @brief Sender: resend the blocks whose hashes differ from the receiver's and close the file again.
+* Gives the file up as RUDP_FILE_CORRUPT without a source or after RUDP_VERIFY_ROUNDS repairs.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_repair(RUDP_Socket *sockfd, unsigned int file_id) {
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    RUDP_Merkle *merkle = entry->merkle;
+    merkle->pending = false;
+    if (merkle->source == NULL || ++merkle->rounds > RUDP_VERIFY_ROUNDS) {
+        printf("File %u failed verification\n", file_id);
+        return rudp_session_send_end(sockfd, file_id, RUDP_FILE_CORRUPT);
+    }
+
+    unsigned long long blocks = rudp_session_blocks(&entry->info);
+    unsigned long long resent = 0;
+    for (unsigned long long block = 0; block < blocks; block++) {
+        if (memcmp(merkle->nodes[block], merkle->peer[block], RUDP_HASH_SIZE) == 0) {
+            continue;
+        }
+        unsigned long long offset = block * RUDP_SESSION_BLOCK;
+        RUDP_Record record;
+        memset(&record, 0, sizeof(record));
+        record.type = RUDP_REC_FILE_DATA;
+        record.file_id = file_id;
+        record.offset = offset;
+        record.length = (unsigned int)(entry->info.size - offset < RUDP_SESSION_BLOCK ? entry->info.size - offset : RUDP_SESSION_BLOCK);
+        if (rudp_session_send_record(sockfd, &record, merkle->source + offset) < 0) {
+            return -1;
+        }
+        resent++;
+    }
+    printf("File %u failed verification, resending %llu of %llu blocks\n", file_id, resent, blocks);
+    return rudp_session_send_end(sockfd, file_id, RUDP_FILE_OK);
+}
+
+/*
+* @brief Append data to a started file. Blocks the receiver already stored are skipped and a delta file only
+* sends what its basis lacks. Only blocks while the retransmission queue is full.
+* @return The number of bytes consumed, -1 on error.
+*/
+int rudp_session_write(RUDP_Socket *sockfd, unsigned int file_id, const void *data, size_t size) {
+    RUDP_File_Entry *entry = rudp_session_file(sockfd, file_id, RUDP_FILE_ACTIVE);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (entry->bytes + size > entry->info.size) {
+        printf("File %u is larger than its manifest entry\n", file_id);
+        return -1;
+    }
+    if (entry->merkle != NULL) {
+        rudp_session_hash(entry, entry->bytes, (const char *)data, size);
+    }
+    int result;
+    if (entry->delta != NULL && entry->delta->count > 0) {
+        result = rudp_session_write_delta(sockfd, file_id, (const char *)data, size);
+    } else {
+        result = rudp_session_emit(sockfd, file_id, (const char *)data, 0, size);
+    }
+    return result < 0 ? -1 : (int)size;
+}
+
+/*
+* @brief Close a started file with RUDP_FILE_OK or an error status. A file closed with RUDP_FILE_OK
+* before all of its announced bytes were written is reported as RUDP_FILE_SHORT.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_end_file(RUDP_Socket *sockfd, unsigned int file_id, int status) {
+    RUDP_File_Entry *entry = rudp_session_file(sockfd, file_id, RUDP_FILE_ACTIVE);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (status == RUDP_FILE_OK && entry->bytes != entry->info.size) {
+        status = RUDP_FILE_SHORT;
+    }
+    return rudp_session_send_end(sockfd, file_id, status);
+}
+
+// FILE_END with the file's status, and its Merkle root if it is verified and OK
+int rudp_session_send_end(RUDP_Socket *sockfd, unsigned int file_id, int status) {
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    RUDP_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = RUDP_REC_FILE_END;
+    record.file_id = file_id;
+    record.offset = entry->bytes;
+    record.status = status;
+    unsigned char root[RUDP_HASH_SIZE];
+    if (entry->merkle != NULL && status == RUDP_FILE_OK) {
+        rudp_merkle_root((const unsigned char (*)[RUDP_HASH_SIZE])entry->merkle->nodes, rudp_session_blocks(&entry->info), root);
+        record.length = RUDP_HASH_SIZE;
+        entry->merkle->pending = true;
+    }
+    if (rudp_session_send_record(sockfd, &record, root) < 0) {
+        return -1;
+    }
+    entry->status = status;
+    entry->state = status == RUDP_FILE_OK ? RUDP_FILE_SENT : RUDP_FILE_FAILED;
+    entry->end_seq = sockfd->streams[RUDP_SESSION_STREAM].snd_next;
+    return 1;
+}
+
+/*
+* @brief End the session and wait until the receiver acknowledged every record.
+* @return 1 on success, -1 on error.
+*/
+int rudp_session_finish(RUDP_Socket *sockfd) {
+    if (sockfd == NULL || sockfd->session == NULL || sockfd->session->finished) {
+        return -1;
+    }
+    // Verified files first have to pass the receiver's check, repairs included
+    for (unsigned int i = 0; i < sockfd->session->count; i++) {
+        while (sockfd->session->files[i].merkle != NULL && sockfd->session->files[i].merkle->pending) {
+            if (rudp_session_read_answer(sockfd) < 0) {
+                return -1;
+            }
+        }
+    }
+    RUDP_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = RUDP_REC_SESSION_END;
+    if (rudp_session_send_record(sockfd, &record, NULL) < 0) {
+        return -1;
+    }
+    sockfd->session->finished = true;
+    return rudp_flush(sockfd);
+}
+
+/*
+* @brief Progress of a file. On the sender a file becomes RUDP_FILE_DONE once its FILE_END record is acknowledged
+* and, if it is verified, the receiver's check passed.
+* @return One of RUDP_FILE_*, -1 for an unknown file.
+*/
+int rudp_session_file_state(RUDP_Socket *sockfd, unsigned int file_id) {
+    if (sockfd == NULL || sockfd->session == NULL || file_id >= sockfd->session->count) {
+        return -1;
+    }
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    if (entry->state == RUDP_FILE_SENT && SEQ_LEQ(entry->end_seq, sockfd->streams[RUDP_SESSION_STREAM].snd_acked) &&
+        (entry->merkle == NULL || !entry->merkle->pending)) {
+        entry->state = RUDP_FILE_DONE;
+    }
+    return entry->state;
+}
+
+/*
+* @brief Sender: wait until an ended file is done, its records acknowledged and, if it is verified, the receiver's
+* check passed, repairs included.
+* @return RUDP_FILE_DONE or RUDP_FILE_FAILED, -1 on error.
+*/
+int rudp_session_wait(RUDP_Socket *sockfd, unsigned int file_id) {
+    if (sockfd == NULL || sockfd->session == NULL || file_id >= sockfd->session->count) {
+        return -1;
+    }
+    RUDP_File_Entry *entry = &sockfd->session->files[file_id];
+    if (entry->state == RUDP_FILE_PENDING || entry->state == RUDP_FILE_ACTIVE) {
+        printf("File %u has not ended\n", file_id);
+        return -1;
+    }
+    while (entry->merkle != NULL && entry->merkle->pending) {
+        if (rudp_session_read_answer(sockfd) < 0) {
+            return -1;
+        }
+    }
+    if (entry->state == RUDP_FILE_SENT && rudp_flush(sockfd) < 0) {
+        return -1;
+    }
+    return rudp_session_file_state(sockfd, file_id);
+}
+
+/*
+* @brief Receive the next session record.
+* @param buffer Must hold a record header plus RUDP_SESSION_BLOCK bytes; FILE_DATA payloads point into it.
+* @return 1 if event was filled in, 0 if the peer closed the connection, -1 on error.
+*/
+int rudp_session_recv(RUDP_Socket *sockfd, RUDP_Session_Event *event, char *buffer, size_t buffer_size) {
+    if (sockfd == NULL || event == NULL || buffer_size < sizeof(RUDP_Record) + RUDP_SESSION_BLOCK) {
+        return -1;
+    }
+    rudp_session_commit(sockfd, false);
+    RUDP_Session *session = sockfd->session;
+    for (unsigned int i = 0; session != NULL && session->unanswered > 0 && i < session->count; i++) {
+        if (session->files[i].delta != NULL && !session->files[i].delta->complete &&
+            rudp_session_send_signature(sockfd, i) < 0) {
+            return -1; // No basis given, the sender needs an empty signature to go on
+        }
+    }
+    int stream = RUDP_SESSION_STREAM;
+    int bytes_received = rudp_stream_recv(sockfd, &stream, buffer, buffer_size);
+    if (bytes_received <= 0) {
+        rudp_session_commit(sockfd, true); // Keep what arrived for the next attempt
+        return bytes_received;
+    }
+
+    RUDP_Record record;
+    if ((size_t)bytes_received < sizeof(RUDP_Record)) {
+        printf("Session record too short\n");
+        return -1;
+    }
+    memcpy(&record, buffer, sizeof(record));
+    if ((size_t)bytes_received != sizeof(RUDP_Record) + record.length) {
+        printf("Session record length mismatch\n");
+        return -1;
+    }
+
+    memset(event, 0, sizeof(*event));
+    event->type = record.type;
+    event->file_id = record.file_id;
+    if (record.type == RUDP_REC_MANIFEST) {
+        if (record.length % sizeof(RUDP_File_Info) != 0) {
+            printf("Malformed manifest record\n");
+            return -1;
+        }
+        unsigned int count = record.length / sizeof(RUDP_File_Info);
+        session = rudp_session_grow(sockfd, count);
+        if (session == NULL) {
+            return -1;
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int file_id = session->count;
+            RUDP_File_Entry *entry = &session->files[file_id];
+            memset(entry, 0, sizeof(*entry));
+            memcpy(&entry->info, buffer + sizeof(RUDP_Record) + i * sizeof(RUDP_File_Info), sizeof(RUDP_File_Info));
+            entry->info.name[RUDP_NAME_MAX - 1] = '\0';
+            entry->state = RUDP_FILE_PENDING;
+            session->count++;
+            if (rudp_session_prepare(entry) < 0) {
+                return -1;
+            }
+            if (entry->delta != NULL) {
+                session->unanswered++;
+            }
+            if (entry->blocks == NULL) {
+                continue;
+            }
+            rudp_session_load_checkpoint(sockfd, entry);
+            rudp_session_skip_stored(entry);
+            if (rudp_session_send_resume(sockfd, file_id) < 0) {
+                return -1;
+            }
+        }
+        event->length = count;
+        return 1;
+    }
+    if (record.type == RUDP_REC_SESSION_END) {
+        if (session != NULL) {
+            session->finished = true;
+        }
+        return 1;
+    }
+
+    RUDP_File_Entry *entry = NULL;
+    if (record.type == RUDP_REC_FILE_START) {
+        entry = rudp_session_file(sockfd, record.file_id, RUDP_FILE_PENDING);
+    } else if (record.type == RUDP_REC_FILE_DATA || record.type == RUDP_REC_FILE_COPY || record.type == RUDP_REC_FILE_END) {
+        entry = rudp_session_file(sockfd, record.file_id, RUDP_FILE_ACTIVE);
+    } else {
+        printf("Unknown session record type %u\n", record.type);
+        return -1;
+    }
+    if (entry == NULL) {
+        return -1;
+    }
+    event->info = &entry->info;
+
+    if (record.type == RUDP_REC_FILE_START) {
+        entry->state = RUDP_FILE_ACTIVE;
+        event->resumed = entry->resumed;
+    } else if (record.type == RUDP_REC_FILE_DATA || record.type == RUDP_REC_FILE_COPY) {
+        event->type = RUDP_REC_FILE_DATA; // Copied blocks reach the application as data taken from its basis
+        event->data = buffer + sizeof(RUDP_Record);
+        event->length = record.length;
+        if (record.type == RUDP_REC_FILE_COPY) {
+            RUDP_Copy copy;
+            if (record.length != sizeof(copy) || entry->delta == NULL) {
+                printf("Malformed copy record\n");
+                return -1;
+            }
+            memcpy(&copy, buffer + sizeof(RUDP_Record), sizeof(copy));
+            if (copy.source > entry->delta->basis_size || copy.length > entry->delta->basis_size - copy.source) {
+                printf("File %u copies past the end of its basis\n", record.file_id);
+                return -1;
+            }
+            event->data = entry->delta->basis + copy.source;
+            event->length = copy.length;
+        }
+        // A block the check rejected comes again from its start, everything else continues the file
+        bool repair = entry->merkle != NULL && entry->merkle->repairing && record.offset < entry->bytes;
+        if (repair ? record.offset % RUDP_SESSION_BLOCK != 0 || record.offset + event->length > entry->info.size :
+                     record.offset != entry->bytes || entry->bytes + event->length > entry->info.size) {
+            printf("File %u data out of place\n", record.file_id);
+            return -1;
+        }
+        event->offset = record.offset;
+        if (entry->merkle != NULL) {
+            rudp_session_hash(entry, record.offset, event->data, event->length);
+        }
+        if (!repair) {
+            entry->bytes += event->length;
+        }
+        session->stored_file = (int)record.file_id;
+        session->stored_end = record.offset + event->length;
+        rudp_session_skip_stored(entry);
+    } else {
+        entry->status = record.status;
+        if (entry->status == RUDP_FILE_OK && entry->bytes != entry->info.size) {
+            entry->status = RUDP_FILE_SHORT;
+        }
+        if (entry->merkle != NULL && record.status == RUDP_FILE_OK) {
+            int verdict = rudp_session_check(sockfd, record.file_id, buffer + sizeof(RUDP_Record), record.length);
+            if (verdict < 0) {
+                return -1;
+            }
+            if (verdict == 0) {
+                event->type = RUDP_REC_VERIFY; // The file stays open for the blocks that come again
+                event->status = RUDP_FILE_CORRUPT;
+                return 1;
+            }
+        }
+        entry->state = entry->status == RUDP_FILE_OK ? RUDP_FILE_DONE : RUDP_FILE_FAILED;
+        event->status = entry->status;
+        if (entry->dirty && session->checkpoint_dir[0] != '\0') {
+            rudp_session_save_checkpoint(sockfd, entry);
+        }
+    }
+    return 1;
+}
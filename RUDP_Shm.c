@@ -0,0 +1,179 @@
+#define _GNU_SOURCE // memfd_create() and syscall()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "RUDP_Shm.h"
+
+// Let the sibling hyperthread run while spinning
+#if defined(__x86_64__) || defined(__i386__)
+#define SHM_RELAX() __builtin_ia32_pause()
+#else
+#define SHM_RELAX() do { } while (0)
+#endif
+
+static unsigned char *shm_ring(RUDP_Shm_Region *region, int side, int stream) {
+    return (unsigned char *)region + RUDP_SHM_DATA + ((size_t)side * RUDP_SHM_STREAMS + stream) * RUDP_SHM_RING;
+}
+
+RUDP_Shm_Region *rudp_shm_create(int *fd) {
+    *fd = memfd_create("rudp", MFD_CLOEXEC);
+    if (*fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(*fd, RUDP_SHM_SIZE) < 0) {
+        perror("ftruncate");
+        close(*fd);
+        return NULL;
+    }
+    RUDP_Shm_Region *region = (RUDP_Shm_Region *)mmap(NULL, RUDP_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        close(*fd);
+        return NULL;
+    }
+
+    // The memfd is zero filled, only the identity needs writing
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (random == NULL || fread(&region->token, 1, sizeof(region->token), random) != sizeof(region->token)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        region->token = ((unsigned long long)now.tv_nsec << 32) ^ (unsigned long long)now.tv_sec ^ (unsigned long long)getpid();
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+    region->pid[RUDP_SHM_CLIENT] = (unsigned int)getpid();
+    region->state = RUDP_SHM_OFFERED;
+    __atomic_store_n(&region->magic, RUDP_SHM_MAGIC, __ATOMIC_RELEASE);
+    return region;
+}
+
+RUDP_Shm_Region *rudp_shm_attach(unsigned int pid, int peer_fd, unsigned long long token, int *fd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/fd/%d", pid, peer_fd);
+    *fd = open(path, O_RDWR | O_CLOEXEC);
+    if (*fd < 0) {
+        return NULL; // Another host, another PID namespace or not ours to open
+    }
+    struct stat info;
+    if (fstat(*fd, &info) < 0 || info.st_size != (off_t)RUDP_SHM_SIZE) {
+        close(*fd);
+        return NULL;
+    }
+    RUDP_Shm_Region *region = (RUDP_Shm_Region *)mmap(NULL, RUDP_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (region == MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+    if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != RUDP_SHM_MAGIC || region->token != token) {
+        rudp_shm_release(region, *fd);
+        return NULL;
+    }
+    region->pid[RUDP_SHM_SERVER] = (unsigned int)getpid();
+    return region;
+}
+
+void rudp_shm_release(RUDP_Shm_Region *region, int fd) {
+    munmap(region, RUDP_SHM_SIZE);
+    close(fd);
+}
+
+unsigned int rudp_shm_state(RUDP_Shm_Region *region) {
+    return __atomic_load_n(&region->state, __ATOMIC_ACQUIRE);
+}
+
+bool rudp_shm_transition(RUDP_Shm_Region *region, unsigned int from, unsigned int to) {
+    return __atomic_compare_exchange_n(&region->state, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+bool rudp_shm_closed(RUDP_Shm_Region *region, int side) {
+    return __atomic_load_n(&region->closed[side], __ATOMIC_ACQUIRE) != 0;
+}
+
+void rudp_shm_set_closed(RUDP_Shm_Region *region, int side) {
+    __atomic_store_n(&region->closed[side], 1, __ATOMIC_RELEASE);
+}
+
+unsigned long long rudp_shm_head(RUDP_Shm_Region *region, int side, int stream) {
+    return __atomic_load_n(&region->rings[side][stream].head, __ATOMIC_ACQUIRE);
+}
+
+unsigned long long rudp_shm_tail(RUDP_Shm_Region *region, int side, int stream) {
+    return __atomic_load_n(&region->rings[side][stream].tail, __ATOMIC_ACQUIRE);
+}
+
+void rudp_shm_set_head(RUDP_Shm_Region *region, int side, int stream, unsigned long long head) {
+    __atomic_store_n(&region->rings[side][stream].head, head, __ATOMIC_RELEASE);
+}
+
+void rudp_shm_set_tail(RUDP_Shm_Region *region, int side, int stream, unsigned long long tail) {
+    __atomic_store_n(&region->rings[side][stream].tail, tail, __ATOMIC_RELEASE);
+}
+
+void rudp_shm_store(RUDP_Shm_Region *region, int side, int stream, unsigned long long pos, const void *src, size_t size) {
+    unsigned char *ring = shm_ring(region, side, stream);
+    size_t offset = (size_t)(pos & (RUDP_SHM_RING - 1));
+    size_t first = RUDP_SHM_RING - offset < size ? RUDP_SHM_RING - offset : size;
+    memcpy(ring + offset, src, first);
+    memcpy(ring, (const unsigned char *)src + first, size - first);
+}
+
+void rudp_shm_load(RUDP_Shm_Region *region, int side, int stream, unsigned long long pos, void *dst, size_t size) {
+    unsigned char *ring = shm_ring(region, side, stream);
+    size_t offset = (size_t)(pos & (RUDP_SHM_RING - 1));
+    size_t first = RUDP_SHM_RING - offset < size ? RUDP_SHM_RING - offset : size;
+    memcpy(dst, ring + offset, first);
+    memcpy((unsigned char *)dst + first, ring, size - first);
+}
+
+unsigned int rudp_shm_bell(RUDP_Shm_Region *region, int side) {
+    return __atomic_load_n(&region->doorbells[side].bell, __ATOMIC_SEQ_CST);
+}
+
+// The bump and the sleeping check pair with the sleeper's flag store and bell check, one of the two sees the other
+void rudp_shm_ring_bell(RUDP_Shm_Region *region, int side) {
+    RUDP_Shm_Doorbell *doorbell = &region->doorbells[side];
+    __atomic_add_fetch(&doorbell->bell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&doorbell->sleeping, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &doorbell->bell, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+unsigned int rudp_shm_wait(RUDP_Shm_Region *region, int side, unsigned int seen, long long timeout_us) {
+    RUDP_Shm_Doorbell *doorbell = &region->doorbells[side];
+    static long cpus = 0;
+    if (cpus == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    unsigned int bell = rudp_shm_bell(region, side);
+    for (int i = 0; bell == seen && cpus > 1 && timeout_us > 0 && i < RUDP_SHM_SPIN; i++) {
+        SHM_RELAX();
+        bell = rudp_shm_bell(region, side);
+    }
+    if (bell != seen || timeout_us <= 0) {
+        return bell;
+    }
+
+    __atomic_store_n(&doorbell->sleeping, 1, __ATOMIC_SEQ_CST);
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    if (rudp_shm_bell(region, side) == seen &&
+        syscall(SYS_futex, &doorbell->bell, FUTEX_WAIT, seen, &timeout, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+        perror("futex");
+    }
+    __atomic_store_n(&doorbell->sleeping, 0, __ATOMIC_SEQ_CST);
+    return rudp_shm_bell(region, side);
+}
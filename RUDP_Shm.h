@@ -0,0 +1,92 @@
+#ifndef RUDP_SHM_H
+#define RUDP_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Same-host path: one memfd holding a single-producer single-consumer byte ring per stream and direction.
+// The client creates it and offers it in the handshake, the server maps it through /proc/<pid>/fd/<fd>.
+#define RUDP_SHM_MAGIC 0x52534d31 // "RSM1"
+#define RUDP_SHM_STREAMS 8        // Rings per direction, one per stream (RUDP_MAX_STREAMS)
+#define RUDP_SHM_RING (1 << 20)   // Bytes per ring, a power of two. Only the rings a connection uses get pages
+#define RUDP_SHM_SPIN 4096        // Checks of the doorbell before sleeping on it, on machines with more than one CPU
+
+// Sides: side s writes rings[s] and sleeps on doorbells[s]
+#define RUDP_SHM_SERVER 0
+#define RUDP_SHM_CLIENT 1
+
+// Whether the connection uses the rings, decided once by whichever side moves first
+#define RUDP_SHM_OFFERED 0     // Created by the client, the server has not mapped it
+#define RUDP_SHM_ATTACHED 1    // Both ends mapped it, no data has moved yet
+#define RUDP_SHM_ACTIVE 2      // All data goes through the rings
+#define RUDP_SHM_DECLINED 3    // Data goes over UDP, both ends unmap it
+
+// Records in a ring: this header, then `length` bytes. Records wrap around the end of the ring.
+typedef struct {
+    unsigned int length;
+    unsigned int flags;         // EOC_FLAG on the last record of a chunk
+} RUDP_Shm_Record;
+
+// Positions only grow, a ring holds head - tail bytes. Each on its own cache line, written by one side only.
+typedef struct {
+    unsigned long long head;    // Bytes ever written
+    char head_pad[56];
+    unsigned long long tail;    // Bytes ever read
+    char tail_pad[56];
+} RUDP_Shm_Ring;
+
+typedef struct {
+    unsigned int bell;          // Bumped by the other side for every change this side may be waiting for, a futex
+    unsigned int sleeping;      // This side is about to wait on bell, the other side has to wake it
+    char pad[56];
+} RUDP_Shm_Doorbell;
+
+// Start of the memfd, the ring bytes follow at RUDP_SHM_DATA
+typedef struct {
+    unsigned int magic;
+    unsigned int state;         // RUDP_SHM_*
+    unsigned long long token;   // Random, sent with the offer, so the server knows it mapped the memory offered
+    unsigned int pid[2];        // Process of each side
+    unsigned int closed[2];     // Side closed its end, or its process is gone
+    RUDP_Shm_Doorbell doorbells[2];
+    RUDP_Shm_Ring rings[2][RUDP_SHM_STREAMS];
+} RUDP_Shm_Region;
+
+#define RUDP_SHM_DATA 4096
+#define RUDP_SHM_SIZE (RUDP_SHM_DATA + 2 * RUDP_SHM_STREAMS * (size_t)RUDP_SHM_RING)
+
+// Create and map a region in the OFFERED state. NULL if the system has no memfd.
+RUDP_Shm_Region *rudp_shm_create(int *fd);
+// Map the region another process offered, NULL unless it exists and carries token
+RUDP_Shm_Region *rudp_shm_attach(unsigned int pid, int peer_fd, unsigned long long token, int *fd);
+void rudp_shm_release(RUDP_Shm_Region *region, int fd);
+
+unsigned int rudp_shm_state(RUDP_Shm_Region *region);
+// Move from one state to another, false if the region is no longer in `from`
+bool rudp_shm_transition(RUDP_Shm_Region *region, unsigned int from, unsigned int to);
+
+// A side closing its end
+bool rudp_shm_closed(RUDP_Shm_Region *region, int side);
+void rudp_shm_set_closed(RUDP_Shm_Region *region, int side);
+
+// Ring positions, loaded with acquire and published with release ordering
+unsigned long long rudp_shm_head(RUDP_Shm_Region *region, int side, int stream);
+unsigned long long rudp_shm_tail(RUDP_Shm_Region *region, int side, int stream);
+void rudp_shm_set_head(RUDP_Shm_Region *region, int side, int stream, unsigned long long head);
+void rudp_shm_set_tail(RUDP_Shm_Region *region, int side, int stream, unsigned long long tail);
+
+// Copy into and out of a ring at a position, across its end if need be
+void rudp_shm_store(RUDP_Shm_Region *region, int side, int stream, unsigned long long pos, const void *src, size_t size);
+void rudp_shm_load(RUDP_Shm_Region *region, int side, int stream, unsigned long long pos, void *dst, size_t size);
+
+// Doorbells: the current value of a side's bell, wake a side, wait until a bell moves past seen
+unsigned int rudp_shm_bell(RUDP_Shm_Region *region, int side);
+void rudp_shm_ring_bell(RUDP_Shm_Region *region, int side);
+/*
+* @brief Wait until side's bell differs from seen, spinning first on machines with more than one CPU.
+* @param timeout_us Longest wait, 0 to only look.
+* @return The bell's value, equal to seen if the wait timed out.
+*/
+unsigned int rudp_shm_wait(RUDP_Shm_Region *region, int side, unsigned int seen, long long timeout_us);
+
+#endif /* RUDP_SHM_H */
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE // recvmmsg() and pthread_setaffinity_np()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "RUDP_API.h"
+
+/*
+* @brief Low-latency mode for request/response traffic: rudp_poll() spins on non-blocking reads of every subflow
+* socket for up to spin_us before it blocks in select(), acknowledges every segment at once, and the calling thread
+* is pinned to one core so the spin does not migrate. Spinning stops early for a timer, so timers keep their time.
+* @param spin_us Spin budget per wait, 0 turns the mode off and restores the ACK policy it replaced.
+* @param cpu Core to pin the calling thread to, -1 to leave it where it is.
+* @return 1 on success, -1 on error.
+*/
+int rudp_set_low_latency(RUDP_Socket *sockfd, unsigned int spin_us, int cpu) {
+    if (sockfd == NULL || spin_us > RUDP_MAX_SPIN_US) {
+        return -1;
+    }
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if (cpu >= CPU_SETSIZE) {
+            return -1;
+        }
+        CPU_SET(cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0) {
+            fprintf(stderr, "Error: Failed to pin to core %d: %s\n", cpu, strerror(err));
+            return -1;
+        }
+        sockfd->spin_cpu = cpu;
+    }
+
+    if (spin_us > 0 && sockfd->spin_us == 0) {
+        sockfd->saved_ack_every = sockfd->ack_every;
+        sockfd->saved_ack_delay_ms = sockfd->ack_delay_ms;
+        sockfd->ack_every = 1; // A request is usually one segment, its ACK should not wait for company
+        sockfd->ack_delay_ms = 0;
+    } else if (spin_us == 0 && sockfd->spin_us > 0) {
+        sockfd->ack_every = sockfd->saved_ack_every;
+        sockfd->ack_delay_ms = sockfd->saved_ack_delay_ms;
+    }
+    sockfd->spin_us = spin_us;
+    rudp_spin_socket(sockfd, sockfd->socket_fd);
+    for (unsigned int p = 1; p < sockfd->path_count; p++) {
+        if (sockfd->paths[p].fd >= 0 && sockfd->paths[p].fd != sockfd->socket_fd) {
+            rudp_spin_socket(sockfd, sockfd->paths[p].fd);
+        }
+    }
+    return 1;
+}
+
+// Ask the kernel to busy-poll the device queue on reads of the socket. Raising it needs CAP_NET_ADMIN beyond
+// net.core.busy_read, without it we only spin in user space.
+void rudp_spin_socket(RUDP_Socket *sockfd, int fd) {
+#ifdef SO_BUSY_POLL
+    if (sockfd->spin_us == 0 && !sockfd->busy_poll) {
+        return;
+    }
+    int busy_us = sockfd->spin_us > 0 ? RUDP_BUSY_POLL_US : 0;
+    bool taken = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_us, sizeof(busy_us)) == 0;
+    if (fd == sockfd->socket_fd) {
+        sockfd->busy_poll = taken && busy_us > 0;
+    }
+#else
+    (void)sockfd;
+    (void)fd;
+#endif
+}
+
+/*
+* @brief Read whatever the subflow sockets hold without blocking, batches of up to RUDP_SPIN_BATCH per recvmmsg(),
+* until something arrives, the spin budget runs out or wake_us comes.
+* @return The number of datagrams processed, 0 if none came, -1 on error.
+*/
+int rudp_spin(RUDP_Socket *sockfd, long long wake_us) {
+    RUDP_Packet packets[RUDP_SPIN_BATCH];
+    struct iovec iov[RUDP_SPIN_BATCH];
+    struct sockaddr_in from[RUDP_SPIN_BATCH];
+    char control[RUDP_SPIN_BATCH][CMSG_SPACE(sizeof(unsigned int))];
+    struct mmsghdr msgs[RUDP_SPIN_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RUDP_SPIN_BATCH; i++) {
+        iov[i].iov_base = &packets[i];
+        iov[i].iov_len = sizeof(packets[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_control = control[i];
+    }
+
+    long long end_us = rudp_now_us() + sockfd->spin_us;
+    if (wake_us != 0 && wake_us < end_us) {
+        end_us = wake_us;
+    }
+    int received = 0;
+    for (;;) {
+        for (unsigned int p = 0; p < sockfd->path_count; p++) {
+            int fd = rudp_path_fd(sockfd, p);
+            if (fd < 0 || (p > 0 && fd == sockfd->socket_fd)) {
+                continue; // Not open, or the server's subflows sharing its one socket
+            }
+            for (int i = 0; i < RUDP_SPIN_BATCH; i++) {
+                msgs[i].msg_hdr.msg_namelen = sizeof(from[i]); // The kernel writes back what it filled in
+                msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+            int count = recvmmsg(fd, msgs, RUDP_SPIN_BATCH, MSG_DONTWAIT, NULL);
+            if (count < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    continue;
+                }
+                perror("recvmmsg");
+                return -1;
+            }
+            for (int i = 0; i < count; i++) {
+                if (rudp_poll_datagram(sockfd, fd, &msgs[i].msg_hdr, msgs[i].msg_len) < 0) {
+                    return -1;
+                }
+            }
+            received += count;
+        }
+        if (received > 0) {
+            sockfd->stats.spin_hits++;
+            return received;
+        }
+        if (rudp_now_us() >= end_us) {
+            sockfd->stats.spin_misses++;
+            return 0;
+        }
+        sched_yield(); // Returns at once on a dedicated core, on a shared one it lets the peer we wait for run
+    }
+}